@@ -6,6 +6,15 @@ in VertexOut {
     vec3 ws_position;
     vec3 ws_normal;
     vec2 texture_coordinate;
+#ifdef INSTANCED
+    flat vec3 diffuse_tint;
+    flat vec3 specular_tint;
+    flat vec3 ambient_tint;
+    flat float shininess;
+#endif
+#ifdef TEXTURE_ARRAYS
+    flat vec2 texture_layers;
+#endif
 } frag_in;
 
 layout(location = 0) out vec4 out_colour;
@@ -13,14 +22,22 @@ layout(location = 0) out vec4 out_colour;
 // Global Data
 uniform float inverse_gamma;
 
+#ifdef TEXTURE_ARRAYS
+// Each instance's textures are layers of these, picked by its texture_layers
+uniform sampler2DArray diffuse_texture;
+uniform sampler2DArray specular_map_texture;
+#else
 uniform sampler2D diffuse_texture;
 uniform sampler2D specular_map_texture;
+#endif
 
 // Material properties from vert.glsl for task g
+#ifndef INSTANCED
 uniform vec3 diffuse_tint;
 uniform vec3 specular_tint;
 uniform vec3 ambient_tint;
 uniform float shininess;
+#endif
 
 // Light Data from vert.glsl for task g
 #if NUM_PL > 0
@@ -43,7 +60,11 @@ void main() {
     // Per fragment lighting calculations from vert.glsl for task g
     vec3 ws_view_dir = normalize(ws_view_position - frag_in.ws_position);
     LightCalculatioData light_calculation_data = LightCalculatioData(frag_in.ws_position, ws_view_dir, normalize(frag_in.ws_normal));
+#ifdef INSTANCED
+    Material material = Material(frag_in.diffuse_tint, frag_in.specular_tint, frag_in.ambient_tint, frag_in.shininess);
+#else
     Material material = Material(diffuse_tint, specular_tint, ambient_tint, shininess);
+#endif
     
     LightingResult lighting_result = total_light_calculation(light_calculation_data, material
         #if NUM_PL > 0
@@ -56,7 +77,11 @@ void main() {
     );
     
     // Resolve the per fragment lighting with texture sampling, changed frag_in.lighting_result to lighting_result for task g
+#ifdef TEXTURE_ARRAYS
+    vec3 resolved_lighting = resolve_textured_light_calculation(lighting_result, diffuse_texture, specular_map_texture, frag_in.texture_coordinate, frag_in.texture_layers);
+#else
     vec3 resolved_lighting = resolve_textured_light_calculation(lighting_result, diffuse_texture, specular_map_texture, frag_in.texture_coordinate);
+#endif
     out_colour = vec4(resolved_lighting, 1.0f);
     out_colour.rgb = pow(out_colour.rgb, vec3(inverse_gamma));
 }
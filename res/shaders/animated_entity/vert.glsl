@@ -14,20 +14,64 @@ out VertexOut {
     vec3 ws_position;
     vec3 ws_normal;
     vec2 texture_coordinate;
+#ifdef INSTANCED
+    // Material properties, passed through from the per instance attributes
+    flat vec3 diffuse_tint;
+    flat vec3 specular_tint;
+    flat vec3 ambient_tint;
+    flat float shininess;
+#endif
+#ifdef TEXTURE_ARRAYS
+    flat vec2 texture_layers;
+#endif
 } vertex_out;
 
+// The depth pre-pass draws with this same shader, and the lit pass then tests for equal depth, so positions must match exactly between programs
+invariant gl_Position;
+
 // Per instance data
+#ifdef INSTANCED
+layout(location = 5) in mat4 instance_model_matrix;
+layout(location = 12) in vec3 instance_diffuse_tint;
+layout(location = 13) in vec3 instance_specular_tint;
+// (ambient_tint, shininess)
+layout(location = 14) in vec4 instance_ambient_tint_shininess;
+// (texture_scale, texture_layers)
+layout(location = 15) in vec4 instance_texture_scale_layers;
+
+// The transformation of the node being drawn within the hierarchy, shared by every instance
+uniform mat4 node_matrix;
+#else
 uniform mat4 model_matrix;
 
 // moved material properties to frag.glsl for task g
 
 // added for task e
 uniform vec2 texture_scale;
+#endif
 
 // moved light data to frag.glsl for task g
 
 // Animation Data
-uniform mat4 bone_transforms[BONE_TRANSFORMS];
+// The bone transforms of every posed instance, one mat4 per 4 texels
+uniform samplerBuffer bone_palettes;
+#if defined(BAKED)
+// bone_palettes holds the hierarchy's baked frames, of palette_size bones each, which each instance picks from by time
+// [first_instance + gl_InstanceID] -> (first_frame, frame_count, animation_time_seconds, unused)
+uniform samplerBuffer baked_instances;
+uniform int first_instance;
+uniform float bake_frame_rate;
+uniform int palette_size;
+#elif defined(INSTANCED)
+// [first_instance + gl_InstanceID] -> index in bone_palettes of the instance's first bone
+uniform usamplerBuffer instance_palettes;
+uniform int first_instance;
+#else
+// Index in bone_palettes of the entity's first bone
+uniform int palette_offset;
+#endif
+// Index of the mesh's first bone within a palette, or -1 if the mesh has no bones
+uniform int mesh_bone_offset;
 
 // Global data
 // moved ws_view_position to frag.glsl for task g
@@ -35,16 +79,49 @@ uniform mat4 projection_view_matrix;
 
 // removed specular_map_texture for task g
 
+mat4 fetch_bone_transform(int index) {
+    return mat4(
+        texelFetch(bone_palettes, index * 4),
+        texelFetch(bone_palettes, index * 4 + 1),
+        texelFetch(bone_palettes, index * 4 + 2),
+        texelFetch(bone_palettes, index * 4 + 3)
+    );
+}
+
 void main() {
+#ifdef INSTANCED
+    mat4 model_matrix = instance_model_matrix * node_matrix;
+    vec2 texture_scale = instance_texture_scale_layers.xy;
+    vertex_out.diffuse_tint = instance_diffuse_tint;
+    vertex_out.specular_tint = instance_specular_tint;
+    vertex_out.ambient_tint = instance_ambient_tint_shininess.xyz;
+    vertex_out.shininess = instance_ambient_tint_shininess.w;
+#endif
+#ifdef TEXTURE_ARRAYS
+    vertex_out.texture_layers = instance_texture_scale_layers.zw;
+#endif
+
     // Transform vertices
-    float sum = dot(bone_weights, vec4(1.0f));
-
-    mat4 bone_transform =
-        bone_weights[0] * bone_transforms[bone_indices[0]]
-        + bone_weights[1] * bone_transforms[bone_indices[1]]
-        + bone_weights[2] * bone_transforms[bone_indices[2]]
-        + bone_weights[3] * bone_transforms[bone_indices[3]]
-        + (1.0f - sum) * mat4(1.0f);
+    mat4 bone_transform = mat4(1.0f);
+    if (mesh_bone_offset >= 0) {
+#if defined(BAKED)
+        vec4 baked_instance = texelFetch(baked_instances, first_instance + gl_InstanceID);
+        int frame = min(int(baked_instance.z * bake_frame_rate + 0.5f), int(baked_instance.y) - 1);
+        int palette = (int(baked_instance.x) + frame) * palette_size + mesh_bone_offset;
+#elif defined(INSTANCED)
+        int palette = int(texelFetch(instance_palettes, first_instance + gl_InstanceID).r) + mesh_bone_offset;
+#else
+        int palette = palette_offset + mesh_bone_offset;
+#endif
+        float sum = dot(bone_weights, vec4(1.0f));
+
+        bone_transform =
+            bone_weights[0] * fetch_bone_transform(palette + int(bone_indices[0]))
+            + bone_weights[1] * fetch_bone_transform(palette + int(bone_indices[1]))
+            + bone_weights[2] * fetch_bone_transform(palette + int(bone_indices[2]))
+            + bone_weights[3] * fetch_bone_transform(palette + int(bone_indices[3]))
+            + (1.0f - sum) * mat4(1.0f);
+    }
 
     mat4 animation_matrix = model_matrix * bone_transform;
     mat3 normal_matrix = cofactor(animation_matrix);
@@ -5,6 +5,10 @@
 #ifndef NUM_DL
 #define NUM_DL 0
 #endif
+// Clustered point lights, see ClusteredLights.h, replaces the NUM_PL nearest point lights
+#ifndef CLUSTERED
+#define CLUSTERED 0
+#endif
 
 // Material Properties
 struct Material {
@@ -85,6 +89,30 @@ void directional_light_calculation(DirectionalLightData directional_light, Light
     total_ambient += ambient_component;
 }
 
+#if CLUSTERED
+// Must match ClusteredLights::ClusterData
+layout (std140) uniform ClusterData {
+    vec4 cluster_depth_plane;
+    // (tiles per pixel in x, tiles per pixel in y, near, slices / log(far / near))
+    vec4 cluster_slice_params;
+    uvec4 cluster_grid_size;
+};
+
+// Two texels per light: (position, radius), (colour, 0)
+uniform samplerBuffer clustered_point_lights;
+// (offset into cluster_light_indices, count) per cluster
+uniform usamplerBuffer cluster_ranges;
+uniform usamplerBuffer cluster_light_indices;
+
+// Only usable from a fragment shader, since the tile is found from gl_FragCoord
+int cluster_index(vec3 ws_position) {
+    uvec2 tile = min(uvec2(gl_FragCoord.xy * cluster_slice_params.xy), cluster_grid_size.xy - 1u);
+    float depth = max(dot(cluster_depth_plane.xyz, ws_position) + cluster_depth_plane.w, cluster_slice_params.z);
+    uint slice = min(uint(log(depth / cluster_slice_params.z) * cluster_slice_params.w), cluster_grid_size.z - 1u);
+    return int(tile.x + cluster_grid_size.x * (tile.y + cluster_grid_size.y * slice));
+}
+#endif
+
 // Total Calculation
 
 struct LightingResult {
@@ -113,6 +141,21 @@ LightingResult total_light_calculation(LightCalculatioData light_calculation_dat
     }
     #endif
 
+    #if CLUSTERED
+    uvec2 cluster_range = texelFetch(cluster_ranges, cluster_index(light_calculation_data.ws_frag_position)).xy;
+    for (uint i = 0u; i < cluster_range.y; i++) {
+        int light = int(texelFetch(cluster_light_indices, int(cluster_range.x + i)).x);
+        vec4 position_radius = texelFetch(clustered_point_lights, 2 * light);
+        vec3 colour = texelFetch(clustered_point_lights, 2 * light + 1).rgb;
+
+        // Fade out to nothing at the radius the light was assigned to clusters with, so the cut off isn't visible
+        float falloff = clamp(1.0f - pow(distance(position_radius.xyz, light_calculation_data.ws_frag_position) / position_radius.w, 4.0f), 0.0f, 1.0f);
+        falloff *= falloff;
+
+        point_light_calculation(PointLightData(position_radius.xyz, falloff * colour), light_calculation_data, material.shininess, total_diffuse, total_specular, total_ambient);
+    }
+    #endif
+
     #if NUM_DL > 0
     for (int i = 0; i < NUM_DL; i++) {
         directional_light_calculation(directional_lights[i], light_calculation_data, material.shininess, total_diffuse, total_specular, total_ambient);
@@ -123,6 +166,10 @@ LightingResult total_light_calculation(LightCalculatioData light_calculation_dat
     total_ambient /= float(NUM_PL);
     #endif
 
+    #if CLUSTERED
+    total_ambient /= float(max(cluster_range.y, 1u));
+    #endif
+
     total_diffuse *= material.diffuse_tint;
     total_specular *= material.specular_tint;
     total_ambient *= material.ambient_tint;
@@ -130,14 +177,24 @@ LightingResult total_light_calculation(LightCalculatioData light_calculation_dat
     return LightingResult(total_diffuse, total_specular, total_ambient);
 }
 
-vec3 resolve_textured_light_calculation(LightingResult result, sampler2D diffuse_texture, sampler2D specular_map, vec2 texture_coordinate) {
-    vec3 texture_colour = texture(diffuse_texture, texture_coordinate).rgb;
-    vec3 specular_map_sample = texture(specular_map, texture_coordinate).rgb;
-
+vec3 resolve_sampled_light_calculation(LightingResult result, vec3 texture_colour, vec3 specular_map_sample) {
     vec3 textured_diffuse = result.total_diffuse * texture_colour;
     vec3 sampled_specular = result.total_specular * specular_map_sample;
     vec3 textured_ambient = result.total_ambient * texture_colour;
 
     // Mix the diffuse and ambient so that there is no ambient in bright scenes
     return max(textured_diffuse, textured_ambient) + sampled_specular;
+}
+
+vec3 resolve_textured_light_calculation(LightingResult result, sampler2D diffuse_texture, sampler2D specular_map, vec2 texture_coordinate) {
+    vec3 texture_colour = texture(diffuse_texture, texture_coordinate).rgb;
+    vec3 specular_map_sample = texture(specular_map, texture_coordinate).rgb;
+    return resolve_sampled_light_calculation(result, texture_colour, specular_map_sample);
+}
+
+// As above, with each texture being a layer of a texture array, texture_layers being (diffuse layer, specular map layer)
+vec3 resolve_textured_light_calculation(LightingResult result, sampler2DArray diffuse_texture, sampler2DArray specular_map, vec2 texture_coordinate, vec2 texture_layers) {
+    vec3 texture_colour = texture(diffuse_texture, vec3(texture_coordinate, texture_layers.x)).rgb;
+    vec3 specular_map_sample = texture(specular_map, vec3(texture_coordinate, texture_layers.y)).rgb;
+    return resolve_sampled_light_calculation(result, texture_colour, specular_map_sample);
 }
\ No newline at end of file
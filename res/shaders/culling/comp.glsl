@@ -0,0 +1,40 @@
+#version 430 core
+
+// Frustum culls one draw per invocation, by setting the instance count of its indirect command to 0 or 1.
+// See GpuCuller.
+
+layout(local_size_x = WORK_GROUP_SIZE) in;
+
+struct DrawCommand {
+    uint count;
+    uint instance_count;
+    uint first_index;
+    int base_vertex;
+    uint base_instance;
+};
+
+// World space (centre, radius) of each draw
+layout(std430, binding = 0) readonly buffer BoundingSpheres {
+    vec4 bounding_spheres[];
+};
+
+layout(std430, binding = 1) buffer DrawCommands {
+    DrawCommand draw_commands[];
+};
+
+// (a, b, c, d), such that a point is inside when dot(plane.xyz, point) + plane.w >= 0
+uniform vec4 frustum_planes[6];
+uniform uint draw_count;
+
+void main() {
+    uint draw = gl_GlobalInvocationID.x;
+    if (draw >= draw_count) return;
+
+    vec4 sphere = bounding_spheres[draw];
+    bool visible = true;
+    for (int i = 0; i < 6; ++i) {
+        visible = visible && dot(frustum_planes[i].xyz, sphere.xyz) + frustum_planes[i].w >= -sphere.w;
+    }
+
+    draw_commands[draw].instance_count = visible ? 1u : 0u;
+}
@@ -0,0 +1,4 @@
+#version 410 core
+
+// Used for the depth pre-pass, where only the depth buffer is written, so there is nothing to compute
+void main() {}
@@ -3,12 +3,17 @@
 in VertexOut {
     vec3 ws_position;
     vec2 texture_coordinate;
+#ifdef INSTANCED
+    flat vec3 emissive_tint;
+#endif
 } frag_in;
 
 layout(location = 0) out vec4 out_colour;
 
 // Material properties
+#ifndef INSTANCED
 uniform vec3 emissive_tint;
+#endif
 
 // Global Data
 uniform float inverse_gamma;
@@ -17,7 +22,11 @@ uniform sampler2D emissive_texture;
 
 void main() {
     vec3 texture_colour = texture(emissive_texture, frag_in.texture_coordinate).rgb;
+#ifdef INSTANCED
+    vec3 emissive_colour = frag_in.emissive_tint * texture_colour;
+#else
     vec3 emissive_colour = emissive_tint * texture_colour;
+#endif
 
     out_colour = vec4(emissive_colour, 1.0f);
     out_colour.rgb = pow(out_colour.rgb, vec3(inverse_gamma));
@@ -7,15 +7,26 @@ layout(location = 2) in vec2 texture_coordinate;
 out VertexOut {
     vec3 ws_position;
     vec2 texture_coordinate;
+#ifdef INSTANCED
+    flat vec3 emissive_tint;
+#endif
 } vertex_out;
 
 // Per instance data
+#ifdef INSTANCED
+layout(location = 5) in mat4 model_matrix;
+layout(location = 9) in vec3 instance_emissive_tint;
+#else
 uniform mat4 model_matrix;
+#endif
 
 // Global data
 uniform mat4 projection_view_matrix;
 
 void main() {
+#ifdef INSTANCED
+    vertex_out.emissive_tint = instance_emissive_tint;
+#endif
     vertex_out.ws_position = (model_matrix * vec4(vertex_position, 1.0f)).xyz;
     vertex_out.texture_coordinate = texture_coordinate;
 
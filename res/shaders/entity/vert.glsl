@@ -11,9 +11,32 @@ out VertexOut {
     vec3 ws_position;
     vec3 ws_normal;
     vec2 texture_coordinate;
+#ifdef INSTANCED
+    // Material properties, passed through from the per instance attributes
+    flat vec3 diffuse_tint;
+    flat vec3 specular_tint;
+    flat vec3 ambient_tint;
+    flat float shininess;
+#endif
+#ifdef TEXTURE_ARRAYS
+    flat vec2 texture_layers;
+#endif
 } vertex_out;
 
+// The depth pre-pass draws with this same shader, and the lit pass then tests for equal depth, so positions must match exactly between programs
+invariant gl_Position;
+
 // Per instance data
+#ifdef INSTANCED
+layout(location = 5) in mat4 model_matrix;
+layout(location = 9) in mat3 normal_matrix;
+layout(location = 12) in vec3 instance_diffuse_tint;
+layout(location = 13) in vec3 instance_specular_tint;
+// (ambient_tint, shininess)
+layout(location = 14) in vec4 instance_ambient_tint_shininess;
+// (texture_scale, texture_layers)
+layout(location = 15) in vec4 instance_texture_scale_layers;
+#else
 uniform mat4 model_matrix;
 uniform mat3 normal_matrix;
 
@@ -21,6 +44,7 @@ uniform mat3 normal_matrix;
 
 // added for task e
 uniform vec2 texture_scale;
+#endif
 
 // moved Light Data segment to frag.glsl for task g
 
@@ -29,6 +53,17 @@ uniform vec2 texture_scale;
 uniform mat4 projection_view_matrix;
 
 void main() {
+#ifdef INSTANCED
+    vec2 texture_scale = instance_texture_scale_layers.xy;
+    vertex_out.diffuse_tint = instance_diffuse_tint;
+    vertex_out.specular_tint = instance_specular_tint;
+    vertex_out.ambient_tint = instance_ambient_tint_shininess.xyz;
+    vertex_out.shininess = instance_ambient_tint_shininess.w;
+#endif
+#ifdef TEXTURE_ARRAYS
+    vertex_out.texture_layers = instance_texture_scale_layers.zw;
+#endif
+
     // Transform vertices
     // changed data type to output for task g
     vertex_out.ws_position = (model_matrix * vec4(vertex_position, 1.0f)).xyz;
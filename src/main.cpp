@@ -85,6 +85,9 @@ int main() {
             }
             // Tell the MasterRenderer that we are staring a new frame
             master_renderer.update(window);
+            // Upload the models and textures that have finished loading in the background, a few each frame so the frame rate holds
+            model_loader.process_uploads();
+            texture_loader.process_uploads();
 
             if (scene_context.imgui_enabled) {
                 // Create an ImGUI window for global options, that are independent of the scene
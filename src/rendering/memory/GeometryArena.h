@@ -0,0 +1,201 @@
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <glad/gl.h>
+
+#include "utility/HelperTypes.h"
+#include "RangeAllocator.h"
+
+/// One large vertex buffer and index buffer, with a single VAO, shared by every model of a VertexData type.
+/// Models are sub-allocated out of it and drawn with a base vertex and first index, so switching between models
+/// doesn't need a VAO change, and many models can be drawn by one multi-draw call.
+/// The buffers grow (by copying into larger ones) when they run out of space, which doesn't move any existing allocations.
+template<typename VertexData>
+class GeometryArena : NonCopyable {
+    static constexpr size_t INITIAL_VERTICES = 1 << 16;
+    static constexpr size_t INITIAL_INDICES = 3 << 16;
+
+    uint vao = 0;
+    uint vertex_vbo = 0;
+    uint index_vbo = 0;
+    RangeAllocator vertex_ranges{};
+    RangeAllocator index_ranges{};
+    // Ids of freed allocations, handed out again before new ones so that the ids stay dense
+    std::vector<uint> free_model_ids{};
+    uint next_model_id = 0;
+public:
+    /// A range of the arena belonging to one model
+    struct Allocation {
+        size_t first_vertex;
+        size_t vertex_count;
+        size_t first_index;
+        size_t index_count;
+        // Small and unique among the arena's live allocations, for telling models apart where the VAO can't
+        uint model_id;
+    };
+
+    GeometryArena();
+
+    /// The arena for VertexData, which is created when first needed, and destroyed once the last model using it is
+    static std::shared_ptr<GeometryArena> get();
+
+    /// Copy the model into the arena, the indices are relative to the model's first vertex
+    Allocation allocate(const std::vector<VertexData>& vertices, const std::vector<uint>& indices);
+    /// As above, for geometry that isn't in vectors, such as a mapped mesh cache entry
+    Allocation allocate(const VertexData* vertices, size_t vertex_count, const uint* indices, size_t index_count);
+    /// Return the ranges of a model for reuse
+    void free(const Allocation& allocation);
+
+    [[nodiscard]] uint get_vao() const;
+    [[nodiscard]] uint get_vertex_vbo() const;
+    [[nodiscard]] uint get_index_vbo() const;
+
+    ~GeometryArena();
+private:
+    /// Replace `buffer` with a larger one holding the same contents
+    static void grow_buffer(uint& buffer, size_t old_size, size_t new_size);
+    /// Point the VAO at the current buffers, needed after either is replaced
+    void setup_vao();
+};
+
+template<typename VertexData>
+GeometryArena<VertexData>::GeometryArena() {
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vertex_vbo);
+    glGenBuffers(1, &index_vbo);
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, vertex_vbo);
+    glBufferData(GL_COPY_WRITE_BUFFER, (long) (INITIAL_VERTICES * sizeof(VertexData)), nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, index_vbo);
+    glBufferData(GL_COPY_WRITE_BUFFER, (long) (INITIAL_INDICES * sizeof(uint)), nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    vertex_ranges.grow(INITIAL_VERTICES);
+    index_ranges.grow(INITIAL_INDICES);
+
+    setup_vao();
+}
+
+template<typename VertexData>
+std::shared_ptr<GeometryArena<VertexData>> GeometryArena<VertexData>::get() {
+    // Only weakly held here, so that the buffers are freed while there is still a GL context, rather than at static destruction
+    static std::weak_ptr<GeometryArena> arena{};
+    auto shared = arena.lock();
+    if (shared == nullptr) {
+        shared = std::make_shared<GeometryArena>();
+        arena = shared;
+    }
+    return shared;
+}
+
+template<typename VertexData>
+typename GeometryArena<VertexData>::Allocation GeometryArena<VertexData>::allocate(const std::vector<VertexData>& vertices, const std::vector<uint>& indices) {
+    return allocate(vertices.data(), vertices.size(), indices.data(), indices.size());
+}
+
+template<typename VertexData>
+typename GeometryArena<VertexData>::Allocation GeometryArena<VertexData>::allocate(const VertexData* vertices, size_t vertex_count, const uint* indices, size_t index_count) {
+    auto first_vertex = vertex_ranges.allocate(vertex_count);
+    auto first_index = index_ranges.allocate(index_count);
+
+    if (!first_vertex.has_value() || !first_index.has_value()) {
+        // Don't hold on to half an allocation while growing
+        if (first_vertex.has_value()) vertex_ranges.free(first_vertex.value(), vertex_count);
+        if (first_index.has_value()) index_ranges.free(first_index.value(), index_count);
+
+        size_t vertex_capacity = vertex_ranges.get_capacity();
+        size_t index_capacity = index_ranges.get_capacity();
+        // Grow geometrically, enough that the model fits even if none of the current free space is usable
+        size_t new_vertex_capacity = std::max(vertex_capacity * 2, vertex_capacity + vertex_count);
+        size_t new_index_capacity = std::max(index_capacity * 2, index_capacity + index_count);
+
+        if (!first_vertex.has_value()) {
+            grow_buffer(vertex_vbo, vertex_capacity * sizeof(VertexData), new_vertex_capacity * sizeof(VertexData));
+            vertex_ranges.grow(new_vertex_capacity);
+        }
+        if (!first_index.has_value()) {
+            grow_buffer(index_vbo, index_capacity * sizeof(uint), new_index_capacity * sizeof(uint));
+            index_ranges.grow(new_index_capacity);
+        }
+        setup_vao();
+
+        first_vertex = vertex_ranges.allocate(vertex_count);
+        first_index = index_ranges.allocate(index_count);
+    }
+
+    uint model_id = next_model_id;
+    if (free_model_ids.empty()) {
+        ++next_model_id;
+    } else {
+        model_id = free_model_ids.back();
+        free_model_ids.pop_back();
+    }
+
+    Allocation allocation{first_vertex.value(), vertex_count, first_index.value(), index_count, model_id};
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, vertex_vbo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, (long) (allocation.first_vertex * sizeof(VertexData)), (long) (vertex_count * sizeof(VertexData)), vertices);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, index_vbo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, (long) (allocation.first_index * sizeof(uint)), (long) (index_count * sizeof(uint)), indices);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    return allocation;
+}
+
+template<typename VertexData>
+void GeometryArena<VertexData>::free(const Allocation& allocation) {
+    vertex_ranges.free(allocation.first_vertex, allocation.vertex_count);
+    index_ranges.free(allocation.first_index, allocation.index_count);
+    free_model_ids.push_back(allocation.model_id);
+}
+
+template<typename VertexData>
+uint GeometryArena<VertexData>::get_vao() const {
+    return vao;
+}
+
+template<typename VertexData>
+uint GeometryArena<VertexData>::get_vertex_vbo() const {
+    return vertex_vbo;
+}
+
+template<typename VertexData>
+uint GeometryArena<VertexData>::get_index_vbo() const {
+    return index_vbo;
+}
+
+template<typename VertexData>
+void GeometryArena<VertexData>::grow_buffer(uint& buffer, size_t old_size, size_t new_size) {
+    uint new_buffer;
+    glGenBuffers(1, &new_buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, new_buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, (long) new_size, nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, (long) old_size);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    glDeleteBuffers(1, &buffer);
+    buffer = new_buffer;
+}
+
+template<typename VertexData>
+void GeometryArena<VertexData>::setup_vao() {
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_vbo);
+    VertexData::setup_attrib_pointers();
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_vbo);
+    glBindVertexArray(0);
+}
+
+template<typename VertexData>
+GeometryArena<VertexData>::~GeometryArena() {
+    glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(1, &vertex_vbo);
+    glDeleteBuffers(1, &index_vbo);
+}
+
+#endif //GEOMETRY_ARENA_H
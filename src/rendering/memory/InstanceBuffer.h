@@ -0,0 +1,56 @@
+#ifndef INSTANCE_BUFFER_H
+#define INSTANCE_BUFFER_H
+
+#include <vector>
+#include <algorithm>
+#include <glad/gl.h>
+
+#include "utility/HelperTypes.h"
+
+/// A helper class that abstracts over a Vertex Buffer Object used for per instance vertex attributes,
+/// as a type safe array that is rewritten every frame and grows to fit however many instances are drawn.
+template<typename T>
+class InstanceBuffer : NonCopyable {
+    uint vbo = 0;
+    size_t capacity = 0;
+public:
+    /// The CPU side buffer that will be mirror on the GPU
+    std::vector<T> data{};
+
+    InstanceBuffer();
+    /// Upload the CPU side to the GPU, orphaning the old storage so the driver doesn't need to wait for draws still using it
+    void upload();
+    /// The name of the underlying buffer, for binding to GL_ARRAY_BUFFER before setting up attribute pointers
+    [[nodiscard]] uint id() const;
+
+    ~InstanceBuffer();
+};
+
+template<typename T>
+InstanceBuffer<T>::InstanceBuffer() {
+    glGenBuffers(1, &vbo);
+}
+
+template<typename T>
+void InstanceBuffer<T>::upload() {
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    if (data.size() > capacity) {
+        // Grow geometrically so a slowly growing scene doesn't reallocate every frame
+        capacity = std::max(data.size(), capacity * 2);
+    }
+    glBufferData(GL_ARRAY_BUFFER, (long) (capacity * sizeof(T)), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, (long) (data.size() * sizeof(T)), data.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+template<typename T>
+uint InstanceBuffer<T>::id() const {
+    return vbo;
+}
+
+template<typename T>
+InstanceBuffer<T>::~InstanceBuffer() {
+    glDeleteBuffers(1, &vbo);
+}
+
+#endif //INSTANCE_BUFFER_H
@@ -0,0 +1,68 @@
+#include "PixelUploadRing.h"
+
+#include <cstring>
+
+PixelUploadRing::PixelUploadRing() {
+    for (auto& buffer: buffers) {
+        glGenBuffers(1, &buffer.pbo);
+    }
+}
+
+bool PixelUploadRing::ready() {
+    auto& buffer = buffers[next];
+    if (buffer.fence == nullptr) return true;
+
+    // Flushed so that the fence is guaranteed to signal eventually, but never waited on
+    GLenum result = glClientWaitSync(buffer.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (result == GL_TIMEOUT_EXPIRED) return false;
+
+    glDeleteSync(buffer.fence);
+    buffer.fence = nullptr;
+    return true;
+}
+
+void PixelUploadRing::upload(int level, int y_offset, int width, int height, uint format, const void* pixels, size_t size) {
+    stage(pixels, size);
+    // With an unpack buffer bound, the pointer is an offset into it
+    glTexSubImage2D(GL_TEXTURE_2D, level, 0, y_offset, width, height, format, GL_UNSIGNED_BYTE, nullptr);
+    finish();
+}
+
+void PixelUploadRing::upload_compressed(int level, int y_offset, int width, int height, uint internal_format, const void* blocks, size_t size) {
+    stage(blocks, size);
+    glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, y_offset, width, height, internal_format, (int) size, nullptr);
+    finish();
+}
+
+void PixelUploadRing::stage(const void* data, size_t size) {
+    auto& buffer = buffers[next];
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.pbo);
+    if (size > buffer.capacity) {
+        buffer.capacity = size;
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, (long) buffer.capacity, nullptr, GL_STREAM_DRAW);
+    }
+
+    // The buffer is free (see ready), so invalidating it lets the driver hand out memory without synchronising
+    void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (long) size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (mapped != nullptr) {
+        std::memcpy(mapped, data, size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    } else {
+        glBufferSubData(GL_PIXEL_UNPACK_BUFFER, 0, (long) size, data);
+    }
+}
+
+void PixelUploadRing::finish() {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    buffers[next].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    next = (next + 1) % BUFFERS;
+}
+
+PixelUploadRing::~PixelUploadRing() {
+    for (auto& buffer: buffers) {
+        if (buffer.fence != nullptr) glDeleteSync(buffer.fence);
+        glDeleteBuffers(1, &buffer.pbo);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef PIXEL_UPLOAD_RING_H
+#define PIXEL_UPLOAD_RING_H
+
+#include <array>
+#include <cstddef>
+#include <glad/gl.h>
+
+#include "utility/HelperTypes.h"
+
+/// A small ring of Pixel Buffer Objects (GL_PIXEL_UNPACK_BUFFER) for streaming texture data to the GPU.
+///
+/// Each upload is copied into the next buffer of the ring, and glTexSubImage2D then reads it from there, so the call returns
+/// without waiting for the transfer. A fence is placed after each buffer is used, and a buffer the GPU may still be reading
+/// from is reported as not ready rather than waited on, so the caller can carry on next frame instead of stalling this one.
+class PixelUploadRing : NonCopyable {
+public:
+    static constexpr uint BUFFERS = 3;
+private:
+    struct Buffer {
+        uint pbo = 0;
+        size_t capacity = 0;
+        GLsync fence = nullptr;
+    };
+    std::array<Buffer, BUFFERS> buffers{};
+    uint next = 0;
+public:
+    PixelUploadRing();
+
+    /// Whether the next buffer is free to upload through
+    bool ready();
+    /// Upload rows [y_offset, y_offset + height) of level of the texture bound to GL_TEXTURE_2D, through the next buffer.
+    /// Only call once ready() is true. The pixels are tightly packed, so GL_UNPACK_ALIGNMENT must suit format.
+    void upload(int level, int y_offset, int width, int height, uint format, const void* pixels, size_t size);
+    /// As upload, for a block compressed texture of internal_format, where y_offset must be a multiple of the block height
+    void upload_compressed(int level, int y_offset, int width, int height, uint internal_format, const void* blocks, size_t size);
+
+    ~PixelUploadRing();
+private:
+    /// Copy the data into the next buffer, leaving it bound to GL_PIXEL_UNPACK_BUFFER
+    void stage(const void* data, size_t size);
+    /// Fence the buffer just used, and move on to the next
+    void finish();
+};
+
+#endif //PIXEL_UPLOAD_RING_H
@@ -0,0 +1,51 @@
+#include "RangeAllocator.h"
+
+#include <iterator>
+
+std::optional<size_t> RangeAllocator::allocate(size_t size) {
+    if (size == 0) return 0;
+
+    for (auto it = free_ranges.begin(); it != free_ranges.end(); ++it) {
+        auto [offset, free_size] = *it;
+        if (free_size < size) continue;
+
+        free_ranges.erase(it);
+        if (free_size > size) {
+            free_ranges.emplace(offset + size, free_size - size);
+        }
+        return offset;
+    }
+
+    return std::nullopt;
+}
+
+void RangeAllocator::free(size_t offset, size_t size) {
+    if (size == 0) return;
+
+    auto next = free_ranges.lower_bound(offset);
+    // Merge with the following range
+    if (next != free_ranges.end() && offset + size == next->first) {
+        size += next->second;
+        next = free_ranges.erase(next);
+    }
+    // Merge with the preceding range
+    if (next != free_ranges.begin()) {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == offset) {
+            previous->second += size;
+            return;
+        }
+    }
+    free_ranges.emplace_hint(next, offset, size);
+}
+
+void RangeAllocator::grow(size_t new_capacity) {
+    if (new_capacity <= capacity) return;
+    size_t old_capacity = capacity;
+    capacity = new_capacity;
+    free(old_capacity, new_capacity - old_capacity);
+}
+
+size_t RangeAllocator::get_capacity() const {
+    return capacity;
+}
@@ -0,0 +1,25 @@
+#ifndef RANGE_ALLOCATOR_H
+#define RANGE_ALLOCATOR_H
+
+#include <map>
+#include <optional>
+
+/// Hands out ranges of a linear space (e.g. elements of a buffer) of some capacity, using a first fit free list.
+/// Freed ranges are merged with their neighbours so that the space doesn't fragment into unusable pieces.
+class RangeAllocator {
+    // { offset } -> { size }, of the free ranges, which are never adjacent to each other
+    std::map<size_t, size_t> free_ranges{};
+    size_t capacity = 0;
+public:
+    /// The offset of a new range of `size`, or nothing if there isn't a large enough free range (see grow).
+    /// Empty ranges are always at offset 0, and don't need to be freed.
+    std::optional<size_t> allocate(size_t size);
+    /// Return a range given by allocate for reuse
+    void free(size_t offset, size_t size);
+    /// Add space to the end, new_capacity must be at least the current capacity
+    void grow(size_t new_capacity);
+
+    [[nodiscard]] size_t get_capacity() const;
+};
+
+#endif //RANGE_ALLOCATOR_H
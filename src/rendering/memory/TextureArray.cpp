@@ -0,0 +1,66 @@
+#include "TextureArray.h"
+
+static void set_sampling_parameters(uint target, float anisotropy) {
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameterf(target, GL_TEXTURE_MAX_ANISOTROPY, anisotropy);
+}
+
+TextureArray::TextureArray(uint width, uint height, uint level_count, uint internal_format, uint layer_count, float anisotropy) :
+    width(width), height(height), level_count(level_count), internal_format(internal_format), layer_count(layer_count), anisotropy(anisotropy) {
+    glGenTextures(1, &texture_id);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture_id);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, (int) level_count, internal_format, (int) width, (int) height, (int) layer_count);
+    set_sampling_parameters(GL_TEXTURE_2D_ARRAY, anisotropy);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    free_layers.reserve(layer_count);
+    for (uint layer = layer_count; layer > 0; --layer) {
+        free_layers.push_back(layer - 1);
+    }
+}
+
+bool TextureArray::is_supported() {
+    return GLAD_GL_VERSION_4_3;
+}
+
+bool TextureArray::matches(uint other_width, uint other_height, uint other_level_count, uint other_internal_format) const {
+    return width == other_width && height == other_height && level_count == other_level_count && internal_format == other_internal_format;
+}
+
+std::optional<uint> TextureArray::allocate() {
+    if (free_layers.empty()) return std::nullopt;
+    uint layer = free_layers.back();
+    free_layers.pop_back();
+    return layer;
+}
+
+void TextureArray::free(uint layer) {
+    free_layers.push_back(layer);
+}
+
+uint TextureArray::create_view(uint layer) const {
+    // The view's name must not have been bound yet, which would give it storage of its own
+    uint view_id;
+    glGenTextures(1, &view_id);
+    glTextureView(view_id, GL_TEXTURE_2D, texture_id, internal_format, 0, level_count, layer, 1);
+
+    glBindTexture(GL_TEXTURE_2D, view_id);
+    set_sampling_parameters(GL_TEXTURE_2D, anisotropy);
+    return view_id;
+}
+
+uint TextureArray::get_texture_id() const {
+    return texture_id;
+}
+
+uint TextureArray::get_layer_count() const {
+    return layer_count;
+}
+
+TextureArray::~TextureArray() {
+    // Views hold on to the storage themselves, so this is safe even while some are still around
+    glDeleteTextures(1, &texture_id);
+}
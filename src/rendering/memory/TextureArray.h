@@ -0,0 +1,48 @@
+#ifndef TEXTURE_ARRAY_H
+#define TEXTURE_ARRAY_H
+
+#include <vector>
+#include <optional>
+#include <glad/gl.h>
+
+#include "utility/HelperTypes.h"
+
+/// A 2D array texture (GL_TEXTURE_2D_ARRAY) holding textures of the same size, format and mip levels, one per layer.
+///
+/// Each texture gets a GL_TEXTURE_2D view of its layer, which it is uploaded and bound through as if it were a texture of
+/// its own, while a shader given the whole array can sample any of them with a layer index. Entities whose textures share
+/// arrays can then be drawn together without rebinding anything between them. The storage is immutable, so the layer count
+/// is fixed when the array is created. Needs GL 4.3 (texture views), see is_supported.
+class TextureArray : NonCopyable {
+    uint texture_id = 0;
+    uint width;
+    uint height;
+    uint level_count;
+    uint internal_format;
+    uint layer_count;
+    float anisotropy;
+    // Popped from the back, so layers are handed out in order
+    std::vector<uint> free_layers{};
+public:
+    /// Allocate storage for layer_count textures of width x height, with level_count mip levels each, in internal_format,
+    /// which must be a sized format. Sampled with trilinear filtering and the given anisotropy, and repeating.
+    TextureArray(uint width, uint height, uint level_count, uint internal_format, uint layer_count, float anisotropy);
+
+    static bool is_supported();
+
+    /// Whether textures of this size and format belong in this array
+    [[nodiscard]] bool matches(uint other_width, uint other_height, uint other_level_count, uint other_internal_format) const;
+    /// Take a free layer, if there is one
+    std::optional<uint> allocate();
+    /// Give back a layer taken by allocate, for a later texture to reuse
+    void free(uint layer);
+    /// Create a GL_TEXTURE_2D view of the layer, which the caller owns, with the same sampling parameters as the array
+    [[nodiscard]] uint create_view(uint layer) const;
+
+    [[nodiscard]] uint get_texture_id() const;
+    [[nodiscard]] uint get_layer_count() const;
+
+    ~TextureArray();
+};
+
+#endif //TEXTURE_ARRAY_H
@@ -0,0 +1,72 @@
+#ifndef TEXTURE_BUFFER_H
+#define TEXTURE_BUFFER_H
+
+#include <vector>
+#include <algorithm>
+#include <glad/gl.h>
+
+#include "utility/HelperTypes.h"
+
+/// A helper class that abstracts over a Buffer Texture (GL_TEXTURE_BUFFER), as a type safe array of unbounded size
+/// that shaders read with texelFetch. Used where data is too large for a Uniform Buffer Object.
+template<typename T>
+class TextureBuffer : NonCopyable {
+    uint buffer = 0;
+    uint texture = 0;
+    size_t capacity = 0;
+public:
+    /// The CPU side buffer that will be mirror on the GPU
+    std::vector<T> data{};
+
+    /// Construct the buffer texture, with `internal_format` describing how each texel of T is seen by the shader (e.g. GL_RGBA32F)
+    explicit TextureBuffer(uint internal_format);
+    /// Upload the CPU side to the GPU, orphaning the old storage so the driver doesn't need to wait for draws still using it
+    void upload();
+    /// Bind the buffer texture to the specified texture unit
+    void bind(uint texture_unit) const;
+
+    ~TextureBuffer();
+};
+
+template<typename T>
+TextureBuffer<T>::TextureBuffer(uint internal_format) {
+    glGenBuffers(1, &buffer);
+    glGenTextures(1, &texture);
+
+    // Buffer textures can't be empty, so always start with space for one element
+    capacity = 1;
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, (long) (capacity * sizeof(T)), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    glBindTexture(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, internal_format, buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+template<typename T>
+void TextureBuffer<T>::upload() {
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    if (data.size() > capacity) {
+        // Grow geometrically so a slowly growing scene doesn't reallocate every frame
+        capacity = std::max(data.size(), capacity * 2);
+    }
+    // The texture refers to the buffer object rather than its storage, so it sees the new storage without being reattached
+    glBufferData(GL_TEXTURE_BUFFER, (long) (capacity * sizeof(T)), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, (long) (data.size() * sizeof(T)), data.data());
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+template<typename T>
+void TextureBuffer<T>::bind(uint texture_unit) const {
+    glActiveTexture(GL_TEXTURE0 + texture_unit);
+    glBindTexture(GL_TEXTURE_BUFFER, texture);
+}
+
+template<typename T>
+TextureBuffer<T>::~TextureBuffer() {
+    glDeleteTextures(1, &texture);
+    glDeleteBuffers(1, &buffer);
+}
+
+#endif //TEXTURE_BUFFER_H
@@ -2,14 +2,44 @@
 #define UNIFORM_BUFFER_ARRAY_H
 
 #include <array>
+#include <cstring>
 #include <glad/gl.h>
 
 #include "utility/HelperTypes.h"
 
+/// How a UniformBufferArray is expected to be updated
+enum class UniformBufferUsage {
+    // Rarely updated
+    Static,
+    // Updated now and then, in place with glBufferSubData
+    Dynamic,
+    // Updated many times a frame (e.g. per draw), see UniformBufferArray for details
+    Streaming,
+};
+
 /// A helper class that abstracts over a Uniform Buffer Object as a type safe array of fixed size.
+///
+/// In Streaming mode the UBO is a persistently mapped ring buffer split into REGIONS regions, and every upload writes
+/// to a fresh aligned range of it, which is then bound with glBindBufferRange. So the driver never has to stall or make a copy
+/// because a draw still in flight reads the old contents. A fence is placed as each region is finished with,
+/// and waited on before the ring comes back around to it, so the CPU never overwrites a range the GPU may still be reading.
+/// Falls back to Dynamic where glBufferStorage isn't available (before GL 4.4, without ARB_buffer_storage).
 template<typename T, unsigned int N>
 class UniformBufferArray : NonCopyable {
+public:
+    static constexpr uint REGIONS = 3;
+    static constexpr uint SLOTS_PER_REGION = 256;
+private:
     uint ubo = 0;
+    bool streaming = false;
+
+    // Streaming state
+    char* mapped = nullptr;
+    // Bytes between consecutive uploads, sizeof(data) rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    size_t slot_size = 0;
+    // The slot holding the latest upload
+    uint slot = REGIONS * SLOTS_PER_REGION - 1;
+    std::array<GLsync, REGIONS> fences{};
 public:
     /// The CPU side buffer that will be mirror on the GPU
     std::array<T, N> data;
@@ -17,24 +47,56 @@ public:
     /// Construct the UBO with an initial state.
     /// is_state means that you do not intend to update it often
     explicit UniformBufferArray(std::array<T, N> data, bool is_static = true);
-    /// Upload the CPU side to the GPU, if a valid index is provided then it will only upload that one element
+    /// Construct the UBO with an initial state, and the given usage
+    UniformBufferArray(std::array<T, N> data, UniformBufferUsage usage);
+    /// Upload the CPU side to the GPU, if a valid index is provided then it will only upload that one element.
+    /// In Streaming mode, the whole array is always uploaded, to a new range, so the UBO must be bound again afterwards for shaders to see it.
     void upload(int index = -1);
-    /// Bind the UBO to the specified binding index
+    /// Bind the UBO to the specified binding index, in Streaming mode this binds the range from the latest upload
     void bind(int binding);
 
     ~UniformBufferArray();
+private:
+    void upload_streaming();
 };
 
 template<typename T, unsigned int N>
-UniformBufferArray<T, N>::UniformBufferArray(std::array<T, N> data, bool is_static): data(data) {
+UniformBufferArray<T, N>::UniformBufferArray(std::array<T, N> data, bool is_static):
+    UniformBufferArray(data, is_static ? UniformBufferUsage::Static : UniformBufferUsage::Dynamic) {}
+
+template<typename T, unsigned int N>
+UniformBufferArray<T, N>::UniformBufferArray(std::array<T, N> data, UniformBufferUsage usage): data(data) {
     glGenBuffers(1, &ubo);
     glBindBuffer(GL_UNIFORM_BUFFER, ubo);
-    glBufferData(GL_UNIFORM_BUFFER, N * sizeof(T), data.data(), is_static ? GL_STATIC_DRAW : GL_DYNAMIC_DRAW);
+
+    streaming = usage == UniformBufferUsage::Streaming && (GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage);
+    if (streaming) {
+        int alignment;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        slot_size = (sizeof(this->data) + alignment - 1) / alignment * alignment;
+
+        auto size = (long) (slot_size * REGIONS * SLOTS_PER_REGION);
+        // Coherent, so writes are visible to the GPU without explicit flushes
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_UNIFORM_BUFFER, size, nullptr, flags);
+        mapped = (char*) glMapBufferRange(GL_UNIFORM_BUFFER, 0, size, flags);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        upload_streaming();
+        return;
+    }
+
+    glBufferData(GL_UNIFORM_BUFFER, N * sizeof(T), this->data.data(), usage == UniformBufferUsage::Static ? GL_STATIC_DRAW : GL_DYNAMIC_DRAW);
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
 template<typename T, unsigned int N>
 void UniformBufferArray<T, N>::upload(int index) {
+    if (streaming) {
+        upload_streaming();
+        return;
+    }
+
     glBindBuffer(GL_UNIFORM_BUFFER, ubo);
     if (index < 0 || index >= (int) N) {
         glBufferSubData(GL_UNIFORM_BUFFER, 0, N * sizeof(T), data.data());
@@ -44,13 +106,56 @@ void UniformBufferArray<T, N>::upload(int index) {
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
+template<typename T, unsigned int N>
+void UniformBufferArray<T, N>::upload_streaming() {
+    uint next_slot = (slot + 1) % (REGIONS * SLOTS_PER_REGION);
+
+    if (next_slot % SLOTS_PER_REGION == 0) {
+        // Leaving a region, so fence it for when the ring comes back around, and wait on the region being entered
+        uint previous_region = slot / SLOTS_PER_REGION;
+        uint next_region = next_slot / SLOTS_PER_REGION;
+        if (fences[previous_region] == nullptr) {
+            fences[previous_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+
+        GLsync fence = fences[next_region];
+        if (fence != nullptr) {
+            // Flush on the first wait so that the fence is guaranteed to signal eventually
+            GLbitfield wait_flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+            while (true) {
+                GLenum result = glClientWaitSync(fence, wait_flags, 1'000'000);
+                if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED) break;
+                wait_flags = 0;
+            }
+            glDeleteSync(fence);
+            fences[next_region] = nullptr;
+        }
+    }
+
+    slot = next_slot;
+    std::memcpy(mapped + slot * slot_size, data.data(), sizeof(data));
+}
+
 template<typename T, unsigned int N>
 void UniformBufferArray<T, N>::bind(int binding) {
+    if (streaming) {
+        glBindBufferRange(GL_UNIFORM_BUFFER, binding, ubo, (long) (slot * slot_size), (long) sizeof(data));
+        return;
+    }
+
     glBindBufferBase(GL_UNIFORM_BUFFER, binding, ubo);
 }
 
 template<typename T, unsigned int N>
 UniformBufferArray<T, N>::~UniformBufferArray() {
+    for (GLsync fence: fences) {
+        if (fence != nullptr) glDeleteSync(fence);
+    }
+    if (mapped != nullptr) {
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
     glDeleteBuffers(1, &ubo);
 }
 
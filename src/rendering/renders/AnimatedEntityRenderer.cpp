@@ -1,84 +1,552 @@
 #include "AnimatedEntityRenderer.h"
 
-AnimatedEntityRenderer::AnimatedEntityShader::AnimatedEntityShader() :
-    BaseLitEntityShader("Animated Entity", "animated_entity/vert.glsl", "animated_entity/frag.glsl", {{"BONE_TRANSFORMS", BONE_TRANSFORMS_STR}}) {
+#include <cmath>
+#include <algorithm>
+
+static std::unordered_map<std::string, std::string> vertex_defines(bool instanced, bool baked) {
+    // Baked poses are looked up per instance, so the baked variant is always instanced
+    if (baked) return {{"INSTANCED", "1"}, {"BAKED", "1"}};
+    if (instanced) return {{"INSTANCED", "1"}};
+    return {};
+}
+
+AnimatedEntityRenderer::AnimatedEntityShader::AnimatedEntityShader(bool instanced, bool baked) :
+    BaseLitEntityShader(baked ? "Baked Animated Entity" : instanced ? "Instanced Animated Entity" : "Animated Entity", "animated_entity/vert.glsl", "animated_entity/frag.glsl",
+                        vertex_defines(instanced, baked),
+                        instanced || baked ? std::unordered_map<std::string, std::string>{{"INSTANCED", "1"}} : std::unordered_map<std::string, std::string>{}) {
 
     get_uniforms_set_bindings();
 }
 
 void AnimatedEntityRenderer::AnimatedEntityShader::get_uniforms_set_bindings() {
     BaseLitEntityShader::get_uniforms_set_bindings(); // Call the base implementation to load all the common uniforms
-    bone_transforms_location = get_uniform_location("bone_transforms");
+    mesh_bone_offset_location = get_uniform_location("mesh_bone_offset");
+    palette_offset_location = get_uniform_location("palette_offset");
+    first_instance_location = get_uniform_location("first_instance");
+    node_matrix_location = get_uniform_location("node_matrix");
+    bake_frame_rate_location = get_uniform_location("bake_frame_rate");
+    palette_size_location = get_uniform_location("palette_size");
+    set_binding("bone_palettes", BONE_PALETTES_TEXTURE_UNIT);
+    set_binding("instance_palettes", INSTANCE_PALETTES_TEXTURE_UNIT);
+    set_binding("baked_instances", BAKED_INSTANCES_TEXTURE_UNIT);
 }
 
 void AnimatedEntityRenderer::AnimatedEntityShader::set_model_matrix(const glm::mat4& model_matrix) {
     glProgramUniformMatrix4fv(id(), model_matrix_location, 1, GL_FALSE, &model_matrix[0][0]);
 }
 
-void AnimatedEntityRenderer::AnimatedEntityShader::set_bone_transforms(const std::vector<glm::mat4>& bone_transforms) {
-    glProgramUniformMatrix4fv(id(), bone_transforms_location, std::min(BONE_TRANSFORMS, (int) bone_transforms.size()), GL_FALSE, &bone_transforms[0][0][0]);
+void AnimatedEntityRenderer::AnimatedEntityShader::set_node_matrix(const glm::mat4& node_matrix) {
+    glProgramUniformMatrix4fv(id(), node_matrix_location, 1, GL_FALSE, &node_matrix[0][0]);
+}
+
+void AnimatedEntityRenderer::AnimatedEntityShader::set_palette_offset(int palette_offset) {
+    glProgramUniform1i(id(), palette_offset_location, palette_offset);
+}
+
+void AnimatedEntityRenderer::AnimatedEntityShader::set_first_instance(int first_instance) {
+    glProgramUniform1i(id(), first_instance_location, first_instance);
+}
+
+void AnimatedEntityRenderer::AnimatedEntityShader::set_mesh_bone_offset(int mesh_bone_offset) {
+    glProgramUniform1i(id(), mesh_bone_offset_location, mesh_bone_offset);
+}
+
+void AnimatedEntityRenderer::AnimatedEntityShader::set_baked_animations(const BakedAnimations& baked_animations, uint palette_size) {
+    glProgramUniform1f(id(), bake_frame_rate_location, baked_animations.frame_rate);
+    glProgramUniform1i(id(), palette_size_location, (int) palette_size);
+}
+
+AnimatedEntityRenderer::AnimatedEntityDepthShader::AnimatedEntityDepthShader(bool instanced, bool baked) :
+    BaseEntityShader(baked ? "Baked Animated Entity Depth" : instanced ? "Instanced Animated Entity Depth" : "Animated Entity Depth", "animated_entity/vert.glsl", "depth/frag.glsl",
+                     vertex_defines(instanced, baked)) {
+
+    get_uniforms_set_bindings();
+}
+
+void AnimatedEntityRenderer::AnimatedEntityDepthShader::get_uniforms_set_bindings() {
+    BaseEntityShader::get_uniforms_set_bindings();
+    mesh_bone_offset_location = get_uniform_location("mesh_bone_offset");
+    palette_offset_location = get_uniform_location("palette_offset");
+    first_instance_location = get_uniform_location("first_instance");
+    node_matrix_location = get_uniform_location("node_matrix");
+    bake_frame_rate_location = get_uniform_location("bake_frame_rate");
+    palette_size_location = get_uniform_location("palette_size");
+    set_binding("bone_palettes", BONE_PALETTES_TEXTURE_UNIT);
+    set_binding("instance_palettes", INSTANCE_PALETTES_TEXTURE_UNIT);
+    set_binding("baked_instances", BAKED_INSTANCES_TEXTURE_UNIT);
+}
+
+void AnimatedEntityRenderer::AnimatedEntityDepthShader::set_model_matrix(const glm::mat4& model_matrix) {
+    glProgramUniformMatrix4fv(id(), model_matrix_location, 1, GL_FALSE, &model_matrix[0][0]);
+}
+
+void AnimatedEntityRenderer::AnimatedEntityDepthShader::set_node_matrix(const glm::mat4& node_matrix) {
+    glProgramUniformMatrix4fv(id(), node_matrix_location, 1, GL_FALSE, &node_matrix[0][0]);
+}
+
+void AnimatedEntityRenderer::AnimatedEntityDepthShader::set_palette_offset(int palette_offset) {
+    glProgramUniform1i(id(), palette_offset_location, palette_offset);
+}
+
+void AnimatedEntityRenderer::AnimatedEntityDepthShader::set_first_instance(int first_instance) {
+    glProgramUniform1i(id(), first_instance_location, first_instance);
+}
+
+void AnimatedEntityRenderer::AnimatedEntityDepthShader::set_mesh_bone_offset(int mesh_bone_offset) {
+    glProgramUniform1i(id(), mesh_bone_offset_location, mesh_bone_offset);
+}
+
+void AnimatedEntityRenderer::AnimatedEntityDepthShader::set_baked_animations(const BakedAnimations& baked_animations, uint palette_size) {
+    glProgramUniform1f(id(), bake_frame_rate_location, baked_animations.frame_rate);
+    glProgramUniform1i(id(), palette_size_location, (int) palette_size);
+}
+
+AnimatedEntityRenderer::AnimatedEntityRenderer::AnimatedEntityRenderer() : shader(), instanced_shader(true), instance_buffer(), depth_shader(), instanced_depth_shader(true),
+                                                                     bone_palettes(GL_RGBA32F), instance_palettes(GL_R32UI),
+                                                                     baked_shader(true, true), baked_depth_shader(true, true), baked_instances(GL_RGBA32F) {
+    int max_texture_buffer_size;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texture_buffer_size);
+    // Each bone takes 4 texels
+    max_palette_bones = (size_t) max_texture_buffer_size / 4;
+}
+
+glm::vec4 AnimatedEntityRenderer::AnimatedEntityRenderer::bounding_sphere(const Entity& entity) {
+    glm::vec4 sphere = entity.mesh_hierarchy->bounds.world_sphere(entity.instance_data.model_matrix);
+    sphere.w *= ANIMATION_BOUNDS_SCALE;
+    return sphere;
+}
+
+AnimatedEntityRenderer::AnimatedEntityRenderer::PoseKey AnimatedEntityRenderer::AnimatedEntityRenderer::pose_key(const Entity& entity) {
+    const auto& state = entity.animation_lod_state;
+    // Without an animation the time and skeleton make no difference
+    if (state.animation_id == NONE_ANIMATION) return {entity.mesh_hierarchy.get(), NONE_ANIMATION, 0, false};
+    return {entity.mesh_hierarchy.get(), state.animation_id, std::llround(state.time_seconds / POSE_TIME_STEP), state.reduced_skeleton};
+}
+
+void AnimatedEntityRenderer::AnimatedEntityRenderer::update_lod_state(const Entity& entity, const GlobalData& global_data) const {
+    auto& state = entity.animation_lod_state;
+    const auto& policy = entity.animation_lod_policy;
+    // A new animation is always shown straight away
+    if (!policy.enabled || state.animation_id != entity.animation_id) {
+        state = {entity.animation_id, entity.animation_time_seconds, false};
+        return;
+    }
+
+    glm::vec4 sphere = bounding_sphere(entity);
+    float view_depth = -(global_data.view_matrix * glm::vec4(glm::vec3(sphere), 1.0f)).z;
+    // The projected diameter over the viewport's height of 2 in NDC, or everything if the camera is inside the bounds
+    float coverage = view_depth > sphere.w ? sphere.w * global_data.projection_matrix[1][1] / view_depth : 1.0f;
+
+    state.reduced_skeleton = coverage < policy.reduced_skeleton_coverage;
+    uint interval = policy.update_interval(coverage);
+    // Staggered by address, so that a crowd of small entities doesn't all update on the same frame
+    auto stagger = (uint64_t) reinterpret_cast<uintptr_t>(&entity) / sizeof(Entity);
+    if (interval != 0 && (frame_index + stagger) % interval == 0) {
+        state.time_seconds = entity.animation_time_seconds;
+    }
 }
 
-// task h
-void AnimatedEntityRenderer::AnimatedEntityShader::set_directional_lights(const std::vector<DirectionalLight>& directional_lights) {
-    uint count = std::min(MAX_DL, (uint) directional_lights.size());
+void AnimatedEntityRenderer::AnimatedEntityRenderer::update_poses(const RenderScene& render_scene, ThreadPool& thread_pool) {
+    ++frame_index;
+    // Entities out of view aren't posed at all, the Animator still advances their clocks
+    Frustum frustum(render_scene.global_data.projection_view_matrix);
+    frustum_culler.cull(frustum, render_scene.entities, bounding_sphere, posed_entities);
+
+    // Last frame's poses are kept, so that poses held by the LOD policy (or paused) don't need calculating again
+    std::swap(pose_indices, previous_pose_indices);
+    std::swap(pose_palettes, previous_pose_palettes);
+
+    // Find the distinct poses, so that a crowd playing the same animation in sync only calculates it once
+    pose_indices.clear();
+    pose_sources.clear();
+    pose_keys.clear();
+    entity_poses.clear();
+    for (const auto* entity: posed_entities) {
+        update_lod_state(*entity, render_scene.global_data);
+        auto key = pose_key(*entity);
+        auto [pose, inserted] = pose_indices.emplace(key, (uint) pose_sources.size());
+        if (inserted) {
+            pose_sources.push_back(entity);
+            pose_keys.push_back(key);
+        }
+        entity_poses.push_back(pose->second);
+    }
+    if (pose_palettes.size() < pose_sources.size()) pose_palettes.resize(pose_sources.size());
+
+    pose_reused.assign(pose_sources.size(), false);
+    for (const auto& [key, pose]: pose_indices) {
+        auto previous = previous_pose_indices.find(key);
+        // A hierarchy reloaded at the address of a freed one would have the same key, but almost certainly not the same palette size
+        if (previous != previous_pose_indices.end() && previous_pose_palettes[previous->second].size() == std::get<0>(key)->palette_size) {
+            std::swap(pose_palettes[pose], previous_pose_palettes[previous->second]);
+            pose_reused[pose] = true;
+        }
+    }
 
-    for (uint i = 0; i < count; i++) {
-        const DirectionalLight& directional_light = directional_lights[i];
-        glm::vec3 scaled_colour = glm::vec3(directional_light.colour) * directional_light.colour.a;
+    // Each pose only writes to its own palette and its source's cursor, and the hierarchies are only read, so poses can be calculated in any order
+    bool all_reused = std::all_of(pose_reused.begin(), pose_reused.end(), [](bool reused) { return reused; });
+    if (!all_reused) {
+        thread_pool.parallel_for(pose_sources.size(), [this](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                if (pose_reused[i]) continue;
+                const auto* entity = pose_sources[i];
+                auto [mesh_hierarchy, animation_id, time_steps, reduced_skeleton] = pose_key(*entity);
+                mesh_hierarchy->calculate_animation(animation_id, (double) time_steps * POSE_TIME_STEP, entity->animation_cursor, pose_palettes[i], reduced_skeleton);
+            }
+        });
+    }
+
+    // While the same poses come out in the same order, the reused ones are already in place in bone_palettes.
+    // Sizes are checked as well, in case of a hierarchy reloaded at the address of a freed one.
+    bool same_layout = pose_keys == uploaded_pose_keys;
+    for (size_t i = 0; i < pose_sources.size() && same_layout; ++i) {
+        same_layout = pose_palettes[i].size() == uploaded_pose_sizes[i];
+    }
+    if (same_layout && all_reused) {
+        // Nothing changed since the last upload, which is the common case for a scene that is standing still
+        for (size_t i = 0; i < posed_entities.size(); ++i) {
+            posed_entities[i]->bone_palette_offset = pose_offsets[entity_poses[i]];
+        }
+        return;
+    }
+
+    if (!same_layout) {
+        lay_out_poses();
+    }
+    thread_pool.parallel_for(pose_sources.size(), [this, same_layout](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            if (!pose_placed[i] || (same_layout && pose_reused[i])) continue;
+            std::copy(pose_palettes[i].begin(), pose_palettes[i].end(), bone_palettes.data.begin() + pose_offsets[i]);
+        }
+    });
+    for (size_t i = 0; i < posed_entities.size(); ++i) {
+        posed_entities[i]->bone_palette_offset = pose_offsets[entity_poses[i]];
+    }
+
+    // Uploading orphans the previous frame's storage, so this never has to wait for draws still reading it
+    bone_palettes.upload();
+}
+
+void AnimatedEntityRenderer::AnimatedEntityRenderer::lay_out_poses() {
+    size_t pose_count = pose_sources.size();
+    pose_offsets.assign(pose_count, 0);
+    pose_placed.assign(pose_count, false);
+
+    // Each entity only needs to know where its pose starts, so the poses go back to back for as long as they fit
+    size_t bone_count = 0;
+    auto place = [this, &bone_count](size_t pose) {
+        size_t size = pose_palettes[pose].size();
+        if (bone_count + size > max_palette_bones) return;
+        pose_offsets[pose] = (uint) bone_count;
+        pose_placed[pose] = true;
+        bone_count += size;
+    };
+    // The first pose of every hierarchy goes first, so that if they don't all fit, the rest have one to fall back to
+    std::unordered_map<const MeshHierarchy<VertexData>*, size_t> first_poses{};
+    for (size_t i = 0; i < pose_count; ++i) {
+        if (first_poses.emplace(std::get<0>(pose_keys[i]), i).second) place(i);
+    }
+    for (size_t i = 0; i < pose_count; ++i) {
+        if (!pose_placed[i] && first_poses[std::get<0>(pose_keys[i])] != i) place(i);
+    }
+    for (size_t i = 0; i < pose_count; ++i) {
+        if (!pose_placed[i]) pose_offsets[i] = pose_offsets[first_poses[std::get<0>(pose_keys[i])]];
+    }
 
-        directional_lights_ubo.data[i].direction = directional_light.direction;
-        directional_lights_ubo.data[i].colour = scaled_colour;
-        directional_lights_ubo.data[i].intensity = directional_light.colour.a;
+    bone_palettes.data.resize(bone_count);
+    uploaded_pose_keys = pose_keys;
+    uploaded_pose_sizes.clear();
+    for (size_t i = 0; i < pose_count; ++i) {
+        uploaded_pose_sizes.push_back(pose_palettes[i].size());
     }
+}
 
-    set_frag_define("NUM_DL", Formatter() << count);
-    directional_lights_ubo.bind(DIRECTIONAL_LIGHT_BINDING);
-    directional_lights_ubo.upload();
+template<typename Shader>
+void AnimatedEntityRenderer::AnimatedEntityRenderer::set_mesh_bone_offset(Shader& shader, const MeshHierarchy<VertexData>& mesh_hierarchy, uint mesh_id, bool baked) {
+    bool has_bones = !mesh_hierarchy.meshes[mesh_id].bones.empty();
+    // A hierarchy that wasn't baked has no frames to read, so is left in the bind pose
+    bool has_pose = !baked || mesh_hierarchy.baked_animations != nullptr;
+    shader.set_mesh_bone_offset(has_bones && has_pose ? (int) mesh_hierarchy.palette_offsets[mesh_id] : -1);
 }
 
-AnimatedEntityRenderer::AnimatedEntityRenderer::AnimatedEntityRenderer() : shader() {}
+template<typename Shader>
+void AnimatedEntityRenderer::AnimatedEntityRenderer::bind_baked_animations(Shader& shader, const MeshHierarchy<VertexData>& mesh_hierarchy) {
+    if (mesh_hierarchy.baked_animations == nullptr) return;
+    mesh_hierarchy.baked_animations->palettes.bind(BONE_PALETTES_TEXTURE_UNIT);
+    shader.set_baked_animations(*mesh_hierarchy.baked_animations, mesh_hierarchy.palette_size);
+}
 
-void AnimatedEntityRenderer::AnimatedEntityRenderer::render(const RenderScene& render_scene, const LightScene& light_scene) {
+void AnimatedEntityRenderer::AnimatedEntityRenderer::render(const RenderScene& render_scene, const LightScene& light_scene, bool clustered_lighting) {
     shader.use();
     shader.set_global_data(render_scene.global_data);
+    // task h
+    shader.set_directional_lights(light_scene.get_directional_lights(BaseLitEntityShader::MAX_DL));
+    shader.set_clustered_lighting(clustered_lighting);
+
+    Frustum frustum(render_scene.global_data.projection_view_matrix);
+    frustum_culler.cull(frustum, render_scene.entities, bounding_sphere, visible_entities);
+
+    // The point lights are chosen while building the queue, since how many there are decides the shader variant, which is part of the key
+    render_queue.clear();
+    queued_point_lights.clear();
+    const glm::mat4& view_matrix = render_scene.global_data.view_matrix;
+    for (const auto* entity: visible_entities) {
+        glm::vec4 sphere = bounding_sphere(*entity);
+        QueuedEntity queued{entity, (uint) queued_point_lights.size(), 0};
+        if (!clustered_lighting) {
+            light_scene.get_nearest_point_lights(sphere, BaseLitEntityShader::MAX_PL, 1, nearest_point_lights, sphere.w);
+            queued_point_lights.insert(queued_point_lights.end(), nearest_point_lights.begin(), nearest_point_lights.end());
+            queued.point_light_count = (uint) nearest_point_lights.size();
+        }
+
+        // A hierarchy has a model per mesh, the first one stands in for all of them
+        float view_depth = -(view_matrix * glm::vec4(glm::vec3(sphere), 1.0f)).z;
+        uint texture_set = render_queue.get_texture_set(entity->render_data.diffuse_texture->get_texture_id(), entity->render_data.specular_map_texture->get_texture_id());
+        uint model_id = entity->mesh_hierarchy->meshes.front().model->get_model_id();
+        render_queue.push(Queue::make_key(RenderPass::Opaque, queued.point_light_count, model_id, texture_set, Queue::quantise_depth(view_depth)), queued);
+    }
+    render_queue.sort();
+
+    bone_palettes.bind(BONE_PALETTES_TEXTURE_UNIT);
+
+    uint bound_vao = 0;
+    uint bound_diffuse = 0;
+    uint bound_specular = 0;
+    for (size_t i = 0; i < render_queue.size(); ++i) {
+        const auto& [entity, first_point_light, point_light_count] = render_queue[i];
+
+        if (!clustered_lighting) {
+            // IMPORTANT NOTE:
+            // This call switches to a different shader variant if the value for "NUM_PL" changes, which compiles it the first time that count is seen.
+            // After that it is just a change of program, but the per instance uniforms belong to the program, so they must be set after this.
+            shader.set_point_lights(&queued_point_lights[first_point_light], point_light_count);
+        }
 
-    for (const auto& entity: render_scene.entities) {
         shader.set_instance_data(entity->instance_data);
+        shader.set_palette_offset((int) entity->bone_palette_offset);
+
+        // Consecutive draws often share state, since the queue is sorted by it
+        uint diffuse = entity->render_data.diffuse_texture->get_texture_id();
+        if (diffuse != bound_diffuse) {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, diffuse);
+            bound_diffuse = diffuse;
+        }
+        uint specular = entity->render_data.specular_map_texture->get_texture_id();
+        if (specular != bound_specular) {
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, specular);
+            bound_specular = specular;
+        }
+
+        entity->mesh_hierarchy->visit_nodes([this, entity, &bound_vao](const MeshHierarchyNode& node, glm::mat4 accumulated_transformation) {
+            for (const auto& mesh_id: node.meshes) {
+                const auto& mesh = entity->mesh_hierarchy->meshes[mesh_id];
 
-        glm::vec3 position = entity->instance_data.model_matrix[3];
-        // IMPORTANT NOTE:
-        // This call has the potential to recompile the shader if the value for "NUM_PL" changes.
-        // If this where to happen for every entity, it would MASSIVELY kill performance (and possibly just not even work at all).
-        // However, in this case, consecutive get_nearest_point_lights calls WILL return the same number of items,
-        // so that issue won't happen since it only recompiles on a change.
-        // Just make sure to be careful of this kind of thing.
-        shader.set_point_lights(light_scene.get_nearest_point_lights(position, BaseLitEntityShader::MAX_PL, 1));
-        // task h
-        shader.set_directional_lights(light_scene.get_directional_lights(BaseLitEntityShader::MAX_DL));
+                shader.set_model_matrix(entity->instance_data.model_matrix * accumulated_transformation);
+                set_mesh_bone_offset(shader, *entity->mesh_hierarchy, mesh_id, false);
+
+                if (mesh.model->get_vao() != bound_vao) {
+                    bound_vao = mesh.model->get_vao();
+                    glBindVertexArray(bound_vao);
+                }
+                glDrawElementsBaseVertex(GL_TRIANGLES, mesh.model->get_index_count(), GL_UNSIGNED_INT, mesh.model->get_index_pointer(), mesh.model->get_vertex_offset());
+            }
+        });
+    }
+}
+
+void AnimatedEntityRenderer::AnimatedEntityRenderer::render_instanced(const RenderScene& render_scene, const LightScene& light_scene, bool clustered_lighting, bool baked) {
+    if (render_scene.entities.empty()) return;
+
+    auto& group_shader = baked ? baked_shader : instanced_shader;
+    group_shader.use();
+    group_shader.set_global_data(render_scene.global_data);
+    group_shader.set_directional_lights(light_scene.get_directional_lights(BaseLitEntityShader::MAX_DL));
+    group_shader.set_clustered_lighting(clustered_lighting);
+
+    // Each instance finds its own pose through instance_palettes, so entities in any pose can share a draw call, as can entities
+    // with different textures in the same texture arrays
+    auto instance_key = [](const Entity* entity) {
+        return std::make_tuple(entity->mesh_hierarchy.get(), BaseLitEntityShader::instanced_texture_id(*entity->render_data.diffuse_texture),
+                               BaseLitEntityShader::instanced_texture_id(*entity->render_data.specular_map_texture));
+    };
+    Frustum frustum(render_scene.global_data.projection_view_matrix);
+    frustum_culler.cull(frustum, render_scene.entities, bounding_sphere, sorted_entities);
+    // Grouping is by hierarchy rather than by VAO, which doesn't fit in a RenderQueue key, so this is a comparison sort
+    std::sort(sorted_entities.begin(), sorted_entities.end(), [&instance_key](const Entity* lhs, const Entity* rhs) {
+        return instance_key(lhs) < instance_key(rhs);
+    });
+
+    upload_instances(baked);
+
+    for (size_t start = 0; start < sorted_entities.size();) {
+        const auto* first = sorted_entities[start];
+        size_t end = start + 1;
+        glm::vec3 centroid = first->instance_data.model_matrix[3];
+        while (end < sorted_entities.size() && instance_key(sorted_entities[end]) == instance_key(first)) {
+            centroid += glm::vec3(sorted_entities[end]->instance_data.model_matrix[3]);
+            ++end;
+        }
+        centroid /= (float) (end - start);
+
+        if (!clustered_lighting) {
+            // See the note in render() about this potentially switching variant
+            light_scene.get_nearest_point_lights(centroid, BaseLitEntityShader::MAX_PL, 1, nearest_point_lights);
+            group_shader.set_point_lights(nearest_point_lights);
+        }
+        if (baked) {
+            bind_baked_animations(group_shader, *first->mesh_hierarchy);
+        }
 
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, entity->render_data.diffuse_texture->get_texture_id());
+        glBindTexture(BaseLitEntityShader::instanced_texture_target(), BaseLitEntityShader::instanced_texture_id(*first->render_data.diffuse_texture));
         glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, entity->render_data.specular_map_texture->get_texture_id());
+        glBindTexture(BaseLitEntityShader::instanced_texture_target(), BaseLitEntityShader::instanced_texture_id(*first->render_data.specular_map_texture));
 
-        entity->mesh_hierarchy->calculate_animation(entity->animation_id, entity->animation_time_seconds);
-        entity->mesh_hierarchy->visit_nodes([this, &entity](const MeshHierarchyNode& node, glm::mat4 accumulated_transformation) {
+        size_t instance_offset = start * sizeof(InstanceData::Data);
+        int instance_count = (int) (end - start);
+        group_shader.set_first_instance((int) start);
+
+        first->mesh_hierarchy->visit_nodes([this, &group_shader, baked, first, instance_offset, instance_count](const MeshHierarchyNode& node, glm::mat4 accumulated_transformation) {
             for (const auto& mesh_id: node.meshes) {
-                const auto& mesh = entity->mesh_hierarchy->meshes[mesh_id];
+                const auto& mesh = first->mesh_hierarchy->meshes[mesh_id];
 
-                shader.set_model_matrix(entity->instance_data.model_matrix * accumulated_transformation);
-                if (!mesh.bone_transforms.empty()) shader.set_bone_transforms(mesh.bone_transforms);
+                group_shader.set_node_matrix(accumulated_transformation);
+                set_mesh_bone_offset(group_shader, *first->mesh_hierarchy, mesh_id, baked);
+
+                glBindVertexArray(mesh.model->get_vao());
+                glBindBuffer(GL_ARRAY_BUFFER, instance_buffer.id());
+                InstanceData::Data::setup_attrib_pointers(instance_offset);
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh.model->get_index_count(), GL_UNSIGNED_INT, mesh.model->get_index_pointer(), instance_count, mesh.model->get_vertex_offset());
+            }
+        });
+
+        start = end;
+    }
+}
+
+void AnimatedEntityRenderer::AnimatedEntityRenderer::render_depth(const RenderScene& render_scene, bool instanced, bool baked) {
+    Frustum frustum(render_scene.global_data.projection_view_matrix);
+    frustum_culler.cull(frustum, render_scene.entities, bounding_sphere, sorted_entities);
+    if (sorted_entities.empty()) return;
+
+    if (!instanced && !baked) {
+        depth_shader.use();
+        depth_shader.set_global_data(render_scene.global_data);
+        bone_palettes.bind(BONE_PALETTES_TEXTURE_UNIT);
+
+        // Front to back, so that as much as possible is rejected by the early depth test
+        const glm::mat4& view_matrix = render_scene.global_data.view_matrix;
+        std::sort(sorted_entities.begin(), sorted_entities.end(), [&view_matrix](const Entity* lhs, const Entity* rhs) {
+            return (view_matrix * lhs->instance_data.model_matrix[3]).z > (view_matrix * rhs->instance_data.model_matrix[3]).z;
+        });
+
+        for (const auto* entity: sorted_entities) {
+            depth_shader.set_palette_offset((int) entity->bone_palette_offset);
+            entity->mesh_hierarchy->visit_nodes([this, entity](const MeshHierarchyNode& node, glm::mat4 accumulated_transformation) {
+                for (const auto& mesh_id: node.meshes) {
+                    const auto& mesh = entity->mesh_hierarchy->meshes[mesh_id];
+
+                    // Must be the same calculation as in render(), for the depths to match
+                    depth_shader.set_model_matrix(entity->instance_data.model_matrix * accumulated_transformation);
+                    set_mesh_bone_offset(depth_shader, *entity->mesh_hierarchy, mesh_id, false);
+
+                    glBindVertexArray(mesh.model->get_vao());
+                    glDrawElementsBaseVertex(GL_TRIANGLES, mesh.model->get_index_count(), GL_UNSIGNED_INT, mesh.model->get_index_pointer(), mesh.model->get_vertex_offset());
+                }
+            });
+        }
+        return;
+    }
+
+    auto& group_shader = baked ? baked_depth_shader : instanced_depth_shader;
+    group_shader.use();
+    group_shader.set_global_data(render_scene.global_data);
+
+    // Same as render_instanced, but textures don't matter here
+    auto instance_key = [](const Entity* entity) {
+        return entity->mesh_hierarchy.get();
+    };
+    std::sort(sorted_entities.begin(), sorted_entities.end(), [&instance_key](const Entity* lhs, const Entity* rhs) {
+        return instance_key(lhs) < instance_key(rhs);
+    });
+
+    upload_instances(baked);
+
+    for (size_t start = 0; start < sorted_entities.size();) {
+        const auto* first = sorted_entities[start];
+        size_t end = start + 1;
+        while (end < sorted_entities.size() && instance_key(sorted_entities[end]) == instance_key(first)) {
+            ++end;
+        }
+
+        size_t instance_offset = start * sizeof(InstanceData::Data);
+        int instance_count = (int) (end - start);
+        group_shader.set_first_instance((int) start);
+        if (baked) {
+            bind_baked_animations(group_shader, *first->mesh_hierarchy);
+        }
+
+        first->mesh_hierarchy->visit_nodes([this, &group_shader, baked, first, instance_offset, instance_count](const MeshHierarchyNode& node, glm::mat4 accumulated_transformation) {
+            for (const auto& mesh_id: node.meshes) {
+                const auto& mesh = first->mesh_hierarchy->meshes[mesh_id];
+
+                group_shader.set_node_matrix(accumulated_transformation);
+                set_mesh_bone_offset(group_shader, *first->mesh_hierarchy, mesh_id, baked);
 
                 glBindVertexArray(mesh.model->get_vao());
-                glDrawElementsBaseVertex(GL_TRIANGLES, mesh.model->get_index_count(), GL_UNSIGNED_INT, nullptr, mesh.model->get_vertex_offset());
+                glBindBuffer(GL_ARRAY_BUFFER, instance_buffer.id());
+                InstanceData::Data::setup_attrib_pointers(instance_offset);
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh.model->get_index_count(), GL_UNSIGNED_INT, mesh.model->get_index_pointer(), instance_count, mesh.model->get_vertex_offset());
             }
         });
+
+        start = end;
     }
 }
 
+void AnimatedEntityRenderer::AnimatedEntityRenderer::upload_instances(bool baked) {
+    instance_buffer.data.clear();
+    for (const auto* entity: sorted_entities) {
+        instance_buffer.data.push_back(InstanceData::Data::from_instance_data(entity->instance_data, entity->render_data.get_texture_layers()));
+    }
+    instance_buffer.upload();
+
+    if (baked) {
+        // Nothing is posed on the CPU, each instance only says which frames to use and how far through them it is
+        baked_instances.data.clear();
+        for (const auto* entity: sorted_entities) {
+            const auto* baked_animations = entity->mesh_hierarchy->baked_animations.get();
+            std::pair<uint, uint> frames{0, 1};
+            if (baked_animations != nullptr && entity->animation_id < baked_animations->animation_frames.size()) {
+                frames = baked_animations->animation_frames[entity->animation_id];
+            }
+            baked_instances.data.emplace_back((float) frames.first, (float) frames.second, (float) entity->animation_time_seconds, 0.0f);
+        }
+        baked_instances.upload();
+        baked_instances.bind(BAKED_INSTANCES_TEXTURE_UNIT);
+        return;
+    }
+
+    instance_palettes.data.clear();
+    for (const auto* entity: sorted_entities) {
+        instance_palettes.data.push_back(entity->bone_palette_offset);
+    }
+    instance_palettes.upload();
+
+    bone_palettes.bind(BONE_PALETTES_TEXTURE_UNIT);
+    instance_palettes.bind(INSTANCE_PALETTES_TEXTURE_UNIT);
+}
+
 bool AnimatedEntityRenderer::AnimatedEntityRenderer::refresh_shaders() {
-    return shader.reload_files();
+    bool success = shader.reload_files();
+    success &= instanced_shader.reload_files();
+    success &= depth_shader.reload_files();
+    success &= instanced_depth_shader.reload_files();
+    success &= baked_shader.reload_files();
+    success &= baked_depth_shader.reload_files();
+    return success;
 }
 
 void AnimatedEntityRenderer::VertexData::from_mesh(const VertexCollection& vertex_collection, std::vector<VertexData>& out_vertices) {
@@ -4,24 +4,32 @@
 #include <utility>
 #include <vector>
 #include <unordered_set>
+#include <unordered_map>
 
 #include <glm/glm.hpp>
 
 #include "rendering/renders/shaders/ShaderInterface.h"
+#include "rendering/renders/RenderQueue.h"
 #include "rendering/scene/Lights.h"
 #include "rendering/scene/GlobalData.h"
 #include "rendering/scene/RenderScene.h"
+#include "rendering/scene/Frustum.h"
 #include "rendering/scene/RenderedEntity.h"
 #include "rendering/resources/ModelLoader.h"
 #include "rendering/resources/TextureHandle.h"
 #include "rendering/memory/UniformBufferArray.h"
+#include "rendering/memory/InstanceBuffer.h"
+#include "rendering/memory/TextureBuffer.h"
+#include "utility/ThreadPool.h"
 
 #include "rendering/renders/shaders/BaseLitEntityShader.h"
 
-#define BONE_TRANSFORMS 64
-#define BONE_TRANSFORMS_STR "64"
-
 namespace AnimatedEntityRenderer {
+    // Follow on from the units used by the lit shaders and ClusteredLights
+    constexpr uint BONE_PALETTES_TEXTURE_UNIT = 5;
+    constexpr uint INSTANCE_PALETTES_TEXTURE_UNIT = 6;
+    constexpr uint BAKED_INSTANCES_TEXTURE_UNIT = 7;
+
     struct VertexData {
         glm::vec3 position;
         glm::vec3 normal;
@@ -44,29 +52,177 @@ namespace AnimatedEntityRenderer {
 
     class AnimatedEntityShader : public BaseLitEntityShader {
         // Animation Data
-        int bone_transforms_location{};
+        int mesh_bone_offset_location{};
+        // Only used by the non-instanced variant
+        int palette_offset_location{};
+        // Only used by the instanced variant
+        int first_instance_location{};
+        int node_matrix_location{};
+        // Only used by the baked variant
+        int bake_frame_rate_location{};
+        int palette_size_location{};
     public:
-        AnimatedEntityShader();
+        /// If instanced is set, then the per instance data is sourced from vertex attributes instead of uniforms.
+        /// If baked is set, then bones are read from a hierarchy's baked frames instead of from the posed palettes, which implies instanced.
+        explicit AnimatedEntityShader(bool instanced = false, bool baked = false);
 
         void set_model_matrix(const glm::mat4& model_matrix);
+        /// Set the transformation of the node being drawn within the hierarchy, which the instanced variant combines with each instance's model matrix
+        void set_node_matrix(const glm::mat4& node_matrix);
+
+        /// Set where the entity's palette starts in the bone palettes buffer, for the non-instanced variant
+        void set_palette_offset(int palette_offset);
+        /// Set the index of the draw's first instance in the instance palettes buffer, for the instanced variant
+        void set_first_instance(int first_instance);
+        /// Set where the mesh's bones start within a palette, or -1 if it has no bones
+        void set_mesh_bone_offset(int mesh_bone_offset);
+        /// Set how the baked frames being read are laid out, for the baked variant
+        void set_baked_animations(const BakedAnimations& baked_animations, uint palette_size);
+    private:
+        // Override get_uniforms_set_bindings to get the extra uniforms and samplers for bone transforms
+        void get_uniforms_set_bindings() override;
+    };
+
+    /// Writes only depth, for the depth pre-pass, using the same vertex shader as AnimatedEntityShader so that the depths match exactly
+    class AnimatedEntityDepthShader : public BaseEntityShader {
+        int mesh_bone_offset_location{};
+        int palette_offset_location{};
+        int first_instance_location{};
+        int node_matrix_location{};
+        int bake_frame_rate_location{};
+        int palette_size_location{};
+    public:
+        /// See AnimatedEntityShader for instanced and baked
+        explicit AnimatedEntityDepthShader(bool instanced = false, bool baked = false);
 
-        void set_bone_transforms(const std::vector<glm::mat4>& bone_transforms);
-        // task h
-        void set_directional_lights(const std::vector<DirectionalLight>& directional_lights);
+        void set_model_matrix(const glm::mat4& model_matrix);
+        void set_node_matrix(const glm::mat4& node_matrix);
+        void set_palette_offset(int palette_offset);
+        void set_first_instance(int first_instance);
+        void set_mesh_bone_offset(int mesh_bone_offset);
+        void set_baked_animations(const BakedAnimations& baked_animations, uint palette_size);
     private:
-        // Override get_uniforms_set_bindings to get the extra uniform for bone transforms
         void get_uniforms_set_bindings() override;
     };
 
     class AnimatedEntityRenderer {
-        AnimatedEntityShader shader;
+        // Bounds are only known for the bind pose, so they are grown to allow for animations moving the meshes outside of them
+        static constexpr float ANIMATION_BOUNDS_SCALE = 1.5f;
 
+        /// An entity waiting in the render queue, along with the range of queued_point_lights chosen for it
+        struct QueuedEntity {
+            const Entity* entity;
+            uint first_point_light;
+            uint point_light_count;
+        };
+        using Queue = RenderQueue<QueuedEntity>;
+
+        AnimatedEntityShader shader;
+        Queue render_queue{};
+        std::vector<PointLight> queued_point_lights{};
+
+        // Instanced draw path
+        AnimatedEntityShader instanced_shader;
+        InstanceBuffer<InstanceData::Data> instance_buffer;
+        std::vector<const Entity*> sorted_entities{};
+
+        // Depth pre-pass
+        AnimatedEntityDepthShader depth_shader;
+        AnimatedEntityDepthShader instanced_depth_shader;
+
+        // Frustum culling, reused between frames
+        FrustumCuller frustum_culler{};
+        std::vector<const Entity*> visible_entities{};
+
+        // Animation times are snapped to this many seconds, so that instances playing the same animation nearly in sync share a pose
+        static constexpr double POSE_TIME_STEP = 1.0 / 240.0;
+        // (hierarchy, animation_id, time in steps of POSE_TIME_STEP, reduced skeleton), which fully determines a pose
+        using PoseKey = std::tuple<const MeshHierarchy<VertexData>*, uint, int64_t, bool>;
+
+        // Counts calls to update_poses, for spreading out the updates of entities posed less than every frame
+        uint64_t frame_index = 0;
+
+        // The entities posed by update_poses
+        std::vector<const Entity*> posed_entities{};
+        // [posed entity] -> index of its pose
+        std::vector<uint> entity_poses{};
+        // The pose cache, rebuilt each frame so that each distinct pose is only calculated once
+        std::unordered_map<PoseKey, uint, QuadHash> pose_indices{};
+        // [pose] -> the first entity found in that pose, whose cursor is used to calculate it
+        std::vector<const Entity*> pose_sources{};
+        // [pose] -> its key, in the order the poses are laid out in bone_palettes
+        std::vector<PoseKey> pose_keys{};
+        // [pose] -> the calculated bone transforms
+        std::vector<std::vector<glm::mat4>> pose_palettes{};
+        // [pose] -> whether the pose was taken from the previous frame, rather than calculated
+        std::vector<bool> pose_reused{};
+        // The pose cache of the previous frame
+        std::unordered_map<PoseKey, uint, QuadHash> previous_pose_indices{};
+        std::vector<std::vector<glm::mat4>> previous_pose_palettes{};
+        // [pose] -> index of its first bone in bone_palettes
+        std::vector<uint> pose_offsets{};
+        // [pose] -> whether it has its own place in bone_palettes, rather than sharing another pose's for lack of space
+        std::vector<bool> pose_placed{};
+        // pose_keys and the palette sizes as of the last upload to bone_palettes, it is only uploaded again once a pose is added, removed or changed
+        std::vector<PoseKey> uploaded_pose_keys{};
+        std::vector<size_t> uploaded_pose_sizes{};
+
+        // Every distinct pose's bone transforms back to back, which entities and instances index into.
+        // A buffer texture is only guaranteed 65536 texels (16384 bones), so poses past max_palette_bones share an earlier pose of
+        // their hierarchy instead, which should only happen with a huge crowd all in different poses.
+        TextureBuffer<glm::mat4> bone_palettes;
+        size_t max_palette_bones = 0;
+        // [instance in instance_buffer] -> its offset in bone_palettes, so instances in different poses can share a draw
+        TextureBuffer<uint> instance_palettes;
+
+        // Baked draw path, which poses instances from their hierarchy's baked frames without any work on the CPU
+        AnimatedEntityShader baked_shader;
+        AnimatedEntityDepthShader baked_depth_shader;
+        // [instance in instance_buffer] -> (first_frame, frame_count, animation_time_seconds, unused)
+        TextureBuffer<glm::vec4> baked_instances;
+
+        // Reused between entities to avoid allocating for every light query
+        std::vector<PointLight> nearest_point_lights{};
     public:
         AnimatedEntityRenderer();
 
-        void render(const RenderScene& render_scene, const LightScene& light_scene);
+        /// Compute the pose of every entity in view, spread across the thread pool, and upload them all to the bone palettes buffer.
+        /// Poses that are the same as last frame (paused, stopped, or held by the LOD policy) aren't calculated again, and when
+        /// none have changed the buffer isn't uploaded either.
+        /// Must be called each frame before any of the render functions, unless they are all baked.
+        void update_poses(const RenderScene& render_scene, ThreadPool& thread_pool);
+
+        /// If clustered_lighting is set, point lights are read from the clusters bound by ClusteredLights::bind instead of being picked per entity.
+        void render(const RenderScene& render_scene, const LightScene& light_scene, bool clustered_lighting = false);
+        /// Render the scene by grouping entities that share a hierarchy and textures, drawing each mesh of a group with a single instanced draw call.
+        /// Each instance reads its own pose from the bone palettes buffer, so the group doesn't need to be in sync.
+        /// Point lights are chosen per group, as the ones nearest to the group's centroid.
+        /// If baked is set, each instance instead reads the nearest frame of its hierarchy's baked animations, so update_poses isn't needed.
+        /// Hierarchies without baked animations are then drawn in their bind pose.
+        void render_instanced(const RenderScene& render_scene, const LightScene& light_scene, bool clustered_lighting = false, bool baked = false);
+
+        /// Draw only the depth of the scene, for a depth pre-pass, so the lit pass can skip shading hidden fragments.
+        /// instanced and baked must match the lit pass (render_instanced or render), or the depths may differ slightly.
+        void render_depth(const RenderScene& render_scene, bool instanced = false, bool baked = false);
 
         bool refresh_shaders();
+    private:
+        /// The key of the pose the entity is in, as of its last update_lod_state, entities with the same key have identical bone transforms
+        static PoseKey pose_key(const Entity& entity);
+        /// Decide, by the entity's LOD policy and size on screen, whether its pose moves on to the current time this frame and with which skeleton
+        void update_lod_state(const Entity& entity, const GlobalData& global_data) const;
+        /// Decide where each pose goes in bone_palettes, as many as fit, with the rest sharing the first pose of their hierarchy
+        void lay_out_poses();
+        /// Point the shader at the bones of one mesh of the hierarchy, within whichever palette it is reading
+        template<typename Shader>
+        static void set_mesh_bone_offset(Shader& shader, const MeshHierarchy<VertexData>& mesh_hierarchy, uint mesh_id, bool baked);
+        /// Bind the hierarchy's baked frames in place of the bone palettes, if it has them
+        template<typename Shader>
+        static void bind_baked_animations(Shader& shader, const MeshHierarchy<VertexData>& mesh_hierarchy);
+        /// Upload the instance data and palette offsets (or baked frames) of sorted_entities, in order, and bind the buffers the shaders read them from
+        void upload_instances(bool baked);
+        /// World space bounding sphere of an entity, (centre, radius)
+        static glm::vec4 bounding_sphere(const Entity& entity);
     };
 }
 
@@ -0,0 +1,150 @@
+#include "ClusteredLights.h"
+
+#include <cmath>
+#include <algorithm>
+
+ClusteredLights::ClusteredLights() :
+    point_lights(GL_RGBA32F), cluster_ranges(GL_RG32UI), light_indices(GL_R32UI), cluster_data({}, UniformBufferUsage::Streaming) {
+
+    int max_texture_buffer_size;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texture_buffer_size);
+    max_light_indices = (size_t) max_texture_buffer_size;
+
+    cluster_min.resize(CLUSTER_COUNT);
+    cluster_max.resize(CLUSTER_COUNT);
+}
+
+void ClusteredLights::update(const LightScene& light_scene, const glm::mat4& view_matrix, const glm::mat4& projection_matrix, glm::uvec2 viewport_size) {
+    // Works for both finite and infinite perspective projections
+    float near = projection_matrix[3][2] / (projection_matrix[2][2] - 1.0f);
+    float x_scale = projection_matrix[0][0];
+    float y_scale = projection_matrix[1][1];
+
+    // Collect the lights, skipping any entirely behind the camera. The far end of the clusters is
+    // pulled in to the furthest reach of any light, since nothing further can be lit by a point light anyway.
+    float far = 2.0f * near;
+    point_lights.data.clear();
+    view_space_lights.clear();
+    for (const auto& point_light: light_scene.point_lights) {
+        glm::vec3 scaled_colour = glm::vec3(point_light->colour) * point_light->colour.a;
+        float radius = point_light->get_radius();
+        if (radius <= 0.0f) continue;
+
+        glm::vec3 vs_position = view_matrix * glm::vec4(point_light->position, 1.0f);
+        float depth = -vs_position.z;
+        if (depth + radius < near) continue;
+        far = std::max(far, depth + radius);
+
+        point_lights.data.emplace_back(point_light->position, radius);
+        point_lights.data.emplace_back(scaled_colour, 0.0f);
+        view_space_lights.emplace_back(vs_position, radius);
+    }
+
+    float slice_scale = (float) SLICES / std::log(far / near);
+    auto slice_of = [near, slice_scale](float depth) {
+        int slice = (int) std::floor(std::log(std::max(depth, near) / near) * slice_scale);
+        return (uint) std::clamp(slice, 0, (int) SLICES - 1);
+    };
+    auto tile_of = [](float ndc, uint tiles) {
+        int tile = (int) std::floor((ndc * 0.5f + 0.5f) * (float) tiles);
+        return (uint) std::clamp(tile, 0, (int) tiles - 1);
+    };
+
+    // View space bounds of each cluster, since positions scale linearly with depth the extremes are at the corners
+    for (uint k = 0; k < SLICES; ++k) {
+        float near_depth = near * std::pow(far / near, (float) k / (float) SLICES);
+        float far_depth = near * std::pow(far / near, (float) (k + 1) / (float) SLICES);
+        for (uint j = 0; j < TILES_Y; ++j) {
+            float ndc_y0 = -1.0f + 2.0f * (float) j / (float) TILES_Y;
+            float ndc_y1 = -1.0f + 2.0f * (float) (j + 1) / (float) TILES_Y;
+            for (uint i = 0; i < TILES_X; ++i) {
+                float ndc_x0 = -1.0f + 2.0f * (float) i / (float) TILES_X;
+                float ndc_x1 = -1.0f + 2.0f * (float) (i + 1) / (float) TILES_X;
+
+                uint cluster = i + TILES_X * (j + TILES_Y * k);
+                cluster_min[cluster] = glm::vec3(
+                    std::min(ndc_x0 * near_depth, ndc_x0 * far_depth) / x_scale,
+                    std::min(ndc_y0 * near_depth, ndc_y0 * far_depth) / y_scale,
+                    -far_depth
+                );
+                cluster_max[cluster] = glm::vec3(
+                    std::max(ndc_x1 * near_depth, ndc_x1 * far_depth) / x_scale,
+                    std::max(ndc_y1 * near_depth, ndc_y1 * far_depth) / y_scale,
+                    -near_depth
+                );
+            }
+        }
+    }
+
+    // Find the (cluster, light) pairs, only testing the clusters within each light's projected bounds
+    assignments.clear();
+    for (uint light = 0; light < (uint) view_space_lights.size(); ++light) {
+        glm::vec3 vs_position = view_space_lights[light];
+        float radius = view_space_lights[light].w;
+        float depth = -vs_position.z;
+
+        float min_depth = std::max(depth - radius, near);
+        float max_depth = depth + radius;
+
+        float ndc_min_x = std::min((vs_position.x - radius) / min_depth, (vs_position.x - radius) / max_depth) * x_scale;
+        float ndc_max_x = std::max((vs_position.x + radius) / min_depth, (vs_position.x + radius) / max_depth) * x_scale;
+        float ndc_min_y = std::min((vs_position.y - radius) / min_depth, (vs_position.y - radius) / max_depth) * y_scale;
+        float ndc_max_y = std::max((vs_position.y + radius) / min_depth, (vs_position.y + radius) / max_depth) * y_scale;
+
+        uint k0 = slice_of(min_depth), k1 = slice_of(max_depth);
+        uint j0 = tile_of(ndc_min_y, TILES_Y), j1 = tile_of(ndc_max_y, TILES_Y);
+        uint i0 = tile_of(ndc_min_x, TILES_X), i1 = tile_of(ndc_max_x, TILES_X);
+
+        for (uint k = k0; k <= k1; ++k) {
+            for (uint j = j0; j <= j1; ++j) {
+                for (uint i = i0; i <= i1; ++i) {
+                    uint cluster = i + TILES_X * (j + TILES_Y * k);
+                    glm::vec3 offset = glm::clamp(vs_position, cluster_min[cluster], cluster_max[cluster]) - vs_position;
+                    if (glm::dot(offset, offset) <= radius * radius) {
+                        assignments.emplace_back(cluster, light);
+                    }
+                }
+            }
+        }
+    }
+
+    // Should only happen with an absurd number of overlapping lights, but buffer textures have a limited size
+    if (assignments.size() > max_light_indices) {
+        assignments.resize(max_light_indices);
+    }
+
+    // Counting sort the pairs into a contiguous list of light indices per cluster
+    cluster_ranges.data.assign(CLUSTER_COUNT, glm::uvec2(0));
+    for (const auto& [cluster, light]: assignments) {
+        cluster_ranges.data[cluster].y++;
+    }
+    uint offset = 0;
+    for (auto& range: cluster_ranges.data) {
+        offset += range.y;
+        range.x = offset; // The end of the range for now, it gets walked back to the start as it is filled in
+    }
+    light_indices.data.resize(assignments.size());
+    for (auto it = assignments.rbegin(); it != assignments.rend(); ++it) {
+        light_indices.data[--cluster_ranges.data[it->first].x] = it->second;
+    }
+
+    cluster_data.data[0] = ClusterData{
+        // Negated third row of the view matrix, since view space looks down -z
+        -glm::vec4(view_matrix[0][2], view_matrix[1][2], view_matrix[2][2], view_matrix[3][2]),
+        glm::vec4((float) TILES_X / (float) viewport_size.x, (float) TILES_Y / (float) viewport_size.y, near, slice_scale),
+        glm::uvec4(TILES_X, TILES_Y, SLICES, 0)
+    };
+
+    point_lights.upload();
+    cluster_ranges.upload();
+    light_indices.upload();
+    cluster_data.upload();
+}
+
+void ClusteredLights::bind() {
+    point_lights.bind(POINT_LIGHTS_TEXTURE_UNIT);
+    cluster_ranges.bind(CLUSTER_RANGES_TEXTURE_UNIT);
+    light_indices.bind(LIGHT_INDICES_TEXTURE_UNIT);
+    glActiveTexture(GL_TEXTURE0);
+    cluster_data.bind(CLUSTER_DATA_BINDING);
+}
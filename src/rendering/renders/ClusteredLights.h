@@ -0,0 +1,62 @@
+#ifndef CLUSTERED_LIGHTS_H
+#define CLUSTERED_LIGHTS_H
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "rendering/scene/Lights.h"
+#include "rendering/memory/TextureBuffer.h"
+#include "rendering/memory/UniformBufferArray.h"
+
+/// Clustered forward light assignment.
+/// Each frame the view frustum is split into a grid of clusters (screen space tiles, by exponential depth slices),
+/// every point light is assigned to the clusters its radius of influence (PointLight::get_radius) touches, and the result is uploaded as buffer textures,
+/// so that each fragment only has to process the lights in its own cluster (see CLUSTERED in lights.glsl).
+class ClusteredLights {
+public:
+    static constexpr uint TILES_X = 16;
+    static constexpr uint TILES_Y = 9;
+    static constexpr uint SLICES = 24;
+    static constexpr uint CLUSTER_COUNT = TILES_X * TILES_Y * SLICES;
+
+    // Bindings used by the lit shaders
+    static constexpr uint POINT_LIGHTS_TEXTURE_UNIT = 2;
+    static constexpr uint CLUSTER_RANGES_TEXTURE_UNIT = 3;
+    static constexpr uint LIGHT_INDICES_TEXTURE_UNIT = 4;
+    static constexpr uint CLUSTER_DATA_BINDING = 2;
+
+    /// On GPU format, with std140 layout
+    struct ClusterData {
+        // (forward, -dot(forward, camera_position)), so that view depth = dot(depth_plane.xyz, ws_position) + depth_plane.w
+        glm::vec4 depth_plane;
+        // (tiles per pixel in x, tiles per pixel in y, near, slices / log(far / near))
+        glm::vec4 slice_params;
+        glm::uvec4 grid_size;
+    };
+private:
+    // Two texels per light: (position, radius), (colour, 0)
+    TextureBuffer<glm::vec4> point_lights;
+    // One texel per cluster: (offset into light_indices, count)
+    TextureBuffer<glm::uvec2> cluster_ranges;
+    TextureBuffer<uint> light_indices;
+    UniformBufferArray<ClusterData, 1> cluster_data;
+
+    size_t max_light_indices = 0;
+
+    // Reused every frame to avoid allocations
+    // (view space position, radius) of each light in point_lights
+    std::vector<glm::vec4> view_space_lights{};
+    std::vector<glm::vec3> cluster_min{};
+    std::vector<glm::vec3> cluster_max{};
+    std::vector<std::pair<uint, uint>> assignments{};
+public:
+    ClusteredLights();
+
+    /// Rebuild the clusters for the camera and reassign all the point lights in the scene to them, then upload everything.
+    void update(const LightScene& light_scene, const glm::mat4& view_matrix, const glm::mat4& projection_matrix, glm::uvec2 viewport_size);
+    /// Bind all the buffers to the bindings the lit shaders expect
+    void bind();
+};
+
+#endif //CLUSTERED_LIGHTS_H
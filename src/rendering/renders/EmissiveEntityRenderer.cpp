@@ -1,7 +1,11 @@
 #include "EmissiveEntityRenderer.h"
 
-EmissiveEntityRenderer::EmissiveEntityShader::EmissiveEntityShader() :
-    BaseEntityShader("Emissive Entity", "emissive_entity/vert.glsl", "emissive_entity/frag.glsl") {
+#include <algorithm>
+
+EmissiveEntityRenderer::EmissiveEntityShader::EmissiveEntityShader(bool instanced) :
+    BaseEntityShader(instanced ? "Instanced Emissive Entity" : "Emissive Entity", "emissive_entity/vert.glsl", "emissive_entity/frag.glsl",
+                     instanced ? std::unordered_map<std::string, std::string>{{"INSTANCED", "1"}} : std::unordered_map<std::string, std::string>{},
+                     instanced ? std::unordered_map<std::string, std::string>{{"INSTANCED", "1"}} : std::unordered_map<std::string, std::string>{}) {
     get_uniforms_set_bindings();
 }
 
@@ -22,23 +26,173 @@ void EmissiveEntityRenderer::EmissiveEntityShader::set_instance_data(const Insta
     glProgramUniform3fv(id(), emission_tint_location, 1, &scaled_diffuse_tint[0]);
 }
 
-EmissiveEntityRenderer::EmissiveEntityRenderer::EmissiveEntityRenderer() : shader() {}
+EmissiveEntityRenderer::EmissiveEntityRenderer::EmissiveEntityRenderer() : shader(), instanced_shader(true), instance_buffer() {}
+
+/// World space bounding sphere of an entity, (centre, radius)
+static glm::vec4 bounding_sphere(const EmissiveEntityRenderer::Entity& entity) {
+    return entity.model->get_bounds().world_sphere(entity.instance_data.model_matrix);
+}
 
 void EmissiveEntityRenderer::EmissiveEntityRenderer::render(const RenderScene& render_scene) {
     shader.use();
     shader.set_global_data(render_scene.global_data);
 
-    for (const auto& entity: render_scene.entities) {
+    Frustum frustum(render_scene.global_data.projection_view_matrix);
+    frustum_culler.cull(frustum, render_scene.entities, bounding_sphere, visible_entities);
+
+    render_queue.clear();
+    const glm::mat4& view_matrix = render_scene.global_data.view_matrix;
+    for (const auto* entity: visible_entities) {
+        float view_depth = -(view_matrix * glm::vec4(glm::vec3(bounding_sphere(*entity)), 1.0f)).z;
+        uint texture_set = render_queue.get_texture_set(entity->render_data.emission_texture->get_texture_id());
+        render_queue.push(Queue::make_key(RenderPass::Emissive, 0, entity->model->get_model_id(), texture_set, Queue::quantise_depth(view_depth)), entity);
+    }
+    render_queue.sort();
+
+    uint bound_vao = 0;
+    uint bound_emission = 0;
+    for (size_t i = 0; i < render_queue.size(); ++i) {
+        const auto* entity = render_queue[i];
         shader.set_instance_data(entity->instance_data);
 
+        // Consecutive draws often share state, since the queue is sorted by it
+        uint emission = entity->render_data.emission_texture->get_texture_id();
+        if (emission != bound_emission) {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, emission);
+            bound_emission = emission;
+        }
+        if (entity->model->get_vao() != bound_vao) {
+            bound_vao = entity->model->get_vao();
+            glBindVertexArray(bound_vao);
+        }
+
+        glDrawElementsBaseVertex(GL_TRIANGLES, entity->model->get_index_count(), GL_UNSIGNED_INT, entity->model->get_index_pointer(), entity->model->get_vertex_offset());
+    }
+}
+
+void EmissiveEntityRenderer::EmissiveEntityRenderer::render_instanced(const RenderScene& render_scene) {
+    if (render_scene.entities.empty()) return;
+
+    instanced_shader.use();
+    instanced_shader.set_global_data(render_scene.global_data);
+
+    // Entities which can share a draw call, which the queue makes contiguous
+    auto instance_key = [](const Entity* entity) {
+        return std::make_tuple(entity->model->get_vao(), entity->model->get_model_id(), entity->render_data.emission_texture->get_texture_id());
+    };
+    Frustum frustum(render_scene.global_data.projection_view_matrix);
+    frustum_culler.cull(frustum, render_scene.entities, bounding_sphere, visible_entities);
+    // Depth is left out of the key, since each group is a single draw call anyway
+    render_queue.clear();
+    for (const auto* entity: visible_entities) {
+        uint texture_set = render_queue.get_texture_set(entity->render_data.emission_texture->get_texture_id());
+        render_queue.push(Queue::make_key(RenderPass::Emissive, 0, entity->model->get_model_id(), texture_set, 0), entity);
+    }
+    render_queue.sort();
+    sorted_entities.clear();
+    for (size_t i = 0; i < render_queue.size(); ++i) {
+        sorted_entities.push_back(render_queue[i]);
+    }
+
+    instance_buffer.data.clear();
+    for (const auto* entity: sorted_entities) {
+        instance_buffer.data.push_back(InstanceData::Data::from_instance_data(entity->instance_data));
+    }
+    instance_buffer.upload();
+
+    for (size_t start = 0; start < sorted_entities.size();) {
+        const auto* first = sorted_entities[start];
+        size_t end = start + 1;
+        while (end < sorted_entities.size() && instance_key(sorted_entities[end]) == instance_key(first)) {
+            ++end;
+        }
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, first->render_data.emission_texture->get_texture_id());
+
+        glBindVertexArray(first->model->get_vao());
+        glBindBuffer(GL_ARRAY_BUFFER, instance_buffer.id());
+        InstanceData::Data::setup_attrib_pointers(start * sizeof(InstanceData::Data));
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, first->model->get_index_count(), GL_UNSIGNED_INT, first->model->get_index_pointer(), (int) (end - start), first->model->get_vertex_offset());
+
+        start = end;
+    }
+}
+
+void EmissiveEntityRenderer::EmissiveEntityRenderer::render_indirect(const RenderScene& render_scene) {
+    if (render_scene.entities.empty()) return;
+    if (!gpu_culler.has_value()) gpu_culler.emplace();
+
+    // Every model is in the same arena, so only entities with different textures need separate calls
+    auto texture_key = [](const Entity* entity) {
+        return std::make_pair(entity->model->get_vao(), entity->render_data.emission_texture->get_texture_id());
+    };
+    render_queue.clear();
+    for (const auto& entity: render_scene.entities) {
+        uint texture_set = render_queue.get_texture_set(entity->render_data.emission_texture->get_texture_id());
+        // Models are left out of the key, so that each texture is contiguous
+        render_queue.push(Queue::make_key(RenderPass::Emissive, 0, 0, texture_set, 0), entity.get());
+    }
+    render_queue.sort();
+
+    // One command per entity, which the GPU culls, and base_instance picks out the entity's per instance data
+    instance_buffer.data.clear();
+    gpu_culler->clear();
+    for (size_t i = 0; i < render_queue.size(); ++i) {
+        const auto* entity = render_queue[i];
+        instance_buffer.data.push_back(InstanceData::Data::from_instance_data(entity->instance_data));
+        gpu_culler->push({(uint) entity->model->get_index_count(), 0, entity->model->get_first_index(), entity->model->get_vertex_offset(), (uint) i}, bounding_sphere(*entity));
+    }
+    instance_buffer.upload();
+    gpu_culler->cull(Frustum(render_scene.global_data.projection_view_matrix));
+
+    instanced_shader.use();
+    instanced_shader.set_global_data(render_scene.global_data);
+
+    for (size_t start = 0; start < render_queue.size();) {
+        const auto* first = render_queue[start];
+        size_t end = start + 1;
+        while (end < render_queue.size() && texture_key(render_queue[end]) == texture_key(first)) {
+            ++end;
+        }
+
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, entity->render_data.emission_texture->get_texture_id());
+        glBindTexture(GL_TEXTURE_2D, first->render_data.emission_texture->get_texture_id());
+
+        glBindVertexArray(first->model->get_vao());
+        glBindBuffer(GL_ARRAY_BUFFER, instance_buffer.id());
+        InstanceData::Data::setup_attrib_pointers(0);
+        gpu_culler->draw(start, end - start);
 
-        glBindVertexArray(entity->model->get_vao());
-        glDrawElementsBaseVertex(GL_TRIANGLES, entity->model->get_index_count(), GL_UNSIGNED_INT, nullptr, entity->model->get_vertex_offset());
+        start = end;
     }
 }
 
 bool EmissiveEntityRenderer::EmissiveEntityRenderer::refresh_shaders() {
-    return shader.reload_files();
+    bool success = shader.reload_files();
+    success &= instanced_shader.reload_files();
+    if (gpu_culler.has_value()) success &= gpu_culler->refresh_shaders();
+    return success;
+}
+
+EmissiveEntityRenderer::InstanceData::Data EmissiveEntityRenderer::InstanceData::Data::from_instance_data(const InstanceData& instance_data) {
+    const auto& entity_material = instance_data.material;
+    return Data{
+        instance_data.model_matrix,
+        glm::vec3(entity_material.emission_tint) * entity_material.emission_tint.a
+    };
+}
+
+void EmissiveEntityRenderer::InstanceData::Data::setup_attrib_pointers(size_t offset) {
+    // Matrix attributes take up one location per column
+    for (uint i = 0; i < 4; ++i) {
+        glVertexAttribPointer(5 + i, 4, GL_FLOAT, GL_FALSE, sizeof(Data), (void*) (offset + offsetof(Data, model_matrix) + i * sizeof(glm::vec4)));
+    }
+    glVertexAttribPointer(9, 3, GL_FLOAT, GL_FALSE, sizeof(Data), (void*) (offset + offsetof(Data, emission_tint)));
+
+    for (uint location = 5; location <= 9; ++location) {
+        glVertexAttribDivisor(location, 1);
+        glEnableVertexAttribArray(location);
+    }
 }
@@ -10,10 +10,14 @@
 #include <assimp/scene.h>
 
 #include "rendering/renders/shaders/ShaderInterface.h"
+#include "rendering/renders/RenderQueue.h"
+#include "rendering/renders/GpuCuller.h"
 #include "rendering/scene/GlobalData.h"
 #include "rendering/scene/RenderScene.h"
+#include "rendering/scene/Frustum.h"
 #include "rendering/scene/RenderedEntity.h"
 #include "rendering/resources/TextureHandle.h"
+#include "rendering/memory/InstanceBuffer.h"
 
 #include "EntityRenderer.h"
 
@@ -34,6 +38,17 @@ namespace EmissiveEntityRenderer {
 
         // Material properties
         EmissiveEntityMaterial material;
+
+        // On GPU format, used by the instanced draw path where it is read as per instance vertex attributes
+        struct Data {
+            glm::mat4 model_matrix;
+            glm::vec3 emission_tint;
+
+            static Data from_instance_data(const InstanceData& instance_data);
+            /// Points the per instance attributes (locations 5 to 9) of the bound VAO at the buffer bound to GL_ARRAY_BUFFER,
+            /// with `offset` being the byte offset of the first instance to draw.
+            static void setup_attrib_pointers(size_t offset);
+        };
     };
 
     using GlobalData = BaseEntityGlobalData;
@@ -53,7 +68,8 @@ namespace EmissiveEntityRenderer {
         // Material
         int emission_tint_location{};
     public:
-        EmissiveEntityShader();
+        /// If instanced is set, then the per instance data is sourced from vertex attributes instead of uniforms
+        explicit EmissiveEntityShader(bool instanced = false);
 
         void set_instance_data(const InstanceData& instance_data);
     private:
@@ -61,12 +77,32 @@ namespace EmissiveEntityRenderer {
     };
 
     class EmissiveEntityRenderer {
+        // Emissive entities don't need anything besides the entity, so the same queue serves both draw paths
+        using Queue = RenderQueue<const Entity*>;
+
         EmissiveEntityShader shader;
+        Queue render_queue{};
+
+        // Instanced draw path
+        EmissiveEntityShader instanced_shader;
+        InstanceBuffer<InstanceData::Data> instance_buffer;
+        std::vector<const Entity*> sorted_entities{};
+
+        // GPU driven draw path, created on first use since it needs GL 4.3
+        std::optional<GpuCuller> gpu_culler{};
 
+        // Frustum culling, reused between frames
+        FrustumCuller frustum_culler{};
+        std::vector<const Entity*> visible_entities{};
     public:
         EmissiveEntityRenderer();
 
         void render(const RenderScene& render_scene);
+        /// Render the scene by grouping entities that share a model and texture, drawing each group with a single instanced draw call.
+        void render_instanced(const RenderScene& render_scene);
+        /// Render the scene with frustum culling done by a compute shader, and a multi draw indirect call per texture.
+        /// Needs GpuCuller::is_supported.
+        void render_indirect(const RenderScene& render_scene);
 
         bool refresh_shaders();
     };
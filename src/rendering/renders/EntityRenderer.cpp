@@ -1,7 +1,11 @@
 #include "EntityRenderer.h"
 
-EntityRenderer::EntityShader::EntityShader() :
-    BaseLitEntityShader("Entity", "entity/vert.glsl", "entity/frag.glsl") {
+#include <algorithm>
+
+EntityRenderer::EntityShader::EntityShader(bool instanced) :
+    BaseLitEntityShader(instanced ? "Instanced Entity" : "Entity", "entity/vert.glsl", "entity/frag.glsl",
+                        instanced ? std::unordered_map<std::string, std::string>{{"INSTANCED", "1"}} : std::unordered_map<std::string, std::string>{},
+                        instanced ? std::unordered_map<std::string, std::string>{{"INSTANCED", "1"}} : std::unordered_map<std::string, std::string>{}) {
 
     get_uniforms_set_bindings();
 }
@@ -12,25 +16,6 @@ void EntityRenderer::EntityShader::get_uniforms_set_bindings() {
     normal_matrix_location = get_uniform_location("normal_matrix");
 }
 
-// task h
-void EntityRenderer::EntityShader::set_directional_lights(const std::vector<DirectionalLight>& directional_lights) {
-    uint count = std::min(MAX_DL, (uint) directional_lights.size());
-
-    for (uint i = 0; i < count; i++) {
-        const DirectionalLight& directional_light = directional_lights[i];
-
-        glm::vec3 scaled_colour = glm::vec3(directional_light.colour) * directional_light.colour.a;
-
-        directional_lights_ubo.data[i].direction = directional_light.direction;
-        directional_lights_ubo.data[i].colour = scaled_colour;
-        directional_lights_ubo.data[i].intensity = directional_light.colour.a;
-    }
-
-    set_frag_define("NUM_DL", Formatter() << count);
-    directional_lights_ubo.bind(DIRECTIONAL_LIGHT_BINDING);
-    directional_lights_ubo.upload();
-}
-
 void EntityRenderer::EntityShader::set_instance_data(const BaseLitEntityInstanceData& instance_data) {
     BaseLitEntityShader::set_instance_data(instance_data); // Call the base implementation to set all the common instance data
 
@@ -45,38 +30,280 @@ void EntityRenderer::EntityShader::set_instance_data(const BaseLitEntityInstance
     glProgramUniformMatrix3fv(id(), normal_matrix_location, 1, GL_FALSE, &normal_matrix[0][0]);
 }
 
-EntityRenderer::EntityRenderer::EntityRenderer() : shader() {}
+EntityRenderer::EntityDepthShader::EntityDepthShader(bool instanced) :
+    BaseEntityShader(instanced ? "Instanced Entity Depth" : "Entity Depth", "entity/vert.glsl", "depth/frag.glsl",
+                     instanced ? std::unordered_map<std::string, std::string>{{"INSTANCED", "1"}} : std::unordered_map<std::string, std::string>{}) {}
+
+EntityRenderer::EntityRenderer::EntityRenderer() : shader(), instanced_shader(true), instance_buffer(), depth_shader(), instanced_depth_shader(true) {}
 
-void EntityRenderer::EntityRenderer::render(const RenderScene& render_scene, const LightScene& light_scene) {
+/// World space bounding sphere of an entity, (centre, radius)
+static glm::vec4 bounding_sphere(const EntityRenderer::Entity& entity) {
+    return entity.model->get_bounds().world_sphere(entity.instance_data.model_matrix);
+}
+
+/// The textures to bind for an entity in the instanced draw paths
+static uint diffuse_texture_id(const EntityRenderer::Entity& entity) {
+    return BaseLitEntityShader::instanced_texture_id(*entity.render_data.diffuse_texture);
+}
+
+static uint specular_texture_id(const EntityRenderer::Entity& entity) {
+    return BaseLitEntityShader::instanced_texture_id(*entity.render_data.specular_map_texture);
+}
+
+void EntityRenderer::EntityRenderer::render(const RenderScene& render_scene, const LightScene& light_scene, bool clustered_lighting) {
     shader.use();
     shader.set_global_data(render_scene.global_data);
+    // task h
+    shader.set_directional_lights(light_scene.get_directional_lights(BaseLitEntityShader::MAX_DL));
+    shader.set_clustered_lighting(clustered_lighting);
+
+    Frustum frustum(render_scene.global_data.projection_view_matrix);
+    frustum_culler.cull(frustum, render_scene.entities, bounding_sphere, visible_entities);
+
+    // The point lights are chosen while building the queue, since how many there are decides the shader variant, which is part of the key
+    render_queue.clear();
+    queued_point_lights.clear();
+    const glm::mat4& view_matrix = render_scene.global_data.view_matrix;
+    for (const auto* entity: visible_entities) {
+        glm::vec4 sphere = bounding_sphere(*entity);
+        QueuedEntity queued{entity, (uint) queued_point_lights.size(), 0};
+        if (!clustered_lighting) {
+            light_scene.get_nearest_point_lights(sphere, BaseLitEntityShader::MAX_PL, 1, nearest_point_lights, sphere.w);
+            queued_point_lights.insert(queued_point_lights.end(), nearest_point_lights.begin(), nearest_point_lights.end());
+            queued.point_light_count = (uint) nearest_point_lights.size();
+        }
+
+        float view_depth = -(view_matrix * glm::vec4(glm::vec3(sphere), 1.0f)).z;
+        uint texture_set = render_queue.get_texture_set(entity->render_data.diffuse_texture->get_texture_id(), entity->render_data.specular_map_texture->get_texture_id());
+        render_queue.push(Queue::make_key(RenderPass::Opaque, queued.point_light_count, entity->model->get_model_id(), texture_set, Queue::quantise_depth(view_depth)), queued);
+    }
+    render_queue.sort();
+
+    uint bound_vao = 0;
+    uint bound_diffuse = 0;
+    uint bound_specular = 0;
+    for (size_t i = 0; i < render_queue.size(); ++i) {
+        const auto& [entity, first_point_light, point_light_count] = render_queue[i];
+
+        if (!clustered_lighting) {
+            // IMPORTANT NOTE:
+            // This call switches to a different shader variant if the value for "NUM_PL" changes, which compiles it the first time that count is seen.
+            // After that it is just a change of program, but the per instance uniforms belong to the program, so they must be set after this.
+            shader.set_point_lights(&queued_point_lights[first_point_light], point_light_count);
+        }
 
-    for (const auto& entity: render_scene.entities) {
         shader.set_instance_data(entity->instance_data);
 
-        glm::vec3 position = entity->instance_data.model_matrix[3];
-        // IMPORTANT NOTE:
-        // This call has the potential to recompile the shader if the value for "NUM_PL" changes.
-        // If this where to happen for every entity, it would MASSIVELY kill performance (and possibly just not even work at all).
-        // However, in this case, consecutive get_nearest_point_lights calls WILL return the same number of items,
-        // so that issue won't happen since it only recompiles on a change.
-        // Just make sure to be careful of this kind of thing.
-        shader.set_point_lights(light_scene.get_nearest_point_lights(position, BaseLitEntityShader::MAX_PL, 1));
-        // task h
-        shader.set_directional_lights(light_scene.get_directional_lights(BaseLitEntityShader::MAX_DL));
+        // Consecutive draws often share state, since the queue is sorted by it
+        uint diffuse = entity->render_data.diffuse_texture->get_texture_id();
+        if (diffuse != bound_diffuse) {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, diffuse);
+            bound_diffuse = diffuse;
+        }
+        uint specular = entity->render_data.specular_map_texture->get_texture_id();
+        if (specular != bound_specular) {
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, specular);
+            bound_specular = specular;
+        }
+        if (entity->model->get_vao() != bound_vao) {
+            bound_vao = entity->model->get_vao();
+            glBindVertexArray(bound_vao);
+        }
+
+        glDrawElementsBaseVertex(GL_TRIANGLES, entity->model->get_index_count(), GL_UNSIGNED_INT, entity->model->get_index_pointer(), entity->model->get_vertex_offset());
+    }
+}
+
+void EntityRenderer::EntityRenderer::render_instanced(const RenderScene& render_scene, const LightScene& light_scene, bool clustered_lighting) {
+    if (render_scene.entities.empty()) return;
+
+    instanced_shader.use();
+    instanced_shader.set_global_data(render_scene.global_data);
+    instanced_shader.set_directional_lights(light_scene.get_directional_lights(BaseLitEntityShader::MAX_DL));
+    instanced_shader.set_clustered_lighting(clustered_lighting);
+
+    // Entities which can share a draw call, which the queue makes contiguous. With texture arrays, that is any in the same arrays
+    auto instance_key = [](const Entity* entity) {
+        return std::make_tuple(entity->model->get_vao(), entity->model->get_model_id(), diffuse_texture_id(*entity), specular_texture_id(*entity));
+    };
+    Frustum frustum(render_scene.global_data.projection_view_matrix);
+    frustum_culler.cull(frustum, render_scene.entities, bounding_sphere, visible_entities);
+    // Depth is left out of the key, since each group is a single draw call anyway
+    instance_queue.clear();
+    for (const auto* entity: visible_entities) {
+        uint texture_set = instance_queue.get_texture_set(diffuse_texture_id(*entity), specular_texture_id(*entity));
+        instance_queue.push(InstanceQueue::make_key(RenderPass::Opaque, 0, entity->model->get_model_id(), texture_set, 0), entity);
+    }
+    instance_queue.sort();
+    sorted_entities.clear();
+    for (size_t i = 0; i < instance_queue.size(); ++i) {
+        sorted_entities.push_back(instance_queue[i]);
+    }
+
+    instance_buffer.data.clear();
+    for (const auto* entity: sorted_entities) {
+        instance_buffer.data.push_back(InstanceData::Data::from_instance_data(entity->instance_data, entity->render_data.get_texture_layers()));
+    }
+    instance_buffer.upload();
+
+    for (size_t start = 0; start < sorted_entities.size();) {
+        const auto* first = sorted_entities[start];
+        size_t end = start + 1;
+        glm::vec3 centroid = first->instance_data.model_matrix[3];
+        while (end < sorted_entities.size() && instance_key(sorted_entities[end]) == instance_key(first)) {
+            centroid += glm::vec3(sorted_entities[end]->instance_data.model_matrix[3]);
+            ++end;
+        }
+        centroid /= (float) (end - start);
+
+        if (!clustered_lighting) {
+            // See the note in render() about this potentially switching variant
+            light_scene.get_nearest_point_lights(centroid, BaseLitEntityShader::MAX_PL, 1, nearest_point_lights);
+            instanced_shader.set_point_lights(nearest_point_lights);
+        }
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(BaseLitEntityShader::instanced_texture_target(), diffuse_texture_id(*first));
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(BaseLitEntityShader::instanced_texture_target(), specular_texture_id(*first));
+
+        glBindVertexArray(first->model->get_vao());
+        glBindBuffer(GL_ARRAY_BUFFER, instance_buffer.id());
+        InstanceData::Data::setup_attrib_pointers(start * sizeof(InstanceData::Data));
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, first->model->get_index_count(), GL_UNSIGNED_INT, first->model->get_index_pointer(), (int) (end - start), first->model->get_vertex_offset());
+
+        start = end;
+    }
+}
+
+void EntityRenderer::EntityRenderer::render_indirect(const RenderScene& render_scene, const LightScene& light_scene, bool clustered_lighting) {
+    if (render_scene.entities.empty()) return;
+    if (!gpu_culler.has_value()) gpu_culler.emplace();
+
+    // Every model is in the same arena, so only entities with different textures (or texture arrays) need separate calls
+    auto texture_key = [](const Entity* entity) {
+        return std::make_tuple(entity->model->get_vao(), diffuse_texture_id(*entity), specular_texture_id(*entity));
+    };
+    instance_queue.clear();
+    for (const auto& entity: render_scene.entities) {
+        uint texture_set = instance_queue.get_texture_set(diffuse_texture_id(*entity), specular_texture_id(*entity));
+        // Models are left out of the key, so that each set of textures is contiguous
+        instance_queue.push(InstanceQueue::make_key(RenderPass::Opaque, 0, 0, texture_set, 0), entity.get());
+    }
+    instance_queue.sort();
+
+    // One command per entity, which the GPU culls, and base_instance picks out the entity's per instance data
+    instance_buffer.data.clear();
+    gpu_culler->clear();
+    for (size_t i = 0; i < instance_queue.size(); ++i) {
+        const auto* entity = instance_queue[i];
+        instance_buffer.data.push_back(InstanceData::Data::from_instance_data(entity->instance_data, entity->render_data.get_texture_layers()));
+        gpu_culler->push({(uint) entity->model->get_index_count(), 0, entity->model->get_first_index(), entity->model->get_vertex_offset(), (uint) i}, bounding_sphere(*entity));
+    }
+    instance_buffer.upload();
+    gpu_culler->cull(Frustum(render_scene.global_data.projection_view_matrix));
+
+    instanced_shader.use();
+    instanced_shader.set_global_data(render_scene.global_data);
+    instanced_shader.set_directional_lights(light_scene.get_directional_lights(BaseLitEntityShader::MAX_DL));
+    instanced_shader.set_clustered_lighting(clustered_lighting);
+
+    for (size_t start = 0; start < instance_queue.size();) {
+        const auto* first = instance_queue[start];
+        size_t end = start + 1;
+        glm::vec3 centroid = first->instance_data.model_matrix[3];
+        while (end < instance_queue.size() && texture_key(instance_queue[end]) == texture_key(first)) {
+            centroid += glm::vec3(instance_queue[end]->instance_data.model_matrix[3]);
+            ++end;
+        }
+        centroid /= (float) (end - start);
+
+        if (!clustered_lighting) {
+            // Like render_instanced, the whole call shares the lights nearest its centroid, clustered lighting is a much better fit for this path
+            light_scene.get_nearest_point_lights(centroid, BaseLitEntityShader::MAX_PL, 1, nearest_point_lights);
+            instanced_shader.set_point_lights(nearest_point_lights);
+        }
 
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, entity->render_data.diffuse_texture->get_texture_id());
+        glBindTexture(BaseLitEntityShader::instanced_texture_target(), diffuse_texture_id(*first));
         glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, entity->render_data.specular_map_texture->get_texture_id());
+        glBindTexture(BaseLitEntityShader::instanced_texture_target(), specular_texture_id(*first));
+
+        glBindVertexArray(first->model->get_vao());
+        glBindBuffer(GL_ARRAY_BUFFER, instance_buffer.id());
+        InstanceData::Data::setup_attrib_pointers(0);
+        gpu_culler->draw(start, end - start);
+
+        start = end;
+    }
+}
+
+void EntityRenderer::EntityRenderer::render_depth(const RenderScene& render_scene, bool instanced) {
+    Frustum frustum(render_scene.global_data.projection_view_matrix);
+    frustum_culler.cull(frustum, render_scene.entities, bounding_sphere, visible_entities);
+    if (visible_entities.empty()) return;
+
+    // Front to back, so that as much as possible is rejected by the early depth test, and grouped by model for instancing
+    const glm::mat4& view_matrix = render_scene.global_data.view_matrix;
+    instance_queue.clear();
+    for (const auto* entity: visible_entities) {
+        float view_depth = instanced ? 0.0f : -(view_matrix * entity->instance_data.model_matrix[3]).z;
+        uint model_id = instanced ? entity->model->get_model_id() : 0;
+        instance_queue.push(InstanceQueue::make_key(RenderPass::Opaque, 0, model_id, 0, InstanceQueue::quantise_depth(view_depth)), entity);
+    }
+    instance_queue.sort();
+
+    if (!instanced) {
+        depth_shader.use();
+        depth_shader.set_global_data(render_scene.global_data);
+
+        uint bound_vao = 0;
+        for (size_t i = 0; i < instance_queue.size(); ++i) {
+            const auto* entity = instance_queue[i];
+            depth_shader.set_instance_data(entity->instance_data);
+            if (entity->model->get_vao() != bound_vao) {
+                bound_vao = entity->model->get_vao();
+                glBindVertexArray(bound_vao);
+            }
+            glDrawElementsBaseVertex(GL_TRIANGLES, entity->model->get_index_count(), GL_UNSIGNED_INT, entity->model->get_index_pointer(), entity->model->get_vertex_offset());
+        }
+        return;
+    }
+
+    instanced_depth_shader.use();
+    instanced_depth_shader.set_global_data(render_scene.global_data);
+
+    instance_buffer.data.clear();
+    for (size_t i = 0; i < instance_queue.size(); ++i) {
+        instance_buffer.data.push_back(InstanceData::Data::from_instance_data(instance_queue[i]->instance_data));
+    }
+    instance_buffer.upload();
+
+    for (size_t start = 0; start < instance_queue.size();) {
+        const auto* first = instance_queue[start];
+        size_t end = start + 1;
+        while (end < instance_queue.size() && instance_queue[end]->model->get_model_id() == first->model->get_model_id()) {
+            ++end;
+        }
+
+        glBindVertexArray(first->model->get_vao());
+        glBindBuffer(GL_ARRAY_BUFFER, instance_buffer.id());
+        InstanceData::Data::setup_attrib_pointers(start * sizeof(InstanceData::Data));
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, first->model->get_index_count(), GL_UNSIGNED_INT, first->model->get_index_pointer(), (int) (end - start), first->model->get_vertex_offset());
 
-        glBindVertexArray(entity->model->get_vao());
-        glDrawElementsBaseVertex(GL_TRIANGLES, entity->model->get_index_count(), GL_UNSIGNED_INT, nullptr, entity->model->get_vertex_offset());
+        start = end;
     }
 }
 
 bool EntityRenderer::EntityRenderer::refresh_shaders() {
-    return shader.reload_files();
+    bool success = shader.reload_files();
+    success &= instanced_shader.reload_files();
+    success &= depth_shader.reload_files();
+    success &= instanced_depth_shader.reload_files();
+    if (gpu_culler.has_value()) success &= gpu_culler->refresh_shaders();
+    return success;
 }
 
 void EntityRenderer::VertexData::from_mesh(const VertexCollection& vertex_collection, std::vector<VertexData>& out_vertices) {
@@ -8,13 +8,17 @@
 #include <glm/glm.hpp>
 
 #include "rendering/renders/shaders/ShaderInterface.h"
+#include "rendering/renders/RenderQueue.h"
+#include "rendering/renders/GpuCuller.h"
 #include "rendering/scene/Lights.h"
 #include "rendering/scene/GlobalData.h"
 #include "rendering/scene/RenderScene.h"
+#include "rendering/scene/Frustum.h"
 #include "rendering/scene/RenderedEntity.h"
 #include "rendering/resources/ModelLoader.h"
 #include "rendering/resources/TextureHandle.h"
 #include "rendering/memory/UniformBufferArray.h"
+#include "rendering/memory/InstanceBuffer.h"
 
 #include "rendering/renders/shaders/BaseLitEntityShader.h"
 
@@ -40,22 +44,70 @@ namespace EntityRenderer {
     class EntityShader : public BaseLitEntityShader {
         int normal_matrix_location{};
     public:
-        EntityShader();
+        /// If instanced is set, then the per instance data is sourced from vertex attributes instead of uniforms
+        explicit EntityShader(bool instanced = false);
 
         void set_instance_data(const BaseLitEntityInstanceData& instance_data);
-        // task h
-        void set_directional_lights(const std::vector<DirectionalLight>& directional_lights);
     protected:
         void get_uniforms_set_bindings() override;
     };
 
+    /// Writes only depth, for the depth pre-pass, using the same vertex shader as EntityShader so that the depths match exactly
+    class EntityDepthShader : public BaseEntityShader {
+    public:
+        /// If instanced is set, then the per instance data is sourced from vertex attributes instead of uniforms
+        explicit EntityDepthShader(bool instanced = false);
+    };
+
     class EntityRenderer {
+        /// An entity waiting in the render queue, along with the range of queued_point_lights chosen for it
+        struct QueuedEntity {
+            const Entity* entity;
+            uint first_point_light;
+            uint point_light_count;
+        };
+        using Queue = RenderQueue<QueuedEntity>;
+        using InstanceQueue = RenderQueue<const Entity*>;
+
         EntityShader shader;
+        Queue render_queue{};
+        std::vector<PointLight> queued_point_lights{};
+
+        // Instanced draw path
+        EntityShader instanced_shader;
+        InstanceBuffer<InstanceData::Data> instance_buffer;
+        InstanceQueue instance_queue{};
+        std::vector<const Entity*> sorted_entities{};
+
+        // Depth pre-pass
+        EntityDepthShader depth_shader;
+        EntityDepthShader instanced_depth_shader;
+
+        // GPU driven draw path, created on first use since it needs GL 4.3
+        std::optional<GpuCuller> gpu_culler{};
+
+        // Frustum culling, reused between frames
+        FrustumCuller frustum_culler{};
+        std::vector<const Entity*> visible_entities{};
 
+        // Reused between entities to avoid allocating for every light query
+        std::vector<PointLight> nearest_point_lights{};
     public:
         EntityRenderer();
 
-        void render(const RenderScene& render_scene, const LightScene& light_scene);
+        /// If clustered_lighting is set, point lights are read from the clusters bound by ClusteredLights::bind instead of being picked per entity.
+        void render(const RenderScene& render_scene, const LightScene& light_scene, bool clustered_lighting = false);
+        /// Render the scene by grouping entities that share a model and textures, drawing each group with a single instanced draw call.
+        /// Where texture arrays are supported (see BaseLitEntityShader::uses_texture_arrays), only the arrays need to be shared.
+        /// Since a group shares a single set of point lights, they are chosen based on the centroid of the group.
+        void render_instanced(const RenderScene& render_scene, const LightScene& light_scene, bool clustered_lighting = false);
+        /// Render the scene with frustum culling done by a compute shader, and a multi draw indirect call per set of textures (or texture arrays).
+        /// Needs GpuCuller::is_supported. Like render_instanced, the point lights for each call are chosen based on the centroid of its entities.
+        void render_indirect(const RenderScene& render_scene, const LightScene& light_scene, bool clustered_lighting = false);
+
+        /// Draw only the depth of the scene, for a depth pre-pass, so the lit pass can skip shading hidden fragments.
+        /// instanced must match how the lit pass will source the model matrices (true for render_instanced and render_indirect), or the depths may differ slightly.
+        void render_depth(const RenderScene& render_scene, bool instanced = false);
 
         bool refresh_shaders();
     };
@@ -0,0 +1,59 @@
+#include "GpuCuller.h"
+
+GpuCuller::CullShader::CullShader() :
+    ComputeShader("Cull", "culling/comp.glsl", {{"WORK_GROUP_SIZE", Formatter() << WORK_GROUP_SIZE}}) {}
+
+void GpuCuller::CullShader::set_frustum(const Frustum& frustum) {
+    auto planes = frustum.get_planes();
+    glProgramUniform4fv(id(), get_uniform_location("frustum_planes"), (int) planes.size(), &planes[0][0]);
+}
+
+void GpuCuller::CullShader::set_draw_count(uint draw_count) {
+    glProgramUniform1ui(id(), get_uniform_location("draw_count"), draw_count);
+}
+
+GpuCuller::GpuCuller() : shader() {}
+
+bool GpuCuller::is_supported() {
+    return GLAD_GL_VERSION_4_3;
+}
+
+void GpuCuller::clear() {
+    bounding_spheres_buffer.data.clear();
+    draw_commands_buffer.data.clear();
+}
+
+void GpuCuller::push(const DrawCommand& command, glm::vec4 bounding_sphere) {
+    draw_commands_buffer.data.push_back(command);
+    bounding_spheres_buffer.data.push_back(bounding_sphere);
+}
+
+size_t GpuCuller::size() const {
+    return draw_commands_buffer.data.size();
+}
+
+void GpuCuller::cull(const Frustum& frustum) {
+    bounding_spheres_buffer.upload();
+    draw_commands_buffer.upload();
+    if (size() == 0) return;
+
+    shader.use();
+    shader.set_frustum(frustum);
+    shader.set_draw_count((uint) size());
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BOUNDING_SPHERES_BINDING, bounding_spheres_buffer.id());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_COMMANDS_BINDING, draw_commands_buffer.id());
+    shader.dispatch(((uint) size() + WORK_GROUP_SIZE - 1) / WORK_GROUP_SIZE);
+    // The commands are read by the draws as indirect arguments, not through shader storage
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+}
+
+void GpuCuller::draw(size_t first, size_t count) const {
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, draw_commands_buffer.id());
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*) (first * sizeof(DrawCommand)), (int) count, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+bool GpuCuller::refresh_shaders() {
+    return shader.reload_files();
+}
@@ -0,0 +1,64 @@
+#ifndef GPU_CULLER_H
+#define GPU_CULLER_H
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "rendering/scene/Frustum.h"
+#include "rendering/memory/InstanceBuffer.h"
+#include "rendering/renders/shaders/ComputeShader.h"
+
+/// GPU driven submission. A renderer fills in an indirect draw command and a world space bounding sphere per draw,
+/// and then a compute shader frustum culls every draw at once by zeroing the instance count of those that can't be seen,
+/// so that the draws can be submitted in a few glMultiDrawElementsIndirect calls without the CPU looking at them again.
+///
+/// Needs GL 4.3 (compute shaders, shader storage buffers and multi draw indirect), see is_supported.
+class GpuCuller {
+public:
+    /// The layout glMultiDrawElementsIndirect expects
+    struct DrawCommand {
+        uint count;
+        uint instance_count;
+        uint first_index;
+        int base_vertex;
+        // Selects the per instance attributes, since instanced attributes start from base_instance
+        uint base_instance;
+    };
+
+    static constexpr uint WORK_GROUP_SIZE = 64;
+    static constexpr uint BOUNDING_SPHERES_BINDING = 0;
+    static constexpr uint DRAW_COMMANDS_BINDING = 1;
+private:
+    class CullShader : public ComputeShader {
+    public:
+        CullShader();
+        void set_frustum(const Frustum& frustum);
+        void set_draw_count(uint draw_count);
+    };
+
+    CullShader shader;
+    // These are plain buffers, InstanceBuffer is just used for its upload handling
+    InstanceBuffer<glm::vec4> bounding_spheres_buffer{};
+    InstanceBuffer<DrawCommand> draw_commands_buffer{};
+public:
+    GpuCuller();
+
+    /// Whether the context supports this path, otherwise renderers should stay on their CPU culled paths
+    static bool is_supported();
+
+    /// Clear the queued draws for a new frame
+    void clear();
+    /// Queue a draw, which is culled by its world space bounding sphere (centre, radius)
+    void push(const DrawCommand& command, glm::vec4 bounding_sphere);
+    [[nodiscard]] size_t size() const;
+
+    /// Upload the queued draws and cull them against the frustum. Leaves the cull program in use.
+    void cull(const Frustum& frustum);
+    /// Submit `count` of the queued draws starting from `first`, after cull. The VAO, program and textures must already be bound.
+    void draw(size_t first, size_t count) const;
+
+    bool refresh_shaders();
+};
+
+#endif //GPU_CULLER_H
@@ -4,7 +4,7 @@
 #include "rendering/imgui/ImGuiManager.h"
 #include "scene/SceneContext.h"
 
-MasterRenderer::MasterRenderer() : entity_renderer(), animated_entity_renderer(), emissive_entity_renderer(), render_settings() {
+MasterRenderer::MasterRenderer() : entity_renderer(), animated_entity_renderer(), emissive_entity_renderer(), clustered_lights(), render_settings() {
     glEnable(GL_DEPTH_TEST);
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
     glEnable(GL_CULL_FACE);
@@ -15,14 +15,70 @@ MasterRenderer::MasterRenderer() : entity_renderer(), animated_entity_renderer()
 
 void MasterRenderer::update(const Window& window) {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-    glViewport(0, 0, (int) window.get_framebuffer_width(), (int) window.get_framebuffer_height());
+    viewport_size = {window.get_framebuffer_width(), window.get_framebuffer_height()};
+    glViewport(0, 0, (int) viewport_size.x, (int) viewport_size.y);
 }
 
 void MasterRenderer::render_scene(MasterRenderScene& render_scene, const SceneContext& scene_context) {
     render_scene.animator.animate(scene_context.window_manager.get_delta_time());
-    entity_renderer.render(render_scene.entity_scene, render_scene.light_scene);
-    animated_entity_renderer.render(render_scene.animated_entity_scene, render_scene.light_scene);
-    emissive_entity_renderer.render(render_scene.emissive_entity_scene);
+    bool baked_animation = render_settings.baked_animation;
+    if (!baked_animation) {
+        // Every pose is worked out up front in parallel, rather than one at a time in the middle of submitting draws
+        animated_entity_renderer.update_poses(render_scene.animated_entity_scene, thread_pool);
+    }
+    // Lights may have been moved since last frame
+    render_scene.light_scene.update_spatial_index();
+
+    bool clustered_lighting = render_settings.clustered_lighting;
+    if (clustered_lighting) {
+        // Every render scene is given the same camera, so any of them can be used for the view
+        const auto& global_data = render_scene.entity_scene.global_data;
+        clustered_lights.update(render_scene.light_scene, global_data.view_matrix, global_data.projection_matrix, viewport_size);
+        clustered_lights.bind();
+    }
+
+    bool gpu_driven = render_settings.gpu_culling && GpuCuller::is_supported();
+    // Each mesh of an animated entity has its own bone transforms, which can't be given per draw of a multi draw, so they never take the GPU driven path
+    bool instanced = render_settings.instanced_rendering;
+
+    if (render_settings.depth_pre_pass) {
+        // The pre-pass must source model matrices the same way as the lit pass, for the depths to be exactly equal
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        entity_renderer.render_depth(render_scene.entity_scene, gpu_driven || instanced);
+        animated_entity_renderer.render_depth(render_scene.animated_entity_scene, instanced, baked_animation);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+        // Only the nearest fragment of each pixel passes, and the depth buffer is already complete
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+    }
+
+    if (gpu_driven) {
+        entity_renderer.render_indirect(render_scene.entity_scene, render_scene.light_scene, clustered_lighting);
+    } else if (instanced) {
+        entity_renderer.render_instanced(render_scene.entity_scene, render_scene.light_scene, clustered_lighting);
+    } else {
+        entity_renderer.render(render_scene.entity_scene, render_scene.light_scene, clustered_lighting);
+    }
+    if (instanced || baked_animation) {
+        animated_entity_renderer.render_instanced(render_scene.animated_entity_scene, render_scene.light_scene, clustered_lighting, baked_animation);
+    } else {
+        animated_entity_renderer.render(render_scene.animated_entity_scene, render_scene.light_scene, clustered_lighting);
+    }
+
+    if (render_settings.depth_pre_pass) {
+        // Emissive entities weren't in the pre-pass, so they are depth tested and written as normal
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+    }
+
+    if (gpu_driven) {
+        emissive_entity_renderer.render_indirect(render_scene.emissive_entity_scene);
+    } else if (instanced) {
+        emissive_entity_renderer.render_instanced(render_scene.emissive_entity_scene);
+    } else {
+        emissive_entity_renderer.render(render_scene.emissive_entity_scene);
+    }
 }
 
 void MasterRenderer::sync() {
@@ -57,6 +113,17 @@ void MasterRenderer::add_imgui_options_section(WindowManager& window_manager) {
             window_manager.set_v_sync(render_settings.v_sync);
         }
 
+        ImGui::Checkbox("Instanced Rendering", &render_settings.instanced_rendering);
+        ImGui::Checkbox("Clustered Lighting", &render_settings.clustered_lighting);
+        if (GpuCuller::is_supported()) {
+            ImGui::Checkbox("GPU Culling", &render_settings.gpu_culling);
+        } else {
+            ImGui::TextDisabled("GPU Culling (needs OpenGL 4.3)");
+        }
+
+        ImGui::Checkbox("Depth Pre-Pass", &render_settings.depth_pre_pass);
+        ImGui::Checkbox("Baked Animation", &render_settings.baked_animation);
+
         ImGui::Checkbox("Enable FPS Cap", &render_settings.enable_fps_cap);
 
         if (ImGui::SliderFloat("FPS Cap", &render_settings.fps_cap, 24.0f, 240.0f)) {
@@ -2,8 +2,10 @@
 #define MASTER_RENDERER_H
 
 #include "utility/SyncManager.h"
+#include "utility/ThreadPool.h"
 #include "EntityRenderer.h"
 #include "EmissiveEntityRenderer.h"
+#include "ClusteredLights.h"
 #include "rendering/scene/MasterRenderScene.h"
 #include "system_interfaces/WindowManager.h"
 #include "scene/SceneInterface.h"
@@ -14,7 +16,12 @@ class MasterRenderer {
     EntityRenderer::EntityRenderer entity_renderer;
     AnimatedEntityRenderer::AnimatedEntityRenderer animated_entity_renderer;
     EmissiveEntityRenderer::EmissiveEntityRenderer emissive_entity_renderer;
+    ClusteredLights clustered_lights;
     SyncManager sync_manager;
+    // Used for work spread over every core, such as posing animated entities
+    ThreadPool thread_pool;
+
+    glm::uvec2 viewport_size{1, 1};
 
     struct RenderSettings {
         bool show_wireframe = false;
@@ -23,6 +30,16 @@ class MasterRenderer {
         bool v_sync = false;
         bool enable_fps_cap = true;
         float fps_cap = 240.0f;
+        // Draw entities that share a model and textures (or the texture arrays they are in) with a single instanced draw call
+        bool instanced_rendering = false;
+        // Light each fragment with every point light that reaches it, instead of the nearest few to each entity
+        bool clustered_lighting = false;
+        // Frustum cull on the GPU and submit with multi draw indirect (needs OpenGL 4.3), animated entities stay on the CPU
+        bool gpu_culling = false;
+        // Draw opaque entities depth only first, so that the lit pass only shades the fragments that end up visible
+        bool depth_pre_pass = false;
+        // Pose animated entities from animations baked at load time, instanced, rather than evaluating their skeletons each frame
+        bool baked_animation = false;
     } render_settings;
 public:
     MasterRenderer();
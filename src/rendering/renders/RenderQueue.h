@@ -0,0 +1,150 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+
+#include "utility/HelperTypes.h"
+
+/// Coarse ordering of draws, the most significant part of a RenderQueue key
+enum class RenderPass : uint {
+    Opaque = 0,
+    Emissive = 1,
+};
+
+/// A queue of draws that is sorted by a 64 bit key each frame, so that draws sharing GL state end up next to each other.
+///
+/// Key layout, from most to least significant:
+///     pass (4 bits) | shader variant (8 bits) | model (16 bits) | texture set (16 bits) | view depth (20 bits)
+/// So draws are grouped by program, then geometry, then textures, and draws with identical state are submitted front to back.
+/// Models of a VertexData all share their arena's VAO, so the model field is the model's id within it (see ModelHandle::get_model_id).
+/// Fields that overflow their bits only cost extra state changes, since renderers compare the actual state before skipping a bind.
+template<typename Item>
+class RenderQueue {
+    struct Entry {
+        uint64_t key;
+        uint index;
+    };
+
+    std::vector<Item> items{};
+    std::vector<Entry> entries{};
+    std::vector<Entry> scratch{};
+
+    // { (texture_0, texture_1) } -> { texture set id }, reset by clear so that ids stay small enough for the key
+    std::unordered_map<uint64_t, uint> texture_sets{};
+public:
+    static constexpr uint PASS_SHIFT = 60;
+    static constexpr uint VARIANT_SHIFT = 52;
+    static constexpr uint MODEL_SHIFT = 36;
+    static constexpr uint TEXTURE_SET_SHIFT = 20;
+    static constexpr uint DEPTH_BITS = 20;
+
+    /// Pack the fields into a key, see the class documentation for the layout
+    static uint64_t make_key(RenderPass pass, uint variant, uint model, uint texture_set, uint depth);
+    /// Map a view space depth onto DEPTH_BITS, preserving order.
+    /// Takes the top bits of the float itself, which is roughly logarithmic, so precision is spent close to the camera.
+    static uint quantise_depth(float view_depth);
+
+    /// A small id for a pair of textures, so that they fit in the key. Only valid until the next clear.
+    uint get_texture_set(uint texture_0, uint texture_1 = 0);
+
+    void clear();
+    void push(uint64_t key, const Item& item);
+    /// Sort the pushed items by key, ties keep the order they were pushed in
+    void sort();
+
+    [[nodiscard]] size_t size() const;
+    [[nodiscard]] bool empty() const;
+    /// The key of the i-th item in sorted order
+    [[nodiscard]] uint64_t key(size_t i) const;
+    /// The i-th item in sorted order
+    const Item& operator[](size_t i) const;
+};
+
+template<typename Item>
+uint64_t RenderQueue<Item>::make_key(RenderPass pass, uint variant, uint model, uint texture_set, uint depth) {
+    return ((uint64_t) ((uint) pass & 0xFu) << PASS_SHIFT)
+           | ((uint64_t) (variant & 0xFFu) << VARIANT_SHIFT)
+           | ((uint64_t) (model & 0xFFFFu) << MODEL_SHIFT)
+           | ((uint64_t) (texture_set & 0xFFFFu) << TEXTURE_SET_SHIFT)
+           | (uint64_t) (depth & ((1u << DEPTH_BITS) - 1u));
+}
+
+template<typename Item>
+uint RenderQueue<Item>::quantise_depth(float view_depth) {
+    // Non-negative floats compare the same as their bit patterns do as integers
+    float depth = std::max(view_depth, 0.0f);
+    uint32_t bits;
+    std::memcpy(&bits, &depth, sizeof(bits));
+    return bits >> (32 - DEPTH_BITS);
+}
+
+template<typename Item>
+uint RenderQueue<Item>::get_texture_set(uint texture_0, uint texture_1) {
+    auto [it, inserted] = texture_sets.try_emplace(((uint64_t) texture_0 << 32) | texture_1, (uint) texture_sets.size());
+    return it->second;
+}
+
+template<typename Item>
+void RenderQueue<Item>::clear() {
+    items.clear();
+    entries.clear();
+    texture_sets.clear();
+}
+
+template<typename Item>
+void RenderQueue<Item>::push(uint64_t key, const Item& item) {
+    entries.push_back({key, (uint) items.size()});
+    items.push_back(item);
+}
+
+template<typename Item>
+void RenderQueue<Item>::sort() {
+    // LSD radix sort, one byte at a time. Stable, and linear in the number of draws.
+    scratch.resize(entries.size());
+    for (uint shift = 0; shift < 64; shift += 8) {
+        std::array<size_t, 256> counts{};
+        for (const auto& entry: entries) {
+            counts[(entry.key >> shift) & 0xFFu]++;
+        }
+        // Most passes are over fields that are the same for every draw (e.g. the pass), which doesn't change the order
+        if (counts[(entries.empty() ? 0 : entries[0].key >> shift) & 0xFFu] == entries.size()) continue;
+
+        size_t offset = 0;
+        for (auto& count: counts) {
+            size_t next = offset + count;
+            count = offset;
+            offset = next;
+        }
+        for (const auto& entry: entries) {
+            scratch[counts[(entry.key >> shift) & 0xFFu]++] = entry;
+        }
+        entries.swap(scratch);
+    }
+}
+
+template<typename Item>
+size_t RenderQueue<Item>::size() const {
+    return entries.size();
+}
+
+template<typename Item>
+bool RenderQueue<Item>::empty() const {
+    return entries.empty();
+}
+
+template<typename Item>
+uint64_t RenderQueue<Item>::key(size_t i) const {
+    return entries[i].key;
+}
+
+template<typename Item>
+const Item& RenderQueue<Item>::operator[](size_t i) const {
+    return items[entries[i].index];
+}
+
+#endif //RENDER_QUEUE_H
@@ -5,7 +5,7 @@
 BaseEntityShader::BaseEntityShader(std::string name, const std::string& vertex_path, const std::string& fragment_path,
                                    std::unordered_map<std::string, std::string> vert_defines,
                                    std::unordered_map<std::string, std::string> frag_defines) :
-    ShaderInterface(std::move(name), vertex_path, fragment_path, [&]() { get_uniforms_set_bindings(); }, std::move(vert_defines), std::move(frag_defines)) {
+    ShaderInterface(std::move(name), vertex_path, fragment_path, [&]() { get_uniforms_set_bindings(); upload_global_data(); }, std::move(vert_defines), std::move(frag_defines)) {
 
     get_uniforms_set_bindings();
 }
@@ -25,6 +25,11 @@ void BaseEntityShader::set_instance_data(const BaseEntityInstanceData& instance_
 }
 
 void BaseEntityShader::set_global_data(const BaseEntityGlobalData& global_data) {
+    this->global_data = global_data;
+    upload_global_data();
+}
+
+void BaseEntityShader::upload_global_data() {
     glProgramUniformMatrix4fv(id(), projection_view_matrix_location, 1, GL_FALSE, &global_data.projection_view_matrix[0][0]);
     glProgramUniform3fv(id(), ws_view_position_location, 1, &global_data.camera_position[0]);
     glProgramUniform1f(id(), inverse_gamma_location, 1.0f / global_data.gamma);
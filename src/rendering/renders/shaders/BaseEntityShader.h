@@ -30,9 +30,14 @@ struct BaseEntityGlobalData : public GlobalDataCameraInterface {
     glm::mat4 projection_view_matrix{};
     glm::vec3 camera_position{};
     float gamma = 1.0f;
+    // Kept separately as well, for CPU side work that needs view space (e.g. light clustering)
+    glm::mat4 view_matrix{};
+    glm::mat4 projection_matrix{};
 
     void use_camera(const CameraInterface& camera_interface) override {
-        projection_view_matrix = camera_interface.get_projection_matrix() * camera_interface.get_view_matrix();
+        view_matrix = camera_interface.get_view_matrix();
+        projection_matrix = camera_interface.get_projection_matrix();
+        projection_view_matrix = projection_matrix * view_matrix;
         camera_position = camera_interface.get_position();
         gamma = camera_interface.get_gamma();
     }
@@ -45,6 +50,9 @@ protected:
     // Global Data
     int ws_view_position_location{};
     int inverse_gamma_location{};
+
+    // Kept so that it can be applied to a new variant when the defines change mid frame
+    BaseEntityGlobalData global_data{};
 public:
     BaseEntityShader(std::string name, const std::string& vertex_path, const std::string& fragment_path,
                      std::unordered_map<std::string, std::string> vert_defines = {},
@@ -55,6 +63,8 @@ public:
     void set_global_data(const BaseEntityGlobalData& global_data);
 protected:
     virtual void get_uniforms_set_bindings();
+private:
+    void upload_global_data();
 };
 
 #endif //BASE_ENTITY_SHADER_H
@@ -2,13 +2,23 @@
 
 #include <utility>
 
+#include "rendering/memory/TextureArray.h"
+
+static std::unordered_map<std::string, std::string> with_texture_arrays(std::unordered_map<std::string, std::string> defines) {
+    // Only instances have their own layers to sample the arrays with
+    if (defines.count("INSTANCED") != 0 && BaseLitEntityShader::uses_texture_arrays()) {
+        defines["TEXTURE_ARRAYS"] = "1";
+    }
+    return defines;
+}
+
 BaseLitEntityShader::BaseLitEntityShader(std::string name, const std::string& vertex_path, const std::string& fragment_path,
                                          std::unordered_map<std::string, std::string> vert_defines,
                                          std::unordered_map<std::string, std::string> frag_defines) :
-    BaseEntityShader(std::move(name), vertex_path, fragment_path, std::move(vert_defines), std::move(frag_defines)),
-    point_lights_ubo({}, false),
+    BaseEntityShader(std::move(name), vertex_path, fragment_path, with_texture_arrays(std::move(vert_defines)), with_texture_arrays(std::move(frag_defines))),
+    point_lights_ubo({}, UniformBufferUsage::Streaming),
     // task h
-    directional_lights_ubo({}, false) {
+    directional_lights_ubo({}, UniformBufferUsage::Streaming) {
 
     get_uniforms_set_bindings();
 }
@@ -29,6 +39,11 @@ void BaseLitEntityShader::get_uniforms_set_bindings() {
     set_block_binding("PointLightArray", POINT_LIGHT_BINDING);
     // task h
     set_block_binding("DirectionalLightArray", DIRECTIONAL_LIGHT_BINDING);
+    // Clustered lighting
+    set_binding("clustered_point_lights", ClusteredLights::POINT_LIGHTS_TEXTURE_UNIT);
+    set_binding("cluster_ranges", ClusteredLights::CLUSTER_RANGES_TEXTURE_UNIT);
+    set_binding("cluster_light_indices", ClusteredLights::LIGHT_INDICES_TEXTURE_UNIT);
+    set_block_binding("ClusterData", ClusteredLights::CLUSTER_DATA_BINDING);
 }
 
 void BaseLitEntityShader::set_instance_data(const BaseLitEntityInstanceData& instance_data) {
@@ -49,8 +64,24 @@ void BaseLitEntityShader::set_instance_data(const BaseLitEntityInstanceData& ins
     glProgramUniform2fv(id(), texture_scale_location, 1, &entity_material.texture_scale[0]);
 }
 
+bool BaseLitEntityShader::uses_texture_arrays() {
+    return TextureArray::is_supported();
+}
+
+uint BaseLitEntityShader::instanced_texture_id(const TextureHandle& texture) {
+    return uses_texture_arrays() ? texture.get_array_id() : texture.get_texture_id();
+}
+
+uint BaseLitEntityShader::instanced_texture_target() {
+    return uses_texture_arrays() ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+}
+
 void BaseLitEntityShader::set_point_lights(const std::vector<PointLight>& point_lights) {
-    uint count = std::min(MAX_PL, (uint) point_lights.size());
+    set_point_lights(point_lights.data(), point_lights.size());
+}
+
+void BaseLitEntityShader::set_point_lights(const PointLight* point_lights, size_t size) {
+    uint count = std::min(MAX_PL, (uint) size);
 
     for (uint i = 0; i < count; i++) {
         const PointLight& point_light = point_lights[i];
@@ -61,10 +92,17 @@ void BaseLitEntityShader::set_point_lights(const std::vector<PointLight>& point_
         point_lights_ubo.data[i].colour = scaled_colour;
     }
 
-    // modified from vert to frag for task g
-    set_frag_define("NUM_PL", Formatter() << count);
-    point_lights_ubo.bind(POINT_LIGHT_BINDING);
+    if (count != point_light_count) {
+        point_light_count = count;
+        // modified from vert to frag for task g
+        set_frag_define("NUM_PL", Formatter() << count);
+        // Lights tend to be added or removed one at a time, so get the neighbouring variants compiling ahead of time
+        if (count > 0) prepare_frag_define("NUM_PL", Formatter() << count - 1);
+        if (count < MAX_PL) prepare_frag_define("NUM_PL", Formatter() << count + 1);
+    }
+    // Upload first, since in streaming mode each upload goes to a new range which has to be bound
     point_lights_ubo.upload();
+    point_lights_ubo.bind(POINT_LIGHT_BINDING);
 }
 
 // task h
@@ -81,7 +119,73 @@ void BaseLitEntityShader::set_directional_lights(const std::vector<DirectionalLi
         directional_lights_ubo.data[i].intensity = directional_light.colour.a;
     }
 
-    set_frag_define("NUM_DL", Formatter() << count);  // new define for directional lights
-    directional_lights_ubo.bind(DIRECTIONAL_LIGHT_BINDING);
+    if (count != directional_light_count) {
+        directional_light_count = count;
+        set_frag_define("NUM_DL", Formatter() << count);  // new define for directional lights
+        if (count > 0) prepare_frag_define("NUM_DL", Formatter() << count - 1);
+        if (count < MAX_DL) prepare_frag_define("NUM_DL", Formatter() << count + 1);
+    }
+    // Upload first, since in streaming mode each upload goes to a new range which has to be bound
     directional_lights_ubo.upload();
-}
\ No newline at end of file
+    directional_lights_ubo.bind(DIRECTIONAL_LIGHT_BINDING);
+}
+
+void BaseLitEntityShader::set_clustered_lighting(bool clustered) {
+    if (clustered == clustered_lighting) return;
+    clustered_lighting = clustered;
+
+    if (clustered) {
+        // Point lights all come from the clusters instead
+        point_light_count = 0;
+        set_frag_define("NUM_PL", "0", true);
+    }
+    set_frag_define("CLUSTERED", clustered ? "1" : "0");
+}
+
+BaseLitEntityInstanceData::Data BaseLitEntityInstanceData::Data::from_instance_data(const BaseLitEntityInstanceData& instance_data, glm::vec2 texture_layers) {
+    const auto& model_matrix = instance_data.model_matrix;
+    const auto& entity_material = instance_data.material;
+
+    // Calculate a normal matrix so that non-uniform scale transformations properly transform normals
+    // See: https://github.com/graphitemaster/normals_revisited
+    // and: https://gist.github.com/shakesoda/8485880f71010b79bc8fed0f166dabac
+    glm::mat3 normal_matrix = glm::mat3(
+        glm::cross(glm::vec3(model_matrix[1]), glm::vec3(model_matrix[2])),
+        glm::cross(glm::vec3(model_matrix[2]), glm::vec3(model_matrix[0])),
+        glm::cross(glm::vec3(model_matrix[0]), glm::vec3(model_matrix[1]))
+    );
+
+    return Data{
+        model_matrix,
+        normal_matrix,
+        glm::vec3(entity_material.diffuse_tint) * entity_material.diffuse_tint.a,
+        glm::vec3(entity_material.specular_tint) * entity_material.specular_tint.a,
+        glm::vec3(entity_material.ambient_tint) * entity_material.ambient_tint.a,
+        entity_material.shininess,
+        entity_material.texture_scale,
+        texture_layers
+    };
+}
+
+void BaseLitEntityInstanceData::Data::setup_attrib_pointers(size_t offset) {
+    // Matrix attributes take up one location per column
+    for (uint i = 0; i < 4; ++i) {
+        glVertexAttribPointer(5 + i, 4, GL_FLOAT, GL_FALSE, sizeof(Data), (void*) (offset + offsetof(Data, model_matrix) + i * sizeof(glm::vec4)));
+    }
+    for (uint i = 0; i < 3; ++i) {
+        glVertexAttribPointer(9 + i, 3, GL_FLOAT, GL_FALSE, sizeof(Data), (void*) (offset + offsetof(Data, normal_matrix) + i * sizeof(glm::vec3)));
+    }
+    glVertexAttribPointer(12, 3, GL_FLOAT, GL_FALSE, sizeof(Data), (void*) (offset + offsetof(Data, diffuse_tint)));
+    glVertexAttribPointer(13, 3, GL_FLOAT, GL_FALSE, sizeof(Data), (void*) (offset + offsetof(Data, specular_tint)));
+    glVertexAttribPointer(14, 4, GL_FLOAT, GL_FALSE, sizeof(Data), (void*) (offset + offsetof(Data, ambient_tint)));
+    glVertexAttribPointer(15, 4, GL_FLOAT, GL_FALSE, sizeof(Data), (void*) (offset + offsetof(Data, texture_scale)));
+
+    for (uint location = 5; location <= 15; ++location) {
+        glVertexAttribDivisor(location, 1);
+        glEnableVertexAttribArray(location);
+    }
+}
+
+glm::vec2 BaseLitEntityRenderData::get_texture_layers() const {
+    return {(float) diffuse_texture->get_array_layer(), (float) specular_map_texture->get_array_layer()};
+}
@@ -17,6 +17,7 @@
 #include "rendering/memory/UniformBufferArray.h"
 
 #include "BaseEntityShader.h"
+#include "rendering/renders/ClusteredLights.h"
 
 struct BaseLitEntityMaterial {
     // Alpha components are just used to store a scalar that is applied before passing to the GPU
@@ -33,6 +34,27 @@ struct BaseLitEntityInstanceData : public BaseEntityInstanceData {
 
     // Material properties
     BaseLitEntityMaterial material;
+
+    // On GPU format, used by the instanced draw path where it is read as per instance vertex attributes
+    struct Data {
+        glm::mat4 model_matrix;
+        glm::mat3 normal_matrix;
+        glm::vec3 diffuse_tint;
+        glm::vec3 specular_tint;
+        // ambient_tint and shininess are read together as a single vec4 attribute, as are texture_scale and texture_layers,
+        // so each pair must stay adjacent
+        glm::vec3 ambient_tint;
+        float shininess;
+        glm::vec2 texture_scale;
+        // (diffuse, specular) layers within the bound texture arrays, as floats since that is how array layers are sampled
+        glm::vec2 texture_layers;
+
+        /// texture_layers only matter to the variants that sample texture arrays, see BaseLitEntityRenderData::get_texture_layers
+        static Data from_instance_data(const BaseLitEntityInstanceData& instance_data, glm::vec2 texture_layers = glm::vec2(0.0f));
+        /// Points the per instance attributes (locations 5 to 15) of the bound VAO at the buffer bound to GL_ARRAY_BUFFER,
+        /// with `offset` being the byte offset of the first instance to draw.
+        static void setup_attrib_pointers(size_t offset);
+    };
 };
 
 struct BaseLitEntityRenderData {
@@ -41,6 +63,9 @@ struct BaseLitEntityRenderData {
 
     std::shared_ptr<TextureHandle> diffuse_texture;
     std::shared_ptr<TextureHandle> specular_map_texture;
+
+    /// The (diffuse, specular) layers of the textures within their texture arrays
+    [[nodiscard]] glm::vec2 get_texture_layers() const;
 };
 
 using BaseLitEntityGlobalData = BaseEntityGlobalData;
@@ -69,16 +94,34 @@ protected:
     UniformBufferArray<PointLight::Data, MAX_PL> point_lights_ubo;
     // task h
     UniformBufferArray<DirectionalLight::Data, MAX_DL> directional_lights_ubo;
+
+    // The counts the active variant was compiled for, checked before touching the defines
+    uint point_light_count = 0;
+    uint directional_light_count = 0;
+    bool clustered_lighting = false;
 public:
+    /// Instanced variants (those with INSTANCED defined) also get TEXTURE_ARRAYS defined if uses_texture_arrays
     BaseLitEntityShader(std::string name, const std::string& vertex_path, const std::string& fragment_path,
                         std::unordered_map<std::string, std::string> vert_defines = {},
                         std::unordered_map<std::string, std::string> frag_defines = {});
 
+    /// Whether the instanced variants sample the textures through their texture arrays (see TextureArray), with the layers
+    /// from the per instance data, so that entities with different textures in the same arrays can share a draw call
+    static bool uses_texture_arrays();
+    /// The texture to bind for a texture handle when drawing with an instanced variant, and the target to bind it to
+    static uint instanced_texture_id(const TextureHandle& texture);
+    static uint instanced_texture_target();
+
     void set_instance_data(const BaseLitEntityInstanceData& instance_data);
 
+    /// Switches to the variant for the number of lights, so must be called before setting any per instance data.
     void set_point_lights(const std::vector<PointLight>& point_lights);
+    void set_point_lights(const PointLight* point_lights, size_t size);
     // task h
     void set_directional_lights(const std::vector<DirectionalLight>& directional_lights);
+    /// Switch between reading point lights from the clusters bound by ClusteredLights::bind, and the nearest point lights given to set_point_lights.
+    /// Like set_point_lights, this can switch variant so must be called before setting any per instance data.
+    void set_clustered_lighting(bool clustered);
 protected:
     void get_uniforms_set_bindings() override;
 };
@@ -0,0 +1,82 @@
+#include "ComputeShader.h"
+
+#include <iostream>
+
+#include "ShaderInterface.h"
+
+ComputeShader::ComputeShader(std::string name, const std::string& compute_path, std::unordered_map<std::string, std::string> defines)
+    : shader_name(std::move(name)), compute_path(compute_path), defines(std::move(defines)) {
+
+    compute_code = ShaderInterface::load_shader_file(SHADER_DIR + "/" + compute_path).value(); // Will throw exception on failure
+    program_id = compile().value(); // Will throw exception on failure
+}
+
+uint ComputeShader::id() const {
+    return program_id;
+}
+
+void ComputeShader::use() const {
+    glUseProgram(program_id);
+}
+
+bool ComputeShader::reload_files() {
+    auto new_code = ShaderInterface::load_shader_file(SHADER_DIR + "/" + compute_path);
+    if (!new_code.has_value()) return false;
+
+    auto old_code = std::move(compute_code);
+    compute_code = std::move(new_code.value());
+
+    auto new_program = compile();
+    if (!new_program.has_value()) {
+        compute_code = std::move(old_code);
+        return false;
+    }
+
+    glDeleteProgram(program_id);
+    program_id = new_program.value();
+    uniform_locations.clear();
+    std::cout << "Successfully reloaded shader files for: [" << shader_name << "]" << std::endl;
+    return true;
+}
+
+void ComputeShader::dispatch(uint groups_x, uint groups_y, uint groups_z) const {
+    glDispatchCompute(groups_x, groups_y, groups_z);
+}
+
+std::optional<uint> ComputeShader::compile() const {
+    auto realised_code = ShaderInterface::apply_defines_and_includes(compute_code, SHADER_DIR + "/" + compute_path, defines);
+    if (!realised_code.has_value()) return {};
+
+    const char* code_c_str = realised_code->c_str();
+    uint shader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(shader, 1, &code_c_str, nullptr);
+    glCompileShader(shader);
+
+    bool success = ShaderInterface::check_compile_status(shader, realised_code.value(), GL_COMPUTE_SHADER, shader_name);
+    uint program = glCreateProgram();
+    if (success) {
+        glAttachShader(program, shader);
+        glLinkProgram(program);
+        success = ShaderInterface::check_link_status(program, shader_name);
+    }
+    glDeleteShader(shader);
+
+    if (!success) {
+        glDeleteProgram(program);
+        return {};
+    }
+    return program;
+}
+
+int ComputeShader::get_uniform_location(const std::string& name) {
+    auto search = uniform_locations.find(name);
+    if (search != uniform_locations.end()) return search->second;
+
+    int location = glGetUniformLocation(program_id, name.c_str());
+    uniform_locations.insert({name, location});
+    return location;
+}
+
+ComputeShader::~ComputeShader() {
+    glDeleteProgram(program_id);
+}
@@ -0,0 +1,48 @@
+#ifndef COMPUTE_SHADER_H
+#define COMPUTE_SHADER_H
+
+#include <string>
+#include <optional>
+#include <unordered_map>
+
+#include "glad/gl.h"
+
+#include "utility/HelperTypes.h"
+
+/// A GLSL compute shader, loaded the same way as ShaderInterface loads its shaders (with defines, includes and hot reloading).
+/// Needs GL 4.3, so check before constructing one.
+class ComputeShader : NonCopyable {
+    const std::string SHADER_DIR = "res/shaders";
+
+    uint program_id = GL_INVALID_INDEX;
+
+    std::string shader_name;
+    std::string compute_path;
+    std::string compute_code;
+    std::unordered_map<std::string, std::string> defines;
+
+    std::unordered_map<std::string, int> uniform_locations{};
+public:
+    /// Construct the shader, proving the name of shader (used for error formatting), the path to the compute shader, and some #define K V to apply to it
+    ComputeShader(std::string name, const std::string& compute_path, std::unordered_map<std::string, std::string> defines = {});
+
+    [[nodiscard]] uint id() const;
+
+    void use() const;
+
+    /// Fetch the newest version of the shader from disk and try to compile it, prints errors but keeps working if
+    /// there is an issue with the new shader.
+    bool reload_files();
+
+    /// Run the shader over the given number of work groups, the program must be in use
+    void dispatch(uint groups_x, uint groups_y = 1, uint groups_z = 1) const;
+
+    virtual ~ComputeShader();
+private:
+    /// Compile and link the current code, returns nothing on failure
+    [[nodiscard]] std::optional<uint> compile() const;
+protected:
+    [[nodiscard]] int get_uniform_location(const std::string& name);
+};
+
+#endif //COMPUTE_SHADER_H
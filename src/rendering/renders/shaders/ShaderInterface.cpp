@@ -1,25 +1,33 @@
 #include "ShaderInterface.h"
 
+/// Let the driver compile and link shaders on its own threads where supported, so that prepare_variant doesn't block.
+static void enable_parallel_shader_compile() {
+    static bool enabled = false;
+    if (enabled) return;
+    enabled = true;
+
+    // 0xFFFFFFFF lets the implementation pick how many threads to use
+    if (GLAD_GL_KHR_parallel_shader_compile) {
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+    } else if (GLAD_GL_ARB_parallel_shader_compile) {
+        glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+    }
+}
+
 ShaderInterface::ShaderInterface(std::string name, const std::string& vertex_path,
                                  const std::string& fragment_path,
                                  std::function<void()> setup,
                                  std::unordered_map<std::string, std::string> vert_defines,
                                  std::unordered_map<std::string, std::string> frag_defines)
-    : uniform_locations(), uniform_block_indices(), shader_name(std::move(name)), vertex_path(vertex_path), fragment_path(fragment_path), setup(std::move(setup)), vert_defines(std::move(vert_defines)), frag_defines(std::move(frag_defines)) {
+    : variants(), shader_name(std::move(name)), vertex_path(vertex_path), fragment_path(fragment_path), setup(std::move(setup)), vert_defines(std::move(vert_defines)), frag_defines(std::move(frag_defines)) {
+
+    enable_parallel_shader_compile();
 
     vertex_code = load_shader_file(SHADER_DIR + "/" + vertex_path).value(); // Will throw exception on failure
     fragment_code = load_shader_file(SHADER_DIR + "/" + fragment_path).value(); // Will throw exception on failure
 
-    std::string realisedVertexCode = apply_defines_and_includes(vertex_code, SHADER_DIR + "/" + vertex_path, this->vert_defines).value(); // Will throw exception on failure
-    std::string realisedFragmentCode = apply_defines_and_includes(fragment_code, SHADER_DIR + "/" + fragment_path, this->frag_defines).value(); // Will throw exception on failure
-
-    auto vertexShader = compile_shader_code(realisedVertexCode, GL_VERTEX_SHADER, shader_name).value(); // Will throw exception on failure
-    auto fragmentShader = compile_shader_code(realisedFragmentCode, GL_FRAGMENT_SHADER, shader_name).value(); // Will throw exception on failure
-
-    program_id = link_program(vertexShader, fragmentShader, shader_name).value(); // Will throw exception on failure
-
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+    current_variant = get_variant(this->vert_defines, this->frag_defines).value(); // Will throw exception on failure
+    program_id = current_variant->program_id;
 }
 
 uint ShaderInterface::id() const {
@@ -34,16 +42,26 @@ bool ShaderInterface::reload_files() {
     auto old_vertex_code = vertex_code;
     auto old_fragment_code = fragment_code;
 
+    // Every cached variant was built from the old code, so start over, but hold onto them in case the new code doesn't compile
+    auto old_variants = std::move(variants);
+    variants.clear();
+    auto old_variant = current_variant;
+
     try {
         vertex_code = load_shader_file(SHADER_DIR + "/" + vertex_path).value(); // Will throw exception on failure
         fragment_code = load_shader_file(SHADER_DIR + "/" + fragment_path).value(); // Will throw exception on failure
 
-        recompile(std::move(vert_defines), std::move(frag_defines));
+        recompile(vert_defines, frag_defines);
+        delete_variants(old_variants);
         std::cout << "Successfully reloaded shader files for: [" << shader_name << "]" << std::endl;
         return true;
     } catch (const std::bad_optional_access&) {
         vertex_code = std::move(old_vertex_code);
         fragment_code = std::move(old_fragment_code);
+        delete_variants(variants);
+        variants = std::move(old_variants);
+        current_variant = old_variant;
+        program_id = current_variant->program_id;
         std::cerr << "Failed to reload shader files for: [" << shader_name << "]" << std::endl;
         return false;
     }
@@ -53,25 +71,15 @@ void ShaderInterface::recompile(
     std::unordered_map<std::string, std::string> new_vert_defines,
     std::unordered_map<std::string, std::string> new_frag_defines) {
 
+    auto variant = get_variant(new_vert_defines, new_frag_defines).value(); // Will throw exception on failure
+
     vert_defines = std::move(new_vert_defines);
     frag_defines = std::move(new_frag_defines);
 
-    std::string realised_vertex_code = apply_defines_and_includes(vertex_code, SHADER_DIR + "/" + vertex_path, vert_defines).value(); // Will throw exception on failure;
-    std::string realised_fragment_code = apply_defines_and_includes(fragment_code, SHADER_DIR + "/" + fragment_path, frag_defines).value(); // Will throw exception on failure;
-
-    uint vertex_shader = compile_shader_code(realised_vertex_code, GL_VERTEX_SHADER, shader_name).value(); // Will throw exception on failure
-    uint fragment_shader = compile_shader_code(realised_fragment_code, GL_FRAGMENT_SHADER, shader_name).value(); // Will throw exception on failure
-
-    auto old_program = program_id;
-    program_id = link_program(vertex_shader, fragment_shader, shader_name).value(); // Will throw exception on failure
-
-    glDeleteProgram(old_program);
-    glDeleteShader(vertex_shader);
-    glDeleteShader(fragment_shader);
-
-    uniform_locations.clear();
-    uniform_block_indices.clear();
+    current_variant = variant;
+    program_id = variant->program_id;
 
+    // Uniform locations are looked up from the variant's own table, so this only queries GL the first time a variant is used
     this->setup();
     this->use();
 }
@@ -96,6 +104,123 @@ void ShaderInterface::set_frag_define(std::string key, std::string value, bool d
     }
 }
 
+void ShaderInterface::prepare_variant(const std::unordered_map<std::string, std::string>& variant_vert_defines,
+                                      const std::unordered_map<std::string, std::string>& variant_frag_defines) {
+    auto key = variant_key(variant_vert_defines, variant_frag_defines);
+    if (variants.find(key) != variants.end()) return; // Already compiled or compiling
+
+    // Any errors will be reported if the variant is ever actually used
+    start_variant(key, variant_vert_defines, variant_frag_defines);
+}
+
+void ShaderInterface::prepare_frag_define(const std::string& key, std::string value) {
+    auto variant_frag_defines = frag_defines;
+    variant_frag_defines[key] = std::move(value);
+    prepare_variant(vert_defines, variant_frag_defines);
+}
+
+std::string ShaderInterface::variant_key(const std::unordered_map<std::string, std::string>& variant_vert_defines,
+                                         const std::unordered_map<std::string, std::string>& variant_frag_defines) {
+    // The iteration order of an unordered_map isn't defined, so sort the defines to get the same key for the same set
+    std::map<std::string, std::string> sorted_vert_defines(variant_vert_defines.begin(), variant_vert_defines.end());
+    std::map<std::string, std::string> sorted_frag_defines(variant_frag_defines.begin(), variant_frag_defines.end());
+
+    std::stringstream key;
+    for (const auto& def: sorted_vert_defines) {
+        key << def.first << '=' << def.second << ';';
+    }
+    key << '|';
+    for (const auto& def: sorted_frag_defines) {
+        key << def.first << '=' << def.second << ';';
+    }
+    return key.str();
+}
+
+std::optional<ShaderInterface::Variant*> ShaderInterface::get_variant(const std::unordered_map<std::string, std::string>& variant_vert_defines,
+                                                                      const std::unordered_map<std::string, std::string>& variant_frag_defines) {
+    auto key = variant_key(variant_vert_defines, variant_frag_defines);
+
+    auto search = variants.find(key);
+    if (search == variants.end()) {
+        if (!start_variant(key, variant_vert_defines, variant_frag_defines)) return {};
+        search = variants.find(key);
+    }
+
+    Variant& variant = search->second;
+    if (!variant.ready && !finish_variant(variant)) {
+        variants.erase(search);
+        return {};
+    }
+
+    return &variant;
+}
+
+bool ShaderInterface::start_variant(const std::string& key,
+                                    const std::unordered_map<std::string, std::string>& variant_vert_defines,
+                                    const std::unordered_map<std::string, std::string>& variant_frag_defines) {
+    auto realised_vertex_code = apply_defines_and_includes(vertex_code, SHADER_DIR + "/" + vertex_path, variant_vert_defines);
+    auto realised_fragment_code = apply_defines_and_includes(fragment_code, SHADER_DIR + "/" + fragment_path, variant_frag_defines);
+    if (!realised_vertex_code.has_value() || !realised_fragment_code.has_value()) return false;
+
+    Variant variant{};
+    variant.realised_vertex_code = std::move(realised_vertex_code.value());
+    variant.realised_fragment_code = std::move(realised_fragment_code.value());
+
+    const char* vertex_c_str = variant.realised_vertex_code.c_str();
+    variant.vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(variant.vertex_shader, 1, &vertex_c_str, nullptr);
+    glCompileShader(variant.vertex_shader);
+
+    const char* fragment_c_str = variant.realised_fragment_code.c_str();
+    variant.fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(variant.fragment_shader, 1, &fragment_c_str, nullptr);
+    glCompileShader(variant.fragment_shader);
+
+    // Linking straight away without checking the compile status means the driver doesn't need to finish compiling before returning
+    variant.program_id = glCreateProgram();
+    glAttachShader(variant.program_id, variant.vertex_shader);
+    glAttachShader(variant.program_id, variant.fragment_shader);
+    glLinkProgram(variant.program_id);
+
+    variants.insert({key, std::move(variant)});
+    return true;
+}
+
+bool ShaderInterface::finish_variant(Variant& variant) const {
+    bool vertex_success = check_compile_status(variant.vertex_shader, variant.realised_vertex_code, GL_VERTEX_SHADER, shader_name);
+    bool fragment_success = check_compile_status(variant.fragment_shader, variant.realised_fragment_code, GL_FRAGMENT_SHADER, shader_name);
+    bool success = vertex_success && fragment_success && check_link_status(variant.program_id, shader_name);
+
+    glDeleteShader(variant.vertex_shader);
+    glDeleteShader(variant.fragment_shader);
+    variant.vertex_shader = 0;
+    variant.fragment_shader = 0;
+    variant.realised_vertex_code.clear();
+    variant.realised_fragment_code.clear();
+
+    if (!success) {
+        glDeleteProgram(variant.program_id);
+        variant.program_id = GL_INVALID_INDEX;
+        return false;
+    }
+
+    variant.ready = true;
+    return true;
+}
+
+void ShaderInterface::delete_variants(std::unordered_map<std::string, Variant>& variants_to_delete) {
+    for (auto& [key, variant]: variants_to_delete) {
+        if (!variant.ready) {
+            glDeleteShader(variant.vertex_shader);
+            glDeleteShader(variant.fragment_shader);
+        }
+        if (variant.program_id != GL_INVALID_INDEX) {
+            glDeleteProgram(variant.program_id);
+        }
+    }
+    variants_to_delete.clear();
+}
+
 std::optional<std::string> ShaderInterface::load_shader_file(const std::string& shader_path) {
     std::string shader_code;
     std::ifstream shader_file;
@@ -211,15 +336,7 @@ static inline std::string format_info_log(const std::string& shader_code, const
     return formatted_info_log.str();
 }
 
-std::optional<uint>
-ShaderInterface::compile_shader_code(const std::string& shader_code,
-                                     uint shader_type, const std::string& shader_name) {
-    uint shader = glCreateShader(shader_type);
-
-    const char* source_c_str = shader_code.c_str();
-    glShaderSource(shader, 1, &source_c_str, nullptr);
-    glCompileShader(shader);
-
+bool ShaderInterface::check_compile_status(uint shader, const std::string& shader_code, uint shader_type, const std::string& shader_name) {
     int success;
     glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
     if (!success) {
@@ -229,21 +346,15 @@ ShaderInterface::compile_shader_code(const std::string& shader_code,
         info_log.resize(msg_len - 1);
 
         glGetShaderInfoLog(shader, msg_len, nullptr, info_log.data());
-        std::cerr << "Failed to compile '" << shader_name << "' " << (shader_type == GL_VERTEX_SHADER ? "Vertex" : "Fragment") << " shader\n"
+        std::cerr << "Failed to compile '" << shader_name << "' " << (shader_type == GL_VERTEX_SHADER ? "Vertex" : shader_type == GL_COMPUTE_SHADER ? "Compute" : "Fragment") << " shader\n"
                   << format_info_log(shader_code, info_log) << std::endl;
-        return {};
+        return false;
     }
 
-    return shader;
+    return true;
 }
 
-std::optional<uint> ShaderInterface::link_program(uint vertex_shader, uint fragment_shader, const std::string& shader_name) {
-    uint program = glCreateProgram();
-
-    glAttachShader(program, vertex_shader);
-    glAttachShader(program, fragment_shader);
-    glLinkProgram(program);
-
+bool ShaderInterface::check_link_status(uint program, const std::string& shader_name) {
     // print linking errors if any
     int success;
     glGetProgramiv(program, GL_LINK_STATUS, &success);
@@ -257,13 +368,14 @@ std::optional<uint> ShaderInterface::link_program(uint vertex_shader, uint fragm
         glGetProgramInfoLog(program, msg_len, nullptr, info_log.data());
         // TODO: To improved error logging: Need to try figure out if the info_log is referencing vertex or fragment shader (or both) and use corresponding shader_code(s)
         std::cerr << "Failed to link shader program '" << shader_name << "'" << "\n" << format_info_log("", info_log) << std::endl;
-        return {};
+        return false;
     }
 
-    return program;
+    return true;
 }
 
 int ShaderInterface::get_uniform_location(const std::string& name) {
+    auto& uniform_locations = current_variant->uniform_locations;
     auto search = uniform_locations.find(name);
 
     if (search != uniform_locations.end()) {
@@ -278,6 +390,7 @@ int ShaderInterface::get_uniform_location(const std::string& name) {
 }
 
 uint ShaderInterface::get_uniform_block_index(const std::string& name) {
+    auto& uniform_block_indices = current_variant->uniform_block_indices;
     auto search = uniform_block_indices.find(name);
 
     if (search != uniform_block_indices.end()) {
@@ -303,10 +416,9 @@ void ShaderInterface::set_block_binding(const std::string& block_name, uint bind
 }
 
 void ShaderInterface::cleanup() {
-    if (program_id != GL_INVALID_INDEX) {
-        glDeleteProgram(program_id);
-        program_id = GL_INVALID_INDEX;
-    }
+    delete_variants(variants);
+    current_variant = nullptr;
+    program_id = GL_INVALID_INDEX;
 }
 
 ShaderInterface::~ShaderInterface() {
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include <map>
 #include <optional>
 #include <filesystem>
 #include <unordered_map>
@@ -17,13 +18,34 @@
 #include "utility/HelperTypes.h"
 
 /// An interface for GLSL shaders with a bunch of helpers and things to make your life easier.
+/// Every distinct set of defines is compiled into its own program (a variant) which is kept around,
+/// so changing a define back to a value that has been seen before is just a switch of program rather than a recompile.
 class ShaderInterface {
-    const std::string SHADER_DIR = "res/shaders";
+    // Shares the file loading and error reporting
+    friend class ComputeShader;
 
-    uint program_id;
+    const std::string SHADER_DIR = "res/shaders";
 
-    std::unordered_map<std::string, int> uniform_locations;
-    std::unordered_map<std::string, int> uniform_block_indices;
+    /// A program compiled for one specific set of defines, along with its own uniform lookup tables.
+    struct Variant {
+        uint program_id = GL_INVALID_INDEX;
+        // Compilation is only checked on first use, so that variants started by prepare_variant can be compiled
+        // in the background by drivers that support it. Until then, the shaders and their code (for error formatting) are held onto.
+        bool ready = false;
+        uint vertex_shader = 0;
+        uint fragment_shader = 0;
+        std::string realised_vertex_code;
+        std::string realised_fragment_code;
+
+        std::unordered_map<std::string, int> uniform_locations;
+        std::unordered_map<std::string, int> uniform_block_indices;
+    };
+
+    // Keyed by variant_key of the vert and frag defines
+    std::unordered_map<std::string, Variant> variants;
+    // Pointers to the elements of an unordered_map stay valid until they are erased
+    Variant* current_variant = nullptr;
+    uint program_id = GL_INVALID_INDEX;
 
     std::string shader_name;
     std::string vertex_code;
@@ -37,7 +59,7 @@ class ShaderInterface {
     std::unordered_map<std::string, std::string> frag_defines;
 public:
     /// Construct the interface, proving the name of shaders (used for error formatting), the paths to the vertex
-    /// and fragment shaders, also a setup function which is called initially and when the shader is reloaded from disk (hot loaded).
+    /// and fragment shaders, also a setup function which is called whenever the active variant changes, including when the shader is reloaded from disk (hot loaded).
     /// Also can specify some #define K V, that will be applied to the shaders
     ShaderInterface(std::string name, const std::string& vertex_path, const std::string& fragment_path,
                     std::function<void()> setup,
@@ -52,15 +74,22 @@ public:
     /// the is an issue with the new shaders.
     bool reload_files();
 
-    /// Recompile the shaders using the stored shader code, but with new defines.
+    /// Switch to the variant with the new defines, compiling it from the stored shader code if it hasn't been used before.
     void recompile(std::unordered_map<std::string, std::string> new_vert_defines = {},
                    std::unordered_map<std::string, std::string> new_frag_defines = {});
 
-    /// Set an individual vert define, and by default recompile.
+    /// Set an individual vert define, and by default recompile (or switch to the cached variant).
     void set_vert_define(std::string key, std::string value, bool defer_recompile = false);
-    /// Set an individual frag define, and by default recompile.
+    /// Set an individual frag define, and by default recompile (or switch to the cached variant).
     void set_frag_define(std::string key, std::string value, bool defer_recompile = false);
 
+    /// Start compiling the variant for the given defines if it doesn't already exist, without waiting for the result.
+    /// Where the driver supports parallel shader compilation, this happens in the background.
+    void prepare_variant(const std::unordered_map<std::string, std::string>& variant_vert_defines,
+                         const std::unordered_map<std::string, std::string>& variant_frag_defines);
+    /// Start compiling the variant that would result from setting the given frag define, see prepare_variant.
+    void prepare_frag_define(const std::string& key, std::string value);
+
     /// Free up resources.
     void cleanup();
 
@@ -71,9 +100,23 @@ private:
     static std::optional<std::string> apply_defines_and_includes(const std::string& code, const std::string& shader_path, const std::unordered_map<std::string, std::string>& defines);
     static std::optional<std::string> apply_includes(const std::string& code, const std::string& shader_path);
 
-    static std::optional<uint> compile_shader_code(const std::string& shader_code, uint shader_type, const std::string& shader_name);
+    static std::string variant_key(const std::unordered_map<std::string, std::string>& variant_vert_defines,
+                                   const std::unordered_map<std::string, std::string>& variant_frag_defines);
+
+    /// Get the variant for the given defines, compiling it if needed, and waiting for it to be ready. Returns nothing if it fails to compile.
+    std::optional<Variant*> get_variant(const std::unordered_map<std::string, std::string>& variant_vert_defines,
+                                        const std::unordered_map<std::string, std::string>& variant_frag_defines);
+    /// Issue the compile and link for a new variant, without checking the results.
+    bool start_variant(const std::string& key,
+                       const std::unordered_map<std::string, std::string>& variant_vert_defines,
+                       const std::unordered_map<std::string, std::string>& variant_frag_defines);
+    /// Check the results of the compile and link of a variant, printing any errors, and release the intermediate shaders.
+    bool finish_variant(Variant& variant) const;
+    static void delete_variants(std::unordered_map<std::string, Variant>& variants_to_delete);
+
+    static bool check_compile_status(uint shader, const std::string& shader_code, uint shader_type, const std::string& shader_name);
 
-    static std::optional<uint> link_program(uint vertex_shader, uint fragment_shader, const std::string& shader_name);
+    static bool check_link_status(uint program, const std::string& shader_name);
 
 protected:
     [[nodiscard]] int get_uniform_location(const std::string& name);
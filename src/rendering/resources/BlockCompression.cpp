@@ -0,0 +1,154 @@
+#include "BlockCompression.h"
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+static uint16_t to_565(const float colour[3]) {
+    auto r = (uint16_t) std::lround(std::clamp(colour[0], 0.0f, 255.0f) * 31.0f / 255.0f);
+    auto g = (uint16_t) std::lround(std::clamp(colour[1], 0.0f, 255.0f) * 63.0f / 255.0f);
+    auto b = (uint16_t) std::lround(std::clamp(colour[2], 0.0f, 255.0f) * 31.0f / 255.0f);
+    return (uint16_t) ((r << 11) | (g << 5) | b);
+}
+
+static void from_565(uint16_t packed, float colour[3]) {
+    uint r = (packed >> 11) & 0x1F;
+    uint g = (packed >> 5) & 0x3F;
+    uint b = packed & 0x1F;
+    // Expanded the way decoders do, by repeating the top bits
+    colour[0] = (float) ((r << 3) | (r >> 2));
+    colour[1] = (float) ((g << 2) | (g >> 4));
+    colour[2] = (float) ((b << 3) | (b >> 2));
+}
+
+/// Encode a block of 16 RGB pixels into 8 bytes
+static void encode_block(const float block[16][3], unsigned char* output) {
+    float mean[3] = {0.0f, 0.0f, 0.0f};
+    for (int i = 0; i < 16; ++i) {
+        for (int c = 0; c < 3; ++c) mean[c] += block[i][c] / 16.0f;
+    }
+
+    // Covariance of the colours, whose largest eigenvector is the axis they spread along
+    float covariance[3][3] = {};
+    for (int i = 0; i < 16; ++i) {
+        float d[3] = {block[i][0] - mean[0], block[i][1] - mean[1], block[i][2] - mean[2]};
+        for (int row = 0; row < 3; ++row) {
+            for (int column = 0; column < 3; ++column) covariance[row][column] += d[row] * d[column];
+        }
+    }
+
+    // A few steps of power iteration find it well enough. Seeded from the column of the channel that varies the most,
+    // since a fixed seed such as (1, 1, 1) can be orthogonal to the axis (red against green), leaving nothing to iterate on.
+    int widest = 0;
+    for (int c = 1; c < 3; ++c) {
+        if (covariance[c][c] > covariance[widest][widest]) widest = c;
+    }
+    float axis[3] = {covariance[0][widest], covariance[1][widest], covariance[2][widest]};
+    bool degenerate = covariance[widest][widest] < 1e-6f;
+    for (int iteration = 0; iteration < 8 && !degenerate; ++iteration) {
+        float next[3];
+        for (int row = 0; row < 3; ++row) {
+            next[row] = covariance[row][0] * axis[0] + covariance[row][1] * axis[1] + covariance[row][2] * axis[2];
+        }
+        float length = std::max({std::abs(next[0]), std::abs(next[1]), std::abs(next[2])});
+        degenerate = length < 1e-6f;
+        if (!degenerate) {
+            for (int c = 0; c < 3; ++c) axis[c] = next[c] / length;
+        }
+    }
+    if (degenerate) {
+        // Then fall back to the axis between the pixels with the least and most of that channel
+        int min_pixel = 0;
+        int max_pixel = 0;
+        for (int i = 1; i < 16; ++i) {
+            if (block[i][widest] < block[min_pixel][widest]) min_pixel = i;
+            if (block[i][widest] > block[max_pixel][widest]) max_pixel = i;
+        }
+        for (int c = 0; c < 3; ++c) axis[c] = block[max_pixel][c] - block[min_pixel][c];
+    }
+
+    float min_projection = 0.0f;
+    float max_projection = 0.0f;
+    float axis_length_squared = std::max(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2], 1e-6f);
+    for (int i = 0; i < 16; ++i) {
+        float projection = ((block[i][0] - mean[0]) * axis[0] + (block[i][1] - mean[1]) * axis[1] + (block[i][2] - mean[2]) * axis[2]) / axis_length_squared;
+        min_projection = std::min(min_projection, projection);
+        max_projection = std::max(max_projection, projection);
+    }
+    // Pulled in slightly, since the extremes are usually outliers and the palette covers them well enough from inside
+    float inset = (max_projection - min_projection) / 16.0f;
+    min_projection += inset;
+    max_projection -= inset;
+
+    float end_colours[2][3];
+    for (int c = 0; c < 3; ++c) {
+        end_colours[0][c] = mean[c] + axis[c] * max_projection;
+        end_colours[1][c] = mean[c] + axis[c] * min_projection;
+    }
+
+    uint16_t endpoint_0 = to_565(end_colours[0]);
+    uint16_t endpoint_1 = to_565(end_colours[1]);
+    // The first endpoint being the larger is what selects the four colour mode (rather than three colours and transparent)
+    if (endpoint_0 < endpoint_1) std::swap(endpoint_0, endpoint_1);
+
+    uint32_t indices = 0;
+    if (endpoint_0 != endpoint_1) {
+        float palette[4][3];
+        from_565(endpoint_0, palette[0]);
+        from_565(endpoint_1, palette[1]);
+        for (int c = 0; c < 3; ++c) {
+            palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+            palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+        }
+
+        for (int i = 0; i < 16; ++i) {
+            uint32_t best_index = 0;
+            float best_distance = INFINITY;
+            for (uint32_t index = 0; index < 4; ++index) {
+                float dr = block[i][0] - palette[index][0];
+                float dg = block[i][1] - palette[index][1];
+                float db = block[i][2] - palette[index][2];
+                float distance = dr * dr + dg * dg + db * db;
+                if (distance < best_distance) {
+                    best_distance = distance;
+                    best_index = index;
+                }
+            }
+            indices |= best_index << (i * 2);
+        }
+    }
+    // Otherwise the block is a single colour, and every index can stay 0
+
+    output[0] = (unsigned char) (endpoint_0 & 0xFF);
+    output[1] = (unsigned char) (endpoint_0 >> 8);
+    output[2] = (unsigned char) (endpoint_1 & 0xFF);
+    output[3] = (unsigned char) (endpoint_1 >> 8);
+    for (int i = 0; i < 4; ++i) {
+        output[4 + i] = (unsigned char) ((indices >> (i * 8)) & 0xFF);
+    }
+}
+
+size_t BlockCompression::bc1_size(uint width, uint height) {
+    return (size_t) ((width + 3) / 4) * ((height + 3) / 4) * BC1_BLOCK_SIZE;
+}
+
+std::vector<unsigned char> BlockCompression::encode_bc1(const unsigned char* pixels, uint width, uint height) {
+    uint blocks_wide = (width + 3) / 4;
+    uint blocks_high = (height + 3) / 4;
+    std::vector<unsigned char> blocks(bc1_size(width, height));
+
+    float block[16][3];
+    for (uint block_y = 0; block_y < blocks_high; ++block_y) {
+        for (uint block_x = 0; block_x < blocks_wide; ++block_x) {
+            for (uint i = 0; i < 16; ++i) {
+                // Blocks hanging over the edge repeat the last row or column, which the decoder never shows
+                uint x = std::min(block_x * 4 + i % 4, width - 1);
+                uint y = std::min(block_y * 4 + i / 4, height - 1);
+                const unsigned char* pixel = &pixels[((size_t) y * width + x) * 3];
+                for (int c = 0; c < 3; ++c) block[i][c] = pixel[c];
+            }
+            encode_block(block, &blocks[((size_t) block_y * blocks_wide + block_x) * BC1_BLOCK_SIZE]);
+        }
+    }
+    return blocks;
+}
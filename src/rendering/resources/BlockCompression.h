@@ -0,0 +1,24 @@
+#ifndef BLOCK_COMPRESSION_H
+#define BLOCK_COMPRESSION_H
+
+#include <vector>
+#include <cstddef>
+
+#include "utility/HelperTypes.h"
+
+/// An encoder for BC1 (also known as DXT1), the block compressed format for RGB textures, which stores each 4x4 block of
+/// pixels as two 5:6:5 endpoint colours and a 2 bit index per pixel into the line between them. That is 8 bytes a block, so
+/// half a byte per pixel rather than the 3 of uncompressed RGB (or 4, since drivers often pad RGB out to RGBA).
+namespace BlockCompression {
+    constexpr size_t BC1_BLOCK_SIZE = 8;
+
+    /// Bytes taken by an image of width x height as BC1, where a partial block at the edge still takes a whole one
+    size_t bc1_size(uint width, uint height);
+
+    /// Compress tightly packed RGB pixels to BC1, with the blocks in rows as glCompressedTexImage2D expects.
+    /// Endpoints are fitted along the principal axis of each block's colours, which handles gradients far better than the
+    /// bounding box. Colours are fitted as they are stored, so sRGB textures are compressed in sRGB space like other encoders do.
+    std::vector<unsigned char> encode_bc1(const unsigned char* pixels, uint width, uint height);
+}
+
+#endif //BLOCK_COMPRESSION_H
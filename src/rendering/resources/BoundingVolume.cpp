@@ -0,0 +1,56 @@
+#include "BoundingVolume.h"
+
+#include <cmath>
+#include <algorithm>
+
+/// The largest factor that the upper 3x3 of `transform` scales any length by
+static float max_scale(const glm::mat4& transform) {
+    return std::sqrt(std::max({
+        glm::dot(glm::vec3(transform[0]), glm::vec3(transform[0])),
+        glm::dot(glm::vec3(transform[1]), glm::vec3(transform[1])),
+        glm::dot(glm::vec3(transform[2]), glm::vec3(transform[2]))
+    }));
+}
+
+BoundingVolume BoundingVolume::transformed(const glm::mat4& transform) const {
+    // Arvo's method, each axis of the transform contributes its smallest and largest extent separately
+    BoundingVolume result{};
+    result.min = result.max = glm::vec3(transform[3]);
+    for (int axis = 0; axis < 3; ++axis) {
+        glm::vec3 a = glm::vec3(transform[axis]) * min[axis];
+        glm::vec3 b = glm::vec3(transform[axis]) * max[axis];
+        result.min += glm::min(a, b);
+        result.max += glm::max(a, b);
+    }
+
+    result.centre = transform * glm::vec4(centre, 1.0f);
+    result.radius = radius * max_scale(transform);
+    return result;
+}
+
+void BoundingVolume::merge(const BoundingVolume& other) {
+    if (radius == 0.0f && min == max) {
+        *this = other;
+        return;
+    }
+
+    min = glm::min(min, other.min);
+    max = glm::max(max, other.max);
+
+    // Smallest sphere containing both spheres
+    glm::vec3 offset = other.centre - centre;
+    float distance = std::sqrt(glm::dot(offset, offset));
+    if (distance + other.radius <= radius) return;
+    if (distance + radius <= other.radius) {
+        centre = other.centre;
+        radius = other.radius;
+        return;
+    }
+    float new_radius = (distance + radius + other.radius) * 0.5f;
+    centre += offset * ((new_radius - radius) / distance);
+    radius = new_radius;
+}
+
+glm::vec4 BoundingVolume::world_sphere(const glm::mat4& model_matrix) const {
+    return {glm::vec3(model_matrix * glm::vec4(centre, 1.0f)), radius * max_scale(model_matrix)};
+}
@@ -0,0 +1,50 @@
+#ifndef BOUNDING_VOLUME_H
+#define BOUNDING_VOLUME_H
+
+#include <cmath>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+/// An axis aligned bounding box, along with a bounding sphere around it, in the model space of some geometry.
+struct BoundingVolume {
+    glm::vec3 min{0.0f};
+    glm::vec3 max{0.0f};
+    glm::vec3 centre{0.0f};
+    float radius = 0.0f;
+
+    /// Bound a set of points, a sphere centred on the box is used since it is cheap and never much worse than the optimal sphere
+    template<typename Iterator, typename PositionFn>
+    static BoundingVolume from_points(Iterator begin, Iterator end, PositionFn position);
+
+    /// The bounds of the geometry after applying `transform`, the box stays axis aligned so it may grow.
+    [[nodiscard]] BoundingVolume transformed(const glm::mat4& transform) const;
+    /// Grow the bounds to also contain `other`
+    void merge(const BoundingVolume& other);
+    /// The bounding sphere after applying `model_matrix`, packed as (centre, radius) for use with Frustum::cull_spheres
+    [[nodiscard]] glm::vec4 world_sphere(const glm::mat4& model_matrix) const;
+};
+
+template<typename Iterator, typename PositionFn>
+BoundingVolume BoundingVolume::from_points(Iterator begin, Iterator end, PositionFn position) {
+    if (begin == end) return {};
+
+    BoundingVolume bounds{};
+    bounds.min = bounds.max = position(*begin);
+    for (auto it = begin; it != end; ++it) {
+        bounds.min = glm::min(bounds.min, position(*it));
+        bounds.max = glm::max(bounds.max, position(*it));
+    }
+
+    bounds.centre = (bounds.min + bounds.max) * 0.5f;
+    float radius_squared = 0.0f;
+    for (auto it = begin; it != end; ++it) {
+        glm::vec3 offset = position(*it) - bounds.centre;
+        radius_squared = std::max(radius_squared, glm::dot(offset, offset));
+    }
+    bounds.radius = std::sqrt(radius_squared);
+
+    return bounds;
+}
+
+#endif //BOUNDING_VOLUME_H
@@ -0,0 +1,236 @@
+#include "MeshCache.h"
+
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+
+void BinaryWriter::write_string(const std::string& value) {
+    write_array(value.data(), value.size());
+}
+
+const std::vector<std::byte>& BinaryWriter::get_bytes() const {
+    return bytes;
+}
+
+void BinaryWriter::append(const void* data, size_t size, size_t alignment) {
+    // Offsets within the writer match offsets within the entry, which is aligned to more than any value needs
+    bytes.resize((bytes.size() + alignment - 1) / alignment * alignment);
+    const auto* first = static_cast<const std::byte*>(data);
+    bytes.insert(bytes.end(), first, first + size);
+}
+
+BinaryReader::BinaryReader(const std::byte* data, size_t size) : begin(data), cursor(data), end(data + size) {}
+
+std::string BinaryReader::read_string() {
+    auto characters = read_array<char>();
+    return {characters.begin(), characters.end()};
+}
+
+size_t BinaryReader::remaining() const {
+    return (size_t) (end - cursor);
+}
+
+const std::byte* BinaryReader::take(size_t size, size_t alignment) {
+    auto offset = (size_t) (cursor - begin);
+    offset = (offset + alignment - 1) / alignment * alignment;
+    if (offset > (size_t) (end - begin) || size > (size_t) (end - begin) - offset) {
+        throw std::runtime_error("Cache entry is truncated");
+    }
+    const std::byte* value = begin + offset;
+    cursor = value + size;
+    return value;
+}
+
+MeshCache::MeshCache(std::filesystem::path cache_path) : cache_path(std::move(cache_path)) {}
+
+std::optional<MeshCache::Entry> MeshCache::find(uint64_t key) const {
+    if (cache_path.empty()) return std::nullopt;
+
+    auto path = entry_path(key);
+    std::error_code error{};
+    if (!std::filesystem::exists(path, error)) return std::nullopt;
+
+    auto file = std::make_unique<MappedFile>(path);
+    if (file->size() < ENTRY_ALIGNMENT) return std::nullopt;
+
+    EntryHeader header{};
+    std::memcpy(&header, file->data(), sizeof(EntryHeader));
+    if (std::memcmp(header.magic, "MESH", 4) != 0 || header.format_version != FORMAT_VERSION || header.key != key) {
+        return std::nullopt;
+    }
+
+    BinaryReader reader(file->data() + ENTRY_ALIGNMENT, file->size() - ENTRY_ALIGNMENT);
+    return Entry{std::move(file), reader};
+}
+
+void MeshCache::store(uint64_t key, const BinaryWriter& writer) const {
+    if (cache_path.empty()) return;
+
+    try {
+        std::filesystem::create_directories(cache_path);
+
+        EntryHeader header{{'M', 'E', 'S', 'H'}, FORMAT_VERSION, key};
+        char padded_header[ENTRY_ALIGNMENT]{};
+        std::memcpy(padded_header, &header, sizeof(EntryHeader));
+
+        // Written to the side then moved into place, so that a partly written entry is never found
+        auto path = entry_path(key);
+        auto temporary_path = path;
+        temporary_path += ".tmp";
+        {
+            std::ofstream out(temporary_path, std::ios::binary | std::ios::trunc);
+            out.write(padded_header, ENTRY_ALIGNMENT);
+            const auto& bytes = writer.get_bytes();
+            out.write(reinterpret_cast<const char*>(bytes.data()), (std::streamsize) bytes.size());
+            if (!out) {
+                throw std::runtime_error(Formatter() << "Failed to write " << temporary_path.string());
+            }
+        }
+        std::filesystem::rename(temporary_path, path);
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to store mesh cache entry:" << std::endl;
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+std::filesystem::path MeshCache::entry_path(uint64_t key) const {
+    std::string name = Formatter() << std::hex << std::setw(16) << std::setfill('0') << key << ".mesh";
+    return cache_path / name;
+}
+
+template<typename T>
+static void write_key_track(BinaryWriter& writer, const KeyTrack<T>& track) {
+    writer.write_array(track.times);
+    writer.write_array(track.values);
+}
+
+template<typename T>
+static void read_key_track(BinaryReader& reader, KeyTrack<T>& track) {
+    auto times = reader.read_array<float>();
+    auto values = reader.read_array<T>();
+    if (times.size != values.size) {
+        throw std::runtime_error("Cache entry has a key track with mismatched times and values");
+    }
+    track.times.assign(times.begin(), times.end());
+    track.values.assign(values.begin(), values.end());
+}
+
+static void write_node(BinaryWriter& writer, const MeshHierarchyNode& node) {
+    writer.write(node.transformation);
+    writer.write_array(node.meshes);
+
+    writer.write((uint64_t) node.bones.size());
+    for (const auto& [mesh_id, bone_id, offset_matrix]: node.bones) {
+        writer.write(mesh_id);
+        writer.write(bone_id);
+        writer.write(offset_matrix);
+    }
+
+    writer.write((uint64_t) node.animation_data.size());
+    for (const auto& [animation_id, animation_data]: node.animation_data) {
+        writer.write(animation_id);
+        write_key_track(writer, animation_data.positions);
+        write_key_track(writer, animation_data.rotations);
+        write_key_track(writer, animation_data.scalings);
+    }
+
+    writer.write((uint64_t) node.children.size());
+    for (const auto& child: node.children) {
+        write_node(writer, child);
+    }
+}
+
+static void read_node(BinaryReader& reader, MeshHierarchyNode& node) {
+    node.transformation = reader.read<glm::mat4>();
+    auto meshes = reader.read_array<uint>();
+    node.meshes.assign(meshes.begin(), meshes.end());
+
+    auto bone_count = reader.read<uint64_t>();
+    for (uint64_t i = 0; i < bone_count; ++i) {
+        auto mesh_id = reader.read<uint>();
+        auto bone_id = reader.read<uint>();
+        node.bones.emplace_back(mesh_id, bone_id, reader.read<glm::mat4>());
+    }
+
+    auto animation_count = reader.read<uint64_t>();
+    for (uint64_t i = 0; i < animation_count; ++i) {
+        auto& animation_data = node.animation_data[reader.read<int>()];
+        read_key_track(reader, animation_data.positions);
+        read_key_track(reader, animation_data.rotations);
+        read_key_track(reader, animation_data.scalings);
+    }
+
+    auto child_count = reader.read<uint64_t>();
+    // Every child takes at least a transformation, which stops a corrupt count from allocating wildly
+    if (child_count > reader.remaining() / sizeof(glm::mat4)) {
+        throw std::runtime_error("Cache entry is truncated");
+    }
+    node.children.resize(child_count);
+    for (auto& child: node.children) {
+        read_node(reader, child);
+    }
+}
+
+void write_hierarchy_tree(BinaryWriter& writer, const std::unordered_map<std::string, std::vector<std::tuple<uint, uint, glm::mat4>>>& total_bones,
+                          const std::vector<std::tuple<std::string, double, double>>& animations, const MeshHierarchyNode& root_node) {
+    writer.write((uint64_t) total_bones.size());
+    for (const auto& [bone_name, bones]: total_bones) {
+        writer.write_string(bone_name);
+        writer.write((uint64_t) bones.size());
+        for (const auto& [mesh_id, bone_id, offset_matrix]: bones) {
+            writer.write(mesh_id);
+            writer.write(bone_id);
+            writer.write(offset_matrix);
+        }
+    }
+
+    writer.write((uint64_t) animations.size());
+    for (const auto& [animation_name, ticks_per_second, duration_ticks]: animations) {
+        writer.write_string(animation_name);
+        writer.write(ticks_per_second);
+        writer.write(duration_ticks);
+    }
+
+    write_node(writer, root_node);
+}
+
+void read_hierarchy_tree(BinaryReader& reader, std::unordered_map<std::string, std::vector<std::tuple<uint, uint, glm::mat4>>>& total_bones,
+                         std::vector<std::tuple<std::string, double, double>>& animations, MeshHierarchyNode& root_node) {
+    auto bone_name_count = reader.read<uint64_t>();
+    for (uint64_t i = 0; i < bone_name_count; ++i) {
+        auto& bones = total_bones[reader.read_string()];
+        auto bone_count = reader.read<uint64_t>();
+        for (uint64_t j = 0; j < bone_count; ++j) {
+            auto mesh_id = reader.read<uint>();
+            auto bone_id = reader.read<uint>();
+            bones.emplace_back(mesh_id, bone_id, reader.read<glm::mat4>());
+        }
+    }
+
+    auto animation_count = reader.read<uint64_t>();
+    for (uint64_t i = 0; i < animation_count; ++i) {
+        auto animation_name = reader.read_string();
+        auto ticks_per_second = reader.read<double>();
+        animations.emplace_back(animation_name, ticks_per_second, reader.read<double>());
+    }
+
+    read_node(reader, root_node);
+}
+
+void write_bone_names(BinaryWriter& writer, const std::unordered_map<std::string, uint>& bone_names) {
+    writer.write((uint64_t) bone_names.size());
+    for (const auto& [bone_name, bone_id]: bone_names) {
+        writer.write_string(bone_name);
+        writer.write(bone_id);
+    }
+}
+
+std::unordered_map<std::string, uint> read_bone_names(BinaryReader& reader) {
+    std::unordered_map<std::string, uint> bone_names{};
+    auto count = reader.read<uint64_t>();
+    for (uint64_t i = 0; i < count; ++i) {
+        auto bone_name = reader.read_string();
+        bone_names[bone_name] = reader.read<uint>();
+    }
+    return bone_names;
+}
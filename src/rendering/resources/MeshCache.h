@@ -0,0 +1,169 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <optional>
+#include <typeinfo>
+#include <filesystem>
+#include <type_traits>
+#include <unordered_map>
+
+#include <glm/glm.hpp>
+
+#include "utility/HelperTypes.h"
+#include "utility/MappedFile.h"
+#include "utility/Hash.h"
+#include "MeshHierarchy.h"
+
+/// A read-only view of an array, such as one within a MappedFile
+template<typename T>
+struct ArrayView {
+    const T* data = nullptr;
+    size_t size = 0;
+
+    [[nodiscard]] const T* begin() const { return data; }
+    [[nodiscard]] const T* end() const { return data + size; }
+};
+
+/// Builds up a cache entry, as plain values and arrays back to back.
+/// Arrays are aligned for their type, so that BinaryReader can hand out views straight into the mapped entry.
+class BinaryWriter {
+    std::vector<std::byte> bytes{};
+public:
+    /// Values are written as their bytes, so must be trivially copyable
+    template<typename T>
+    void write(const T& value);
+    /// The count, then the values
+    template<typename T>
+    void write_array(const T* values, size_t count);
+    template<typename T>
+    void write_array(const std::vector<T>& values);
+    void write_string(const std::string& value);
+
+    [[nodiscard]] const std::vector<std::byte>& get_bytes() const;
+private:
+    void append(const void* data, size_t size, size_t alignment);
+};
+
+/// Reads back what a BinaryWriter wrote, in the same order, throwing if it runs off the end of the data
+class BinaryReader {
+    const std::byte* begin;
+    const std::byte* cursor;
+    const std::byte* end;
+public:
+    BinaryReader(const std::byte* data, size_t size);
+
+    template<typename T>
+    T read();
+    /// A view of the array within the data, only valid for as long as the data is
+    template<typename T>
+    ArrayView<T> read_array();
+    std::string read_string();
+    /// How many bytes are left to read
+    [[nodiscard]] size_t remaining() const;
+private:
+    const std::byte* take(size_t size, size_t alignment);
+};
+
+/// An on-disk cache of imported models, so that Assimp only needs to run the first time a file is loaded.
+/// Each entry holds the final vertices and indices, ready to upload straight from the mapped file, along with the bounds and
+/// any hierarchy and animation tracks. Entries are named by a key of the file's contents and everything that decides what
+/// the import produces, so an edited file just gets a new entry.
+class MeshCache {
+    // Where the entries are kept, or empty to not cache at all
+    std::filesystem::path cache_path;
+
+    struct EntryHeader {
+        char magic[4];
+        uint32_t format_version;
+        uint64_t key;
+    };
+    // The header is padded out so that the alignment of arrays within an entry is kept in the file
+    static constexpr size_t ENTRY_ALIGNMENT = 16;
+public:
+    /// Bumped whenever what an entry holds changes, so that older entries are ignored and replaced
+    static constexpr uint32_t FORMAT_VERSION = 1;
+
+    /// A mapped entry, with the reader positioned at the start of what was written to it
+    struct Entry {
+        std::unique_ptr<MappedFile> file;
+        BinaryReader reader;
+    };
+
+    explicit MeshCache(std::filesystem::path cache_path);
+
+    /// The key for the contents of file, imported with post_process_flags as a kind ("model" or "hierarchy") of VertexData entry
+    template<typename VertexData>
+    static uint64_t key(const std::filesystem::path& file, uint post_process_flags, const std::string& kind);
+
+    /// The entry for key, or nothing if there isn't one
+    [[nodiscard]] std::optional<Entry> find(uint64_t key) const;
+    /// Write the entry for key, which any failure only gets reported for, since the cache is just an optimisation
+    void store(uint64_t key, const BinaryWriter& writer) const;
+private:
+    [[nodiscard]] std::filesystem::path entry_path(uint64_t key) const;
+};
+
+/// The parts of a hierarchy that aren't in its meshes: its bones, animations and node tree (as loaded, so before flattening)
+void write_hierarchy_tree(BinaryWriter& writer, const std::unordered_map<std::string, std::vector<std::tuple<uint, uint, glm::mat4>>>& total_bones,
+                          const std::vector<std::tuple<std::string, double, double>>& animations, const MeshHierarchyNode& root_node);
+void read_hierarchy_tree(BinaryReader& reader, std::unordered_map<std::string, std::vector<std::tuple<uint, uint, glm::mat4>>>& total_bones,
+                         std::vector<std::tuple<std::string, double, double>>& animations, MeshHierarchyNode& root_node);
+
+/// A mesh's { bone_name } -> { bone_id }
+void write_bone_names(BinaryWriter& writer, const std::unordered_map<std::string, uint>& bone_names);
+std::unordered_map<std::string, uint> read_bone_names(BinaryReader& reader);
+
+template<typename T>
+void BinaryWriter::write(const T& value) {
+    static_assert(std::is_trivially_copyable_v<T>, "Only plain values can be written directly");
+    append(&value, sizeof(T), alignof(T));
+}
+
+template<typename T>
+void BinaryWriter::write_array(const T* values, size_t count) {
+    static_assert(std::is_trivially_copyable_v<T>, "Only plain values can be written directly");
+    write((uint64_t) count);
+    append(values, count * sizeof(T), alignof(T));
+}
+
+template<typename T>
+void BinaryWriter::write_array(const std::vector<T>& values) {
+    write_array(values.data(), values.size());
+}
+
+template<typename T>
+T BinaryReader::read() {
+    T value;
+    std::memcpy(&value, take(sizeof(T), alignof(T)), sizeof(T));
+    return value;
+}
+
+template<typename T>
+ArrayView<T> BinaryReader::read_array() {
+    auto count = read<uint64_t>();
+    if (count > (uint64_t) (end - cursor) / sizeof(T)) {
+        throw std::runtime_error(Formatter() << "Cache entry is truncated, an array of " << count << " doesn't fit");
+    }
+    const auto* values = take(count * sizeof(T), alignof(T));
+    return ArrayView<T>{reinterpret_cast<const T*>(values), count};
+}
+
+template<typename VertexData>
+uint64_t MeshCache::key(const std::filesystem::path& file, uint post_process_flags, const std::string& kind) {
+    uint64_t hash = Hash::hash_file(file);
+    // The type's name tells apart vertex formats, and the size catches a format that has changed
+    const char* type_name = typeid(VertexData).name();
+    hash = Hash::hash_bytes(type_name, std::strlen(type_name), hash);
+    uint64_t vertex_size = sizeof(VertexData);
+    hash = Hash::hash_bytes(&vertex_size, sizeof(vertex_size), hash);
+    hash = Hash::hash_bytes(&post_process_flags, sizeof(post_process_flags), hash);
+    hash = Hash::hash_bytes(kind.data(), kind.size(), hash);
+    return Hash::hash_bytes(&FORMAT_VERSION, sizeof(FORMAT_VERSION), hash);
+}
+
+#endif //MESH_CACHE_H
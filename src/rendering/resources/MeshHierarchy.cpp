@@ -1,50 +1,213 @@
 #include "MeshHierarchy.h"
 
-glm::mat4 AnimationData::sample(double time) const {
+uint seek_key(const std::vector<float>& times, float time, uint& cursor) {
+    auto count = (uint) times.size();
+    uint key = std::min(cursor, count - 1);
+
+    if (times[key] <= time) {
+        // Playing forwards, so usually still before the next key, or only just past it
+        if (key + 1 < count && times[key + 1] <= time) {
+            ++key;
+            if (key + 1 < count && times[key + 1] <= time) {
+                key = (uint) (std::upper_bound(times.begin() + key + 1, times.end(), time) - times.begin()) - 1;
+            }
+        }
+    } else {
+        auto next = std::upper_bound(times.begin(), times.begin() + key, time);
+        key = next == times.begin() ? 0 : (uint) (next - times.begin()) - 1;
+    }
+
+    cursor = key;
+    return key;
+}
+
+// Every component but the largest of a unit quaternion is within +-1/sqrt(2)
+static constexpr float SMALLEST_THREE_RANGE = 0.70710678f;
+static constexpr uint SMALLEST_THREE_MAX = (1u << 15) - 1;
+static constexpr float VEC3_RANGE_MAX = 65535.0f;
+
+PackedQuat PackedQuat::pack(glm::quat rotation) {
+    rotation = glm::normalize(rotation);
+    float components[4] = {rotation.x, rotation.y, rotation.z, rotation.w};
+    uint largest = 0;
+    for (uint i = 1; i < 4; ++i) {
+        if (std::abs(components[i]) > std::abs(components[largest])) largest = i;
+    }
+    // q and -q are the same rotation, so flip it to make the dropped component positive
+    float sign = components[largest] < 0.0f ? -1.0f : 1.0f;
+
+    uint64_t packed = (uint64_t) largest << 45;
+    int shift = 30;
+    for (uint i = 0; i < 4; ++i) {
+        if (i == largest) continue;
+        float normalised = glm::clamp(components[i] * sign / SMALLEST_THREE_RANGE * 0.5f + 0.5f, 0.0f, 1.0f);
+        packed |= (uint64_t) std::lround(normalised * (float) SMALLEST_THREE_MAX) << shift;
+        shift -= 15;
+    }
+    return PackedQuat{{(uint16_t) (packed >> 32), (uint16_t) (packed >> 16), (uint16_t) packed}};
+}
+
+glm::quat PackedQuat::unpack() const {
+    uint64_t packed = (uint64_t) bits[0] << 32 | (uint64_t) bits[1] << 16 | (uint64_t) bits[2];
+    auto largest = (uint) (packed >> 45) & 3u;
+
+    float components[4];
+    float sum_squares = 0.0f;
+    int shift = 30;
+    for (uint i = 0; i < 4; ++i) {
+        if (i == largest) continue;
+        auto value = (float) ((packed >> shift) & SMALLEST_THREE_MAX);
+        components[i] = (value / (float) SMALLEST_THREE_MAX * 2.0f - 1.0f) * SMALLEST_THREE_RANGE;
+        sum_squares += components[i] * components[i];
+        shift -= 15;
+    }
+    components[largest] = std::sqrt(std::max(1.0f - sum_squares, 0.0f));
+    return glm::quat{components[3], components[0], components[1], components[2]};
+}
+
+Vec3Range Vec3Range::of(const std::vector<glm::vec3>& values) {
+    if (values.empty()) return {};
+
+    glm::vec3 min = values[0];
+    glm::vec3 max = values[0];
+    for (const auto& value: values) {
+        min = glm::min(min, value);
+        max = glm::max(max, value);
+    }
+    return Vec3Range{min, (max - min) / VEC3_RANGE_MAX};
+}
+
+PackedVec3 Vec3Range::pack(glm::vec3 value) const {
+    PackedVec3 packed{};
+    for (int i = 0; i < 3; ++i) {
+        // A component that never changes has no step, and is just min
+        if (step[i] > 0.0f) {
+            packed[i] = (uint16_t) std::lround(glm::clamp((value[i] - min[i]) / step[i], 0.0f, VEC3_RANGE_MAX));
+        }
+    }
+    return packed;
+}
+
+bool vec3_fits(glm::vec3 a, glm::vec3 b, float t, glm::vec3 value, float tolerance) {
+    return glm::distance(glm::mix(a, b, t), value) <= tolerance;
+}
+
+bool quat_fits(glm::quat a, glm::quat b, float t, glm::quat value, float tolerance) {
+    glm::quat expected = glm::normalize(glm::slerp(a, b, t));
+    value = glm::normalize(value);
+    float sign = glm::dot(expected, value) < 0.0f ? -1.0f : 1.0f;
+    // The angle from the chord between them, since acos of their dot product has no precision left for angles this small
+    glm::vec4 chord = glm::vec4(expected.x, expected.y, expected.z, expected.w) - glm::vec4(value.x, value.y, value.z, value.w) * sign;
+    return 4.0f * std::asin(std::min(glm::length(chord) * 0.5f, 1.0f)) <= tolerance;
+}
+
+/// How far key is between first and last, for checking it against interpolating them
+static float key_fraction(const std::vector<float>& times, uint first, uint last, uint key) {
+    return (times[key] - times[first]) / (times[last] - times[first]);
+}
+
+static void pack_vec3s(const KeyTrack<glm::vec3>& track, KeyTrack<PackedVec3>& out_track, Vec3Range& out_range) {
+    out_range = Vec3Range::of(track.values);
+    out_track.times = track.times;
+    out_track.values.reserve(track.values.size());
+    for (const auto& value: track.values) {
+        out_track.values.push_back(out_range.pack(value));
+    }
+}
+
+PackedAnimationData PackedAnimationData::pack(const AnimationData& animation_data, const KeyTolerances& tolerances) {
+    const auto& positions = animation_data.positions;
+    const auto& rotations = animation_data.rotations;
+    const auto& scalings = animation_data.scalings;
+
+    auto position_keys = reduce_keys(positions.times.size(), [&](uint first, uint last, uint key) {
+        float t = key_fraction(positions.times, first, last, key);
+        return vec3_fits(positions.values[first], positions.values[last], t, positions.values[key], tolerances.position);
+    });
+    auto rotation_keys = reduce_keys(rotations.times.size(), [&](uint first, uint last, uint key) {
+        float t = key_fraction(rotations.times, first, last, key);
+        return quat_fits(rotations.values[first], rotations.values[last], t, rotations.values[key], tolerances.rotation);
+    });
+    auto scaling_keys = reduce_keys(scalings.times.size(), [&](uint first, uint last, uint key) {
+        float t = key_fraction(scalings.times, first, last, key);
+        return vec3_fits(scalings.values[first], scalings.values[last], t, scalings.values[key], tolerances.scaling);
+    });
+
+    PackedAnimationData packed{};
+    pack_vec3s(positions.select(position_keys), packed.positions, packed.position_range);
+    pack_vec3s(scalings.select(scaling_keys), packed.scalings, packed.scaling_range);
+
+    auto kept_rotations = rotations.select(rotation_keys);
+    packed.rotations.times = kept_rotations.times;
+    packed.rotations.values.reserve(kept_rotations.values.size());
+    for (const auto& rotation: kept_rotations.values) {
+        packed.rotations.values.push_back(PackedQuat::pack(rotation));
+    }
+    return packed;
+}
+
+glm::mat4 PackedAnimationData::sample(float time, AnimationData::Cursor& cursor) const {
+    auto mix = [](const glm::vec3& a, const glm::vec3& b, float t) { return glm::mix(a, b, t); };
+
     glm::vec3 position{0.0f};
     if (!positions.empty()) {
-        auto next_key = positions.lower_bound(time);
-        if (next_key == positions.end()) {
-            position = positions.rbegin()->second;
-        } else if (next_key->first == time || next_key == positions.begin()) {
-            position = next_key->second;
-        } else {
-            auto next = *next_key;
-            auto prev = *(--next_key);
-
-            position = glm::mix(prev.second, next.second, (float) ((time - prev.first) / (next.first - prev.first)));
-        }
+        position = positions.sample(time, cursor.position, [this](const PackedVec3& packed) { return position_range.unpack(packed); }, mix);
     }
 
     glm::quat rotation{1.0f, 0.0f, 0.0f, 0.0f};
     if (!rotations.empty()) {
-        auto next_key = rotations.lower_bound(time);
-        if (next_key == rotations.end()) {
-            rotation = rotations.rbegin()->second;
-        } else if (next_key->first == time || next_key == rotations.begin()) {
-            rotation = next_key->second;
-        } else {
-            auto next = *next_key;
-            auto prev = *(--next_key);
-
-            rotation = glm::slerp(prev.second, next.second, (float) ((time - prev.first) / (next.first - prev.first)));
-        }
+        rotation = rotations.sample(time, cursor.rotation, [](const PackedQuat& packed) { return packed.unpack(); },
+                                    [](const glm::quat& a, const glm::quat& b, float t) { return glm::slerp(a, b, t); });
     }
 
     glm::vec3 scaling{1.0f};
     if (!scalings.empty()) {
-        auto next_key = scalings.lower_bound(time);
-        if (next_key == scalings.end()) {
-            scaling = scalings.rbegin()->second;
-        } else if (next_key->first == time || next_key == scalings.begin()) {
-            scaling = next_key->second;
-        } else {
-            auto next = *next_key;
-            auto prev = *(--next_key);
-
-            scaling = glm::mix(prev.second, next.second, (float) ((time - prev.first) / (next.first - prev.first)));
-        }
+        scaling = scalings.sample(time, cursor.scaling, [this](const PackedVec3& packed) { return scaling_range.unpack(packed); }, mix);
     }
 
     return glm::translate(position) * glm::toMat4(rotation) * glm::scale(scaling);
-}
\ No newline at end of file
+}
+
+void KeyGroup::pack(const std::vector<const AnimationData*>& tracks, const KeyTolerances& tolerances) {
+    const auto& loaded_times = tracks[0]->positions.times;
+
+    // Keys are shared by the whole group, so one can only be removed if every channel of every track can do without it
+    auto kept = reduce_keys(loaded_times.size(), [&](uint first, uint last, uint key) {
+        float t = key_fraction(loaded_times, first, last, key);
+        return std::all_of(tracks.begin(), tracks.end(), [&](const AnimationData* track) {
+            const auto& positions = track->positions.values;
+            const auto& rotations = track->rotations.values;
+            const auto& scalings = track->scalings.values;
+            return vec3_fits(positions[first], positions[last], t, positions[key], tolerances.position)
+                && quat_fits(rotations[first], rotations[last], t, rotations[key], tolerances.rotation)
+                && vec3_fits(scalings[first], scalings[last], t, scalings[key], tolerances.scaling);
+        });
+    });
+
+    times.clear();
+    for (uint key: kept) {
+        times.push_back(loaded_times[key]);
+    }
+
+    position_ranges.clear();
+    scaling_ranges.clear();
+    for (const auto* track: tracks) {
+        position_ranges.push_back(Vec3Range::of(track->positions.select(kept).values));
+        scaling_ranges.push_back(Vec3Range::of(track->scalings.select(kept).values));
+    }
+
+    positions.clear();
+    rotations.clear();
+    scalings.clear();
+    for (uint key: kept) {
+        for (size_t i = 0; i < tracks.size(); ++i) {
+            positions.push_back(position_ranges[i].pack(tracks[i]->positions.values[key]));
+            rotations.push_back(PackedQuat::pack(tracks[i]->rotations.values[key]));
+            scalings.push_back(scaling_ranges[i].pack(tracks[i]->scalings.values[key]));
+        }
+    }
+}
+
+bool AnimationData::has_shared_times() const {
+    return !positions.empty() && positions.times == rotations.times && positions.times == scalings.times;
+}
@@ -2,8 +2,14 @@
 #define MESH_HIERARCHY_H
 
 #include <vector>
+#include <array>
 #include <map>
+#include <algorithm>
 #include <memory>
+#include <climits>
+#include <cstdint>
+#include <limits>
+#include <cmath>
 #include <functional>
 #include <unordered_map>
 
@@ -12,17 +18,218 @@
 #include <glm/gtx/quaternion.hpp>
 
 #include "ModelHandle.h"
+#include "rendering/memory/TextureBuffer.h"
 
 #define NONE_ANIMATION UINT_MAX
 
+/// Index of the last of the sorted times at or before time, or 0 if there isn't one.
+/// The search starts from cursor, which is where the previous search for this track ended up, so that playing forwards is
+/// usually just a comparison or two. Anything else (seeking, looping) falls back to a binary search. The cursor is updated.
+uint seek_key(const std::vector<float>& times, float time, uint& cursor);
+
+/// The keys of one channel of an animation, sorted by time, with the times and values in separate arrays
+template<typename T>
+struct KeyTrack {
+    std::vector<float> times{};
+    std::vector<T> values{};
+
+    /// Add a key, replacing any existing key at the same time. Keys added in order are just appended.
+    void insert(float time, const T& value);
+    [[nodiscard]] bool empty() const;
+    /// Sample at time with `interpolate(unpack(a), unpack(b), t)` between the surrounding keys, clamping to the first and last keys
+    template<typename Unpack, typename Interpolate>
+    [[nodiscard]] auto sample(float time, uint& cursor, Unpack unpack, Interpolate interpolate) const;
+    /// A track of only the keys at the given indices
+    [[nodiscard]] KeyTrack<T> select(const std::vector<uint>& keys) const;
+};
+
+/// How far a key removed when compressing may be from what interpolating the keys either side of it gives
+struct KeyTolerances {
+    // Distance, in the units of the model
+    float position = 0.001f;
+    // Angle, in radians
+    float rotation = 0.001f;
+    float scaling = 0.001f;
+};
+
+/// A unit quaternion packed into 48 bits, in smallest three form: the index of the largest component in 2 bits, and the
+/// other three in 15 bits each. The largest is recovered from the quaternion being unit length.
+struct PackedQuat {
+    std::array<uint16_t, 3> bits{};
+
+    static PackedQuat pack(glm::quat rotation);
+    [[nodiscard]] glm::quat unpack() const;
+};
+
+using PackedVec3 = std::array<uint16_t, 3>;
+
+/// The range a track's vec3s are packed across, with 16 bits per component
+struct Vec3Range {
+    glm::vec3 min{0.0f};
+    glm::vec3 step{0.0f};
+
+    static Vec3Range of(const std::vector<glm::vec3>& values);
+    [[nodiscard]] PackedVec3 pack(glm::vec3 value) const;
+    [[nodiscard]] glm::vec3 unpack(const PackedVec3& packed) const {
+        return min + glm::vec3(packed[0], packed[1], packed[2]) * step;
+    }
+};
+
+/// Whether value is within tolerance of mixing a and b by t
+bool vec3_fits(glm::vec3 a, glm::vec3 b, float t, glm::vec3 value, float tolerance);
+/// Whether value is within an angle of tolerance of slerping a and b by t
+bool quat_fits(glm::quat a, glm::quat b, float t, glm::quat value, float tolerance);
+
+/// Keys removed by reduce_keys are never more than this far apart, to bound the time taken for long flat tracks
+constexpr uint MAX_KEY_SPAN = 256;
+
+/// Indices of the keys to keep, out of key_count, so that `fits(first, last, key)` holds for each removed key between the kept keys either side of it.
+/// The first and last keys are always kept.
+template<typename Fits>
+std::vector<uint> reduce_keys(size_t key_count, Fits fits);
+
+/// The keys of a node in one animation, as loaded
 struct AnimationData {
-    std::map<double, glm::vec3> positions{};
-    std::map<double, glm::quat> rotations{};
-    std::map<double, glm::vec3> scalings{};
+    KeyTrack<glm::vec3> positions{};
+    KeyTrack<glm::quat> rotations{};
+    KeyTrack<glm::vec3> scalings{};
+
+    /// Where sampling of each channel was last up to, see seek_key
+    struct Cursor {
+        uint position = 0;
+        uint rotation = 0;
+        uint scaling = 0;
+    };
 
-    [[nodiscard]] glm::mat4 sample(double time) const;
+    /// Whether every channel has a key at each of the same times
+    [[nodiscard]] bool has_shared_times() const;
 };
 
+/// AnimationData after compression by MeshHierarchy::flatten, which is what gets sampled
+struct PackedAnimationData {
+    KeyTrack<PackedVec3> positions{};
+    KeyTrack<PackedQuat> rotations{};
+    KeyTrack<PackedVec3> scalings{};
+    Vec3Range position_range{};
+    Vec3Range scaling_range{};
+
+    /// Remove the keys of each channel that interpolation reproduces within tolerance, and pack the rest
+    static PackedAnimationData pack(const AnimationData& animation_data, const KeyTolerances& tolerances);
+    [[nodiscard]] glm::mat4 sample(float time, AnimationData::Cursor& cursor) const;
+};
+
+/// The tracks of one animation whose channels all share the same key times.
+/// The keys are only searched for once for the whole group, and the values are stored key by key, so that
+/// the positions and scalings of every track at the two surrounding keys unpack into contiguous floats,
+/// which are then interpolated as a single run.
+struct KeyGroup {
+    std::vector<float> times{};
+    // [track] -> node posed by the track
+    std::vector<uint> nodes{};
+    // [track] -> range that the track's positions and scalings are packed across
+    std::vector<Vec3Range> position_ranges{};
+    std::vector<Vec3Range> scaling_ranges{};
+    // [key * nodes.size() + track]
+    std::vector<PackedVec3> positions{};
+    std::vector<PackedQuat> rotations{};
+    std::vector<PackedVec3> scalings{};
+    // Tracks of minor nodes are placed after the rest, so a reduced skeleton only evaluates the first major_count
+    size_t major_count = 0;
+
+    /// Fill the group from the tracks of its nodes, which all have the same key times.
+    /// Only the keys that some track can't do without (see KeyTolerances) are kept, then they are packed.
+    void pack(const std::vector<const AnimationData*>& tracks, const KeyTolerances& tolerances);
+};
+
+/// Where sampling of every track of a hierarchy was last up to, kept per animated instance (see seek_key).
+/// Only a cache, any state is valid, and it is sized by MeshHierarchy::calculate_animation.
+struct AnimationCursor {
+    // [track] -> cursor, for tracks that aren't part of a group
+    std::vector<AnimationData::Cursor> tracks{};
+    // [group] -> cursor
+    std::vector<uint> groups{};
+};
+
+/// Working memory for posing a hierarchy, kept per thread so that many instances can be posed at once
+struct PoseScratch {
+    // [node] -> accumulated transformation
+    std::vector<glm::mat4> pose{};
+    // [node] -> transformation from a key group
+    std::vector<glm::mat4> group_transforms{};
+    // Unpacked values of a key group at the surrounding keys, the first key's for every track then the next key's
+    std::vector<glm::vec3> group_keys{};
+    // Interpolated values of a key group
+    std::vector<glm::vec3> group_positions{};
+    std::vector<glm::vec3> group_scalings{};
+};
+
+template<typename T>
+void KeyTrack<T>::insert(float time, const T& value) {
+    if (times.empty() || time > times.back()) {
+        times.push_back(time);
+        values.push_back(value);
+        return;
+    }
+
+    auto position = std::lower_bound(times.begin(), times.end(), time);
+    auto index = position - times.begin();
+    if (*position == time) {
+        values[index] = value;
+    } else {
+        times.insert(position, time);
+        values.insert(values.begin() + index, value);
+    }
+}
+
+template<typename T>
+bool KeyTrack<T>::empty() const {
+    return times.empty();
+}
+
+template<typename T>
+template<typename Unpack, typename Interpolate>
+auto KeyTrack<T>::sample(float time, uint& cursor, Unpack unpack, Interpolate interpolate) const {
+    uint key = seek_key(times, time, cursor);
+    if (time <= times[key] || key + 1 == times.size()) {
+        return unpack(values[key]);
+    }
+    return interpolate(unpack(values[key]), unpack(values[key + 1]), (time - times[key]) / (times[key + 1] - times[key]));
+}
+
+template<typename T>
+KeyTrack<T> KeyTrack<T>::select(const std::vector<uint>& keys) const {
+    KeyTrack<T> track{};
+    track.times.reserve(keys.size());
+    track.values.reserve(keys.size());
+    for (uint key: keys) {
+        track.times.push_back(times[key]);
+        track.values.push_back(values[key]);
+    }
+    return track;
+}
+
+template<typename Fits>
+std::vector<uint> reduce_keys(size_t key_count, Fits fits) {
+    std::vector<uint> kept{};
+    if (key_count == 0) return kept;
+
+    // Grow the span from the last kept key for as long as every key inside it still fits, then keep the key that ended it
+    kept.push_back(0);
+    uint first = 0;
+    for (uint last = 2; last < key_count; ++last) {
+        bool span_fits = last - first <= MAX_KEY_SPAN;
+        for (uint key = first + 1; key < last && span_fits; ++key) {
+            span_fits = fits(first, last, key);
+        }
+        if (!span_fits) {
+            first = last - 1;
+            kept.push_back(first);
+        }
+    }
+    if (key_count > 1) kept.push_back((uint) key_count - 1);
+    return kept;
+}
+
 struct MeshHierarchyNode {
     std::vector<uint> meshes{};
     glm::mat4 transformation{1.0f};
@@ -38,12 +245,17 @@ struct ModelInfo {
     std::shared_ptr<ModelHandle<VertexData>> model{};
     // { bone_name } -> { bone_id }
     std::unordered_map<std::string, uint> bones{};
-    // Computed based on an input time
-    std::vector<glm::mat4> bone_transforms{};
 
-    ModelInfo(const std::shared_ptr<ModelHandle<VertexData>>& model, const std::unordered_map<std::string, uint>& bones) : model(model), bones(bones) {
-        bone_transforms.resize(bones.size(), glm::mat4{1.0f});
-    }
+    ModelInfo(const std::shared_ptr<ModelHandle<VertexData>>& model, const std::unordered_map<std::string, uint>& bones) : model(model), bones(bones) {}
+};
+
+/// Every animation of a hierarchy sampled at a fixed rate ahead of time, so that instances can be posed on the GPU by looking up a frame
+struct BakedAnimations {
+    float frame_rate = 0.0f;
+    // [animation_id] -> (first_frame, frame_count), where frame 0 is the pose for NONE_ANIMATION
+    std::vector<std::pair<uint, uint>> animation_frames{};
+    // Frames of palette_size bone transforms each, for every animation in turn
+    TextureBuffer<glm::mat4> palettes{GL_RGBA32F};
 };
 
 class BaseMeshHierarchy : private NonCopyable {
@@ -52,8 +264,16 @@ public:
 };
 
 /// A struct representing a hierarchy of meshes, for use in animation.
+/// The node tree is flattened by flatten into arrays in topological order (each parent before its children), so that
+/// evaluating a pose, which happens for every animated entity every frame, is a single forward loop.
 template<typename VertexData>
 struct MeshHierarchy : public BaseMeshHierarchy {
+    static constexpr uint NO_PARENT = UINT_MAX;
+    static constexpr uint NO_TRACK = UINT_MAX;
+    static constexpr uint GROUPED_TRACK = UINT_MAX - 1;
+    // A node is minor if it and everything below it spans less than this fraction of the whole hierarchy, such as fingers and toes
+    static constexpr float MINOR_NODE_SCALE = 0.05f;
+
     std::vector<ModelInfo<VertexData>> meshes{};
     // { bone_name } -> [(mesh_index, bone_id, offset_matrix)]
     std::unordered_map<std::string, std::vector<std::tuple<uint, uint, glm::mat4>>> total_bones{};
@@ -62,21 +282,228 @@ struct MeshHierarchy : public BaseMeshHierarchy {
     // The name of the file the MeshHierarchy was loaded from, if any
     std::optional<std::string> filename{};
     MeshHierarchyNode root_node{};
+    // Bounds of every mesh placed by the node transformations, in the bind pose
+    BoundingVolume bounds{};
+
+    // The flattened node tree, all indexed by position in topological order
+    // [node] -> the node in the tree
+    std::vector<const MeshHierarchyNode*> nodes{};
+    // [node] -> index of the parent node, or NO_PARENT for the root
+    std::vector<uint> parent_indices{};
+    // [node] -> transformation used when posing and the node has no track, identity outside of a skeleton
+    std::vector<glm::mat4> rest_transforms{};
+    // [node] -> accumulated transformation of the bind pose, as passed to visit_nodes
+    std::vector<glm::mat4> bind_transforms{};
+    // [node] -> index into node_bones of the node's first bone, with an extra entry at the end
+    std::vector<uint> first_bones{};
+    // [(mesh_index, bone_id, offset_matrix)], of each node in turn
+    std::vector<std::tuple<uint, uint, glm::mat4>> node_bones{};
+    // [animation_id][node] -> index into tracks, NO_TRACK, or GROUPED_TRACK when the node is posed by one of the animation's key groups
+    std::vector<std::vector<uint>> track_indices{};
+    // The compressed animation data of every node, moved out of the tree. Empty for tracks that were moved into a key group
+    std::vector<PackedAnimationData> tracks{};
+    // The key groups of every animation
+    std::vector<KeyGroup> key_groups{};
+    // [animation_id] -> (first, end) range of key_groups
+    std::vector<std::pair<uint, uint>> animation_key_groups{};
+    // The most tracks in any key group
+    size_t largest_key_group = 0;
+    // [node] -> whether the node is minor, so a reduced skeleton holds it in its rest transform rather than animating it
+    std::vector<bool> minor_nodes{};
+
+    // [mesh] -> index of the mesh's first bone in a palette, as computed by calculate_animation
+    std::vector<uint> palette_offsets{};
+    // Bones of every mesh, the size of a palette
+    uint palette_size = 0;
+
+    // Set by bake_animations, if the hierarchy was baked
+    std::unique_ptr<BakedAnimations> baked_animations{};
 
     explicit MeshHierarchy(const std::optional<std::string>& filename = std::nullopt) : filename(filename) {}
 
-    /// Set the transformation field of each node to the correct state for the given time
-    void calculate_animation(uint animation_id, double time_seconds);
-    /// Recursively iterator over node tree
-    void visit_nodes(std::function<void(const MeshHierarchyNode& node, glm::mat4 accumulated_transformation)> fn);
+    /// Build the flattened arrays from the node tree, must be called once the tree is complete and before any of the functions below.
+    /// The animation data is moved out of the tree's nodes and compressed, dropping keys that interpolation reproduces within tolerances.
+    void flatten(const KeyTolerances& tolerances = {});
+    /// Compute the bone transforms of each mesh for the given time into palette (resized to palette_size), using and updating the cursor of the instance being animated.
+    /// If reduced_skeleton is set, minor nodes aren't animated, for instances too small for them to be noticed.
+    /// Doesn't modify the hierarchy, so different instances can be posed on different threads at once.
+    void calculate_animation(uint animation_id, double time_seconds, AnimationCursor& cursor, std::vector<glm::mat4>& palette, bool reduced_skeleton = false) const;
+    /// Sample every animation frame_rate times a second, including its last moment, and upload the palettes into baked_animations.
+    /// Must be called after flatten, on the thread with the OpenGL context.
+    void bake_animations(float frame_rate);
+    /// Call fn for each node, parents before children, with the accumulated transformation of the bind pose
+    template<typename Fn>
+    void visit_nodes(Fn fn) const;
+private:
+    /// Decide which nodes are minor, by how far they and their descendants reach in the bind pose
+    void find_minor_nodes();
+    /// Move the tracks of each animation that share key times into key groups, leaving them empty
+    void build_key_groups(std::vector<AnimationData>& loaded_tracks, const KeyTolerances& tolerances);
 };
 
 template<typename VertexData>
-void MeshHierarchy<VertexData>::calculate_animation(uint animation_id, double time_seconds) {
-    if (animation_id == NONE_ANIMATION) {
-        for (auto& mesh: meshes) {
-            std::fill(mesh.bone_transforms.begin(), mesh.bone_transforms.end(), glm::mat4{1.0f});
+void MeshHierarchy<VertexData>::flatten(const KeyTolerances& tolerances) {
+    nodes.clear();
+    parent_indices.clear();
+    rest_transforms.clear();
+    bind_transforms.clear();
+    first_bones.clear();
+    node_bones.clear();
+    tracks.clear();
+    track_indices.assign(animations.size(), {});
+    std::vector<AnimationData> loaded_tracks{};
+
+    // Depth first, so parents always come before their children. (node, parent index, inside a skeleton)
+    std::vector<std::tuple<MeshHierarchyNode*, uint, bool>> stack{{&root_node, NO_PARENT, false}};
+    while (!stack.empty()) {
+        auto [node, parent, is_skeleton] = stack.back();
+        stack.pop_back();
+        is_skeleton |= !node->bones.empty();
+
+        auto index = (uint) nodes.size();
+        nodes.push_back(node);
+        parent_indices.push_back(parent);
+        rest_transforms.push_back(is_skeleton ? node->transformation : glm::mat4{1.0f});
+        bind_transforms.push_back(parent == NO_PARENT ? node->transformation : bind_transforms[parent] * node->transformation);
+
+        first_bones.push_back((uint) node_bones.size());
+        node_bones.insert(node_bones.end(), node->bones.begin(), node->bones.end());
+
+        for (auto& [animation_id, animation_data]: node->animation_data) {
+            if ((size_t) animation_id >= track_indices.size()) track_indices.resize(animation_id + 1);
+            auto& indices = track_indices[animation_id];
+            indices.resize(index + 1, NO_TRACK);
+            indices[index] = (uint) loaded_tracks.size();
+            loaded_tracks.push_back(std::move(animation_data));
+        }
+        node->animation_data.clear();
+
+        // Reversed, so that children are visited in their original order
+        for (auto child = node->children.rbegin(); child != node->children.rend(); ++child) {
+            stack.emplace_back(&*child, index, is_skeleton);
+        }
+    }
+    first_bones.push_back((uint) node_bones.size());
+
+    for (auto& indices: track_indices) {
+        indices.resize(nodes.size(), NO_TRACK);
+    }
+    palette_offsets.clear();
+    palette_size = 0;
+    for (const auto& mesh: meshes) {
+        palette_offsets.push_back(palette_size);
+        palette_size += (uint) mesh.bones.size();
+    }
+
+    find_minor_nodes();
+    build_key_groups(loaded_tracks, tolerances);
+    tracks.reserve(loaded_tracks.size());
+    for (const auto& animation_data: loaded_tracks) {
+        tracks.push_back(PackedAnimationData::pack(animation_data, tolerances));
+    }
+}
+
+template<typename VertexData>
+void MeshHierarchy<VertexData>::find_minor_nodes() {
+    glm::vec3 min{std::numeric_limits<float>::max()};
+    glm::vec3 max{std::numeric_limits<float>::lowest()};
+    // [node] -> distance from the parent, in the bind pose
+    std::vector<float> lengths(nodes.size(), 0.0f);
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        glm::vec3 position = bind_transforms[i][3];
+        min = glm::min(min, position);
+        max = glm::max(max, position);
+        if (parent_indices[i] != NO_PARENT) {
+            lengths[i] = glm::distance(position, glm::vec3(bind_transforms[parent_indices[i]][3]));
+        }
+    }
+    float minor_reach = nodes.empty() ? 0.0f : MINOR_NODE_SCALE * glm::distance(min, max);
+
+    // [node] -> furthest any descendant is from the node, found bottom up since children come after their parents
+    std::vector<float> reaches(nodes.size(), 0.0f);
+    for (size_t i = nodes.size(); i-- > 0;) {
+        if (parent_indices[i] != NO_PARENT) {
+            reaches[parent_indices[i]] = std::max(reaches[parent_indices[i]], reaches[i] + lengths[i]);
+        }
+    }
+
+    // A minor node's reach includes its descendants, so they are always minor too
+    minor_nodes.assign(nodes.size(), false);
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        minor_nodes[i] = parent_indices[i] != NO_PARENT && reaches[i] + lengths[i] < minor_reach;
+    }
+}
+
+template<typename VertexData>
+void MeshHierarchy<VertexData>::build_key_groups(std::vector<AnimationData>& loaded_tracks, const KeyTolerances& tolerances) {
+    key_groups.clear();
+    animation_key_groups.clear();
+
+    for (auto& node_tracks: track_indices) {
+        auto first_group = (uint) key_groups.size();
+        // { key times } -> { index into key_groups }
+        std::map<std::vector<float>, uint> groups_by_times{};
+        // [group - first_group] -> [track] -> the loaded track
+        std::vector<std::vector<const AnimationData*>> group_tracks{};
+        // Cleared once the groups are packed
+        std::vector<uint> grouped_tracks{};
+
+        // Major nodes first, so they are at the front of every group
+        for (uint i = 0; i < 2 * nodes.size(); ++i) {
+            uint node = i % (uint) nodes.size();
+            bool minor_pass = i >= nodes.size();
+            uint track = node_tracks[node];
+            if (minor_nodes[node] != minor_pass || track == NO_TRACK || !loaded_tracks[track].has_shared_times()) continue;
+
+            const auto& animation_data = loaded_tracks[track];
+            auto [group_index, inserted] = groups_by_times.emplace(animation_data.positions.times, (uint) key_groups.size());
+            if (inserted) {
+                key_groups.emplace_back();
+                group_tracks.emplace_back();
+            }
+            auto& group = key_groups[group_index->second];
+            group.nodes.push_back(node);
+            if (!minor_pass) group.major_count = group.nodes.size();
+            group_tracks[group_index->second - first_group].push_back(&animation_data);
+            grouped_tracks.push_back(track);
+            node_tracks[node] = GROUPED_TRACK;
+        }
+
+        for (size_t i = 0; i < group_tracks.size(); ++i) {
+            key_groups[first_group + i].pack(group_tracks[i], tolerances);
+        }
+        for (auto index: grouped_tracks) {
+            loaded_tracks[index] = AnimationData{};
         }
+        animation_key_groups.emplace_back(first_group, (uint) key_groups.size());
+    }
+
+    largest_key_group = 0;
+    for (const auto& group: key_groups) {
+        largest_key_group = std::max(largest_key_group, group.nodes.size());
+    }
+}
+
+/// out[i] = mix(a[i], b[i], t), for runs of floats
+inline void mix_floats(const float* a, const float* b, float t, size_t count, float* out) {
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = a[i] * (1.0f - t) + b[i] * t;
+    }
+}
+
+/// Unpack the first count values at key and at next_key, back to back into out
+inline void unpack_group_keys(const PackedVec3* values, const PackedVec3* next_values, const std::vector<Vec3Range>& ranges, size_t count, glm::vec3* out) {
+    for (size_t track = 0; track < count; ++track) {
+        out[track] = ranges[track].unpack(values[track]);
+        out[count + track] = ranges[track].unpack(next_values[track]);
+    }
+}
+
+template<typename VertexData>
+void MeshHierarchy<VertexData>::calculate_animation(uint animation_id, double time_seconds, AnimationCursor& cursor, std::vector<glm::mat4>& palette, bool reduced_skeleton) const {
+    palette.resize(palette_size);
+    if (animation_id == NONE_ANIMATION) {
+        std::fill(palette.begin(), palette.end(), glm::mat4{1.0f});
         return;
     }
 
@@ -84,43 +511,109 @@ void MeshHierarchy<VertexData>::calculate_animation(uint animation_id, double ti
         throw std::runtime_error(Formatter() << "Invalid animation id: " << animation_id);
     }
 
-    std::function<void(const MeshHierarchyNode& node, glm::mat4 accumulated_transformation, bool is_skeleton)> animate;
-    double time_ticks = time_seconds * std::get<1>(animations[animation_id]);
+    auto time_ticks = (float) (time_seconds * std::get<1>(animations[animation_id]));
+    const auto& node_tracks = track_indices[animation_id];
+    cursor.tracks.resize(tracks.size());
+    cursor.groups.resize(key_groups.size());
+
+    thread_local PoseScratch scratch{};
+    auto& [pose, group_transforms, group_keys, group_positions, group_scalings] = scratch;
+    pose.resize(nodes.size());
+    group_transforms.resize(nodes.size());
+    group_keys.resize(2 * largest_key_group);
+    group_positions.resize(largest_key_group);
+    group_scalings.resize(largest_key_group);
+
+    auto [first_group, end_group] = animation_key_groups[animation_id];
+    for (uint group_i = first_group; group_i < end_group; ++group_i) {
+        const auto& group = key_groups[group_i];
+        size_t track_count = group.nodes.size();
+        // Values are still laid out for every track, only fewer of them are read
+        size_t evaluated_count = reduced_skeleton ? group.major_count : track_count;
+        if (evaluated_count == 0) continue;
 
-    animate = [&animate, this, animation_id, time_ticks](const MeshHierarchyNode& node, glm::mat4 accumulated_transformation, bool is_skeleton) {
-        is_skeleton |= !node.bones.empty();
-        glm::mat4 transform = is_skeleton ? node.transformation : glm::mat4{1.0f};
-        const auto animation = node.animation_data.find(animation_id);
-        if (animation != node.animation_data.end()) {
-            transform = animation->second.sample(time_ticks);
+        // The keys are found once for the whole group
+        uint key = seek_key(group.times, time_ticks, cursor.groups[group_i]);
+        uint next_key = key;
+        float t = 0.0f;
+        if (time_ticks > group.times[key] && key + 1 < group.times.size()) {
+            next_key = key + 1;
+            t = (time_ticks - group.times[key]) / (group.times[next_key] - group.times[key]);
         }
-        accumulated_transformation = accumulated_transformation * transform;
 
-        for (const auto& [mesh_id, bone_id, offset_matrix]: node.bones) {
-            meshes[mesh_id].bone_transforms[bone_id] = accumulated_transformation * offset_matrix;
+        // Positions and scalings are unpacked for both keys, then mixed component-wise as a run of plain floats
+        unpack_group_keys(&group.positions[key * track_count], &group.positions[next_key * track_count], group.position_ranges, evaluated_count, group_keys.data());
+        mix_floats(&group_keys[0].x, &group_keys[evaluated_count].x, t, 3 * evaluated_count, &group_positions[0].x);
+        unpack_group_keys(&group.scalings[key * track_count], &group.scalings[next_key * track_count], group.scaling_ranges, evaluated_count, group_keys.data());
+        mix_floats(&group_keys[0].x, &group_keys[evaluated_count].x, t, 3 * evaluated_count, &group_scalings[0].x);
+        const PackedQuat* rotations = &group.rotations[key * track_count];
+        const PackedQuat* next_rotations = &group.rotations[next_key * track_count];
+
+        for (size_t track = 0; track < evaluated_count; ++track) {
+            glm::quat rotation = next_key == key ? rotations[track].unpack() : glm::slerp(rotations[track].unpack(), next_rotations[track].unpack(), t);
+            group_transforms[group.nodes[track]] = glm::translate(group_positions[track]) * glm::toMat4(rotation) * glm::scale(group_scalings[track]);
         }
+    }
 
-        for (const auto& child: node.children) {
-            animate(child, accumulated_transformation, is_skeleton);
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        uint track = node_tracks[i];
+        glm::mat4 transform;
+        if (track == NO_TRACK || (reduced_skeleton && minor_nodes[i])) {
+            transform = rest_transforms[i];
+        } else if (track == GROUPED_TRACK) {
+            transform = group_transforms[i];
+        } else {
+            transform = tracks[track].sample(time_ticks, cursor.tracks[track]);
         }
-    };
+        // Parents come first, so their pose is already done
+        pose[i] = parent_indices[i] == NO_PARENT ? transform : pose[parent_indices[i]] * transform;
 
-    animate(root_node, glm::mat4{1.0f}, false);
+        for (uint bone_i = first_bones[i]; bone_i < first_bones[i + 1]; ++bone_i) {
+            const auto& [mesh_id, bone_id, offset_matrix] = node_bones[bone_i];
+            palette[palette_offsets[mesh_id] + bone_id] = pose[i] * offset_matrix;
+        }
+    }
 }
 
 template<typename VertexData>
-void MeshHierarchy<VertexData>::visit_nodes(std::function<void(const MeshHierarchyNode&, glm::mat4)> fn) {
-    std::function<void(const MeshHierarchyNode& node, glm::mat4 accumulated_transformation)> visit;
-
-    visit = [&visit, &fn](const MeshHierarchyNode& node, glm::mat4 accumulated_transformation) {
-        accumulated_transformation = accumulated_transformation * node.transformation;
-        fn(node, accumulated_transformation);
-        for (const auto& child: node.children) {
-            visit(child, accumulated_transformation);
+void MeshHierarchy<VertexData>::bake_animations(float frame_rate) {
+    auto baked = std::make_unique<BakedAnimations>();
+    baked->frame_rate = frame_rate;
+    auto& frames = baked->palettes.data;
+    AnimationCursor cursor{};
+    std::vector<glm::mat4> palette{};
+
+    calculate_animation(NONE_ANIMATION, 0.0, cursor, palette);
+    frames.insert(frames.end(), palette.begin(), palette.end());
+    uint frame_total = 1;
+
+    for (uint animation_id = 0; animation_id < animations.size(); ++animation_id) {
+        const auto& [animation_name, ticks_per_second, duration_ticks] = animations[animation_id];
+        double duration_seconds = duration_ticks / ticks_per_second;
+        uint frame_count = (uint) std::ceil(duration_seconds * frame_rate) + 1;
+        baked->animation_frames.emplace_back(frame_total, frame_count);
+
+        // Sampled in order, so the cursor makes each frame cheap
+        for (uint frame = 0; frame < frame_count; ++frame) {
+            calculate_animation(animation_id, std::min((double) frame / frame_rate, duration_seconds), cursor, palette);
+            frames.insert(frames.end(), palette.begin(), palette.end());
         }
-    };
+        frame_total += frame_count;
+    }
 
-    visit(root_node, glm::mat4{1.0f});
+    baked->palettes.upload();
+    // Only the GPU copy is needed from now on
+    frames.clear();
+    frames.shrink_to_fit();
+    baked_animations = std::move(baked);
+}
+
+template<typename VertexData>
+template<typename Fn>
+void MeshHierarchy<VertexData>::visit_nodes(Fn fn) const {
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        fn(*nodes[i], bind_transforms[i]);
+    }
 }
 
 #endif //MESH_HIERARCHY_H
@@ -2,10 +2,13 @@
 #define MODEL_HANDLE_H
 
 #include <string>
+#include <memory>
 #include <optional>
 
 #include <glad/gl.h>
 #include "utility/HelperTypes.h"
+#include "rendering/memory/GeometryArena.h"
+#include "BoundingVolume.h"
 
 /// A type-erased version of ModelHandle for polymorphic usages
 class BaseModelHandle : private NonCopyable {
@@ -14,55 +17,112 @@ public:
 };
 
 /// A class representing a handle to a loaded model, also storing some of its configuration data.
+/// The geometry lives in the GeometryArena for its VertexData, which the handle keeps alive, and is returned to it when the handle is destroyed.
+/// A handle that is still loading in the background (see ModelLoader::load_from_file_async) draws as its placeholder until finish_loading.
 template<typename VertexData>
 class ModelHandle : public BaseModelHandle {
-    uint vertex_vbo;
-    uint index_vbo;
-    uint vao;
-    int index_count;
-    int vertex_offset;
+    std::shared_ptr<GeometryArena<VertexData>> arena;
+    typename GeometryArena<VertexData>::Allocation allocation;
+    // In model space
+    BoundingVolume bounds;
 
     std::optional<std::string> filename{};
+    // While loading, the model whose geometry is borrowed in the meantime, which also keeps it from being freed
+    std::shared_ptr<ModelHandle> placeholder{};
 public:
-    ModelHandle(uint vertex_vbo, uint index_vbo, uint vao, int index_count, int vertex_offset, std::optional<std::string> filename = {});
+    ModelHandle(std::shared_ptr<GeometryArena<VertexData>> arena, typename GeometryArena<VertexData>::Allocation allocation, BoundingVolume bounds, std::optional<std::string> filename = {});
+    /// A handle that is still loading, drawn as placeholder until then
+    ModelHandle(std::shared_ptr<ModelHandle> placeholder, std::optional<std::string> filename);
+
+    /// Whether the handle has its own geometry yet, rather than the placeholder's
+    [[nodiscard]] bool is_loaded() const;
+    /// Replace the placeholder with the loaded geometry, which the handle then owns
+    void finish_loading(typename GeometryArena<VertexData>::Allocation loaded_allocation, BoundingVolume loaded_bounds);
 
     [[nodiscard]] uint get_vertex_vbo() const;
     [[nodiscard]] uint get_index_vbo() const;
+    /// Shared by every model with the same VertexData
     [[nodiscard]] uint get_vao() const;
     [[nodiscard]] int get_index_count() const;
+    /// The base vertex to draw with
     [[nodiscard]] int get_vertex_offset() const;
+    /// Identifies the geometry among the models sharing its VAO, and is small enough for a RenderQueue key.
+    /// A handle that is still loading has its placeholder's.
+    [[nodiscard]] uint get_model_id() const;
+    /// The index of the model's first index in the index buffer
+    [[nodiscard]] uint get_first_index() const;
+    /// The first index as the byte offset that glDrawElements* takes in place of a pointer
+    [[nodiscard]] const void* get_index_pointer() const;
+    [[nodiscard]] const BoundingVolume& get_bounds() const;
     [[nodiscard]] const std::optional<std::string>& get_filename() const;
 
     ~ModelHandle() override;
 };
 
 template<typename VertexData>
-ModelHandle<VertexData>::ModelHandle(uint vertex_vbo, uint index_vbo, uint vao, int index_count, int vertex_offset, std::optional<std::string> filename)
-    : BaseModelHandle(), vertex_vbo(vertex_vbo), index_vbo(index_vbo), vao(vao), index_count(index_count), vertex_offset(vertex_offset), filename(std::move(filename)) {}
+ModelHandle<VertexData>::ModelHandle(std::shared_ptr<GeometryArena<VertexData>> arena, typename GeometryArena<VertexData>::Allocation allocation, BoundingVolume bounds, std::optional<std::string> filename)
+    : BaseModelHandle(), arena(std::move(arena)), allocation(allocation), bounds(bounds), filename(std::move(filename)) {}
+
+template<typename VertexData>
+ModelHandle<VertexData>::ModelHandle(std::shared_ptr<ModelHandle> placeholder, std::optional<std::string> filename)
+    : BaseModelHandle(), arena(placeholder->arena), allocation(placeholder->allocation), bounds(placeholder->bounds), filename(std::move(filename)),
+      placeholder(std::move(placeholder)) {}
+
+template<typename VertexData>
+bool ModelHandle<VertexData>::is_loaded() const {
+    return placeholder == nullptr;
+}
+
+template<typename VertexData>
+void ModelHandle<VertexData>::finish_loading(typename GeometryArena<VertexData>::Allocation loaded_allocation, BoundingVolume loaded_bounds) {
+    allocation = loaded_allocation;
+    bounds = loaded_bounds;
+    placeholder = nullptr;
+}
 
 template<typename VertexData>
 uint ModelHandle<VertexData>::get_vertex_vbo() const {
-    return vertex_vbo;
+    return arena->get_vertex_vbo();
 }
 
 template<typename VertexData>
 uint ModelHandle<VertexData>::get_index_vbo() const {
-    return index_vbo;
+    return arena->get_index_vbo();
 }
 
 template<typename VertexData>
 uint ModelHandle<VertexData>::get_vao() const {
-    return vao;
+    return arena->get_vao();
 }
 
 template<typename VertexData>
 int ModelHandle<VertexData>::get_index_count() const {
-    return index_count;
+    return (int) allocation.index_count;
 }
 
 template<typename VertexData>
 int ModelHandle<VertexData>::get_vertex_offset() const {
-    return vertex_offset;
+    return (int) allocation.first_vertex;
+}
+
+template<typename VertexData>
+uint ModelHandle<VertexData>::get_model_id() const {
+    return allocation.model_id;
+}
+
+template<typename VertexData>
+uint ModelHandle<VertexData>::get_first_index() const {
+    return (uint) allocation.first_index;
+}
+
+template<typename VertexData>
+const void* ModelHandle<VertexData>::get_index_pointer() const {
+    return (const void*) (allocation.first_index * sizeof(uint));
+}
+
+template<typename VertexData>
+const BoundingVolume& ModelHandle<VertexData>::get_bounds() const {
+    return bounds;
 }
 
 template<typename VertexData>
@@ -72,9 +132,8 @@ const std::optional<std::string>& ModelHandle<VertexData>::get_filename() const
 
 template<typename VertexData>
 ModelHandle<VertexData>::~ModelHandle() {
-    glDeleteVertexArrays(1, &vao);
-    glDeleteBuffers(1, &vertex_vbo);
-    glDeleteBuffers(1, &index_vbo);
+    // The placeholder's geometry is its own to free
+    if (placeholder == nullptr) arena->free(allocation);
 }
 
 #endif //MODEL_HANDLE_H
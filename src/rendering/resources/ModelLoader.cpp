@@ -13,4 +13,21 @@ const std::vector<std::string>& ModelLoader::get_available_models(bool force_ref
     std::sort(available_models.value().begin(), available_models.value().end());
 
     return available_models.value();
-}
\ No newline at end of file
+}
+
+void ModelLoader::process_uploads(size_t byte_budget) {
+    for (auto& completed_load: completed_loads.take_all()) {
+        pending_uploads.push_back(std::move(completed_load));
+    }
+
+    size_t uploaded = 0;
+    while (!pending_uploads.empty()) {
+        // Always upload at least one, so that a model bigger than the budget still gets there
+        if (uploaded != 0 && uploaded + pending_uploads.front().size > byte_budget) break;
+
+        auto completed_load = std::move(pending_uploads.front());
+        pending_uploads.pop_front();
+        uploaded += completed_load.size;
+        completed_load.upload();
+    }
+}
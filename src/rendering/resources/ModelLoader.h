@@ -2,13 +2,16 @@
 #define MODEL_LOADER_H
 
 #include <map>
+#include <deque>
 #include <set>
+#include <tuple>
 #include <utility>
 #include <vector>
 #include <memory>
 #include <iostream>
 #include <string>
 #include <typeindex>
+#include <functional>
 #include <filesystem>
 #include <unordered_set>
 
@@ -22,6 +25,9 @@
 
 #include "ModelHandle.h"
 #include "MeshHierarchy.h"
+#include "MeshCache.h"
+#include "utility/BackgroundPool.h"
+#include "utility/CompletionQueue.h"
 
 struct VertexCollection {
     std::vector<glm::vec3> positions;
@@ -34,6 +40,12 @@ struct VertexCollection {
 /// A loader class intended for the use of loading models from disk. Includes caching functionality.
 class ModelLoader {
     std::string import_path;
+    // Samples per second when baking the animations of loaded hierarchies, 0 to not bake them
+    float animation_bake_rate;
+    // How far loaded animations may stray from the original keys when redundant keys are removed
+    KeyTolerances key_tolerances;
+    // Imports from previous runs, so that Assimp only runs when a file is new or has changed
+    MeshCache mesh_cache;
     Assimp::Importer importer{};
 
     std::optional<std::vector<std::string>> available_models{};
@@ -41,12 +53,39 @@ class ModelLoader {
     // Map (relative_path, vertex_type) -> (last_modified, weak_handle)
     std::unordered_map<std::pair<std::string, std::type_index>, std::pair<std::filesystem::file_time_type, std::weak_ptr<BaseModelHandle>>, PairHash> cache{};
     std::unordered_map<std::pair<std::string, std::type_index>, std::pair<std::filesystem::file_time_type, std::weak_ptr<BaseMeshHierarchy>>, PairHash> hierarchy_cache{};
+
+    /// A model loaded on a worker, ready to be uploaded on the GL thread
+    struct CompletedLoad {
+        // Bytes that upload copies to the GPU, counted against the budget of process_uploads
+        size_t size = 0;
+        std::function<void()> upload{};
+    };
+    // Pushed to by the workers as each load finishes
+    CompletionQueue<CompletedLoad> completed_loads{};
+    // Taken from completed_loads, but over the budget of a previous frame
+    std::deque<CompletedLoad> pending_uploads{};
+    // Declared last, so that the workers stop before anything they use is destroyed
+    BackgroundPool background_pool{};
 public:
+    static constexpr float DEFAULT_ANIMATION_BAKE_RATE = 30.0f;
+    static constexpr const char* DEFAULT_CACHE_PATH = "cache/models";
+    // Drawn in place of models that are still loading
+    static constexpr const char* PLACEHOLDER_MODEL = "cube.obj";
+    // Bytes of geometry process_uploads uploads per frame by default
+    static constexpr size_t DEFAULT_UPLOAD_BUDGET = 8 * 1024 * 1024;
+    // What every file is imported with, which is part of each mesh cache key
+    static constexpr uint POST_PROCESS_FLAGS = aiProcessPreset_TargetRealtime_MaxQuality | aiProcess_TransformUVCoords | aiProcess_SortByPType;
+
     /// Construct the loader with a import_path which is prepended to any path you try and load.
     /// It also scans the directory for all files, which is used to populate the list of get_available_models()
-    explicit ModelLoader(std::string import_path) : import_path(std::move(import_path)) {}
-
-    /// Loads the provided model data into GPU memory
+    /// Hierarchies are baked (see MeshHierarchy::bake_animations) at animation_bake_rate frames per second, unless it is 0.
+    /// Their animations are compressed to within key_tolerances (see MeshHierarchy::flatten).
+    /// Imports are cached in cache_path (see MeshCache), or not at all if it is empty.
+    explicit ModelLoader(std::string import_path, float animation_bake_rate = DEFAULT_ANIMATION_BAKE_RATE, KeyTolerances key_tolerances = {},
+                         std::string cache_path = DEFAULT_CACHE_PATH) :
+        import_path(std::move(import_path)), animation_bake_rate(animation_bake_rate), key_tolerances(key_tolerances), mesh_cache(std::move(cache_path)) {}
+
+    /// Loads the provided model data into GPU memory, as a range of the GeometryArena for VertexData
     template<typename VertexData>
     static std::shared_ptr<ModelHandle<VertexData>> load_from_data(const std::vector<VertexData>& vertices, const std::vector<uint>& indices, std::optional<std::string> filename = {});
 
@@ -54,6 +93,15 @@ public:
     template<typename VertexData>
     std::shared_ptr<ModelHandle<VertexData>> load_from_file(const std::string& file);
 
+    /// Start loading the file on a worker thread, returning a handle straight away which draws as PLACEHOLDER_MODEL until
+    /// process_uploads uploads the loaded model into it. A failed load is reported then, and leaves the placeholder in place.
+    template<typename VertexData>
+    std::shared_ptr<ModelHandle<VertexData>> load_from_file_async(const std::string& file);
+
+    /// Upload the models that have finished loading in the background, stopping once byte_budget has been used (though always
+    /// uploading at least one), so that streaming in large models doesn't stall the frame. Call once a frame, on the GL thread.
+    void process_uploads(size_t byte_budget = DEFAULT_UPLOAD_BUDGET);
+
     /// Load the file specified, as a hierarchy of meshes, for use with animated models.
     template<typename VertexData>
     std::shared_ptr<MeshHierarchy<VertexData>> load_hierarchy_from_file(const std::string& file);
@@ -74,30 +122,80 @@ public:
     void cleanup() {}
 
 private:
+    /// The loaded model for file, if it is still in use and up-to-date
+    template<typename VertexData>
+    std::shared_ptr<ModelHandle<VertexData>> find_loaded(const std::string& file, std::filesystem::file_time_type last_write_time);
+
+    /// Import the model with Assimp, flattening its meshes into vertices and indices. Each thread needs its own importer.
+    template<typename VertexData>
+    static void import_model(const std::string& file, const std::string& path, Assimp::Importer& importer, std::vector<VertexData>& vertices, std::vector<uint>& indices);
+
+    /// Copy the geometry into the GeometryArena for VertexData
+    template<typename VertexData>
+    static std::shared_ptr<ModelHandle<VertexData>> upload(ArrayView<VertexData> vertices, ArrayView<uint> indices, const BoundingVolume& bounds, std::optional<std::string> filename);
+
+    /// Rebuild a model from its mesh cache entry
+    template<typename VertexData>
+    static std::shared_ptr<ModelHandle<VertexData>> read_model(BinaryReader& reader, std::optional<std::string> filename);
+    /// The (vertices, indices, bounds) of a model in its mesh cache entry, checked to be valid
+    template<typename VertexData>
+    static std::tuple<ArrayView<VertexData>, ArrayView<uint>, BoundingVolume> read_model_views(BinaryReader& reader);
+    template<typename VertexData>
+    static void write_model(BinaryWriter& writer, const std::vector<VertexData>& vertices, const std::vector<uint>& indices, const BoundingVolume& bounds);
+
+    /// Import the meshes and node tree of a hierarchy with Assimp, writing them to the mesh cache entry as it goes
+    template<typename VertexData>
+    void import_hierarchy(const std::string& file, const std::string& path, MeshHierarchy<VertexData>& mesh_hierarchy, BinaryWriter& writer);
+    /// Rebuild the meshes and node tree of a hierarchy from its mesh cache entry
+    template<typename VertexData>
+    static void read_hierarchy(BinaryReader& reader, MeshHierarchy<VertexData>& mesh_hierarchy);
+
     template<typename VertexData>
     static void load_node(const aiScene* scene, const aiNode* node, std::vector<VertexData>& vertices, std::vector<uint>& indices, glm::mat4 parent_transform);
 };
 
 template<typename VertexData>
 std::shared_ptr<ModelHandle<VertexData>> ModelLoader::load_from_data(const std::vector<VertexData>& vertices, const std::vector<uint>& indices, std::optional<std::string> filename) {
-    uint vao;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    auto bounds = BoundingVolume::from_points(vertices.begin(), vertices.end(), [](const VertexData& vertex) { return vertex.position; });
+
+    return upload(ArrayView<VertexData>{vertices.data(), vertices.size()}, ArrayView<uint>{indices.data(), indices.size()}, bounds, std::move(filename));
+}
 
-    uint vertex_vbo;
-    glGenBuffers(1, &vertex_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vertex_vbo);
-    glBufferData(GL_ARRAY_BUFFER, (long) (sizeof(VertexData) * vertices.size()), vertices.data(), GL_STATIC_DRAW);
-    VertexData::setup_attrib_pointers();
+template<typename VertexData>
+std::shared_ptr<ModelHandle<VertexData>> ModelLoader::upload(ArrayView<VertexData> vertices, ArrayView<uint> indices, const BoundingVolume& bounds, std::optional<std::string> filename) {
+    auto arena = GeometryArena<VertexData>::get();
+    auto allocation = arena->allocate(vertices.data, vertices.size, indices.data, indices.size);
 
-    uint index_vbo;
-    glGenBuffers(1, &index_vbo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_vbo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, (long) (sizeof(uint) * indices.size()), indices.data(), GL_STATIC_DRAW);
+    return std::make_shared<ModelHandle<VertexData>>(std::move(arena), allocation, bounds, std::move(filename));
+}
+
+template<typename VertexData>
+std::shared_ptr<ModelHandle<VertexData>> ModelLoader::read_model(BinaryReader& reader, std::optional<std::string> filename) {
+    // Uploaded straight from the mapped entry, without copying out of it first
+    auto [vertices, indices, bounds] = read_model_views<VertexData>(reader);
+    return upload(vertices, indices, bounds, std::move(filename));
+}
+
+template<typename VertexData>
+std::tuple<ArrayView<VertexData>, ArrayView<uint>, BoundingVolume> ModelLoader::read_model_views(BinaryReader& reader) {
+    auto vertices = reader.read_array<VertexData>();
+    auto indices = reader.read_array<uint>();
+    auto bounds = reader.read<BoundingVolume>();
+
+    for (auto index: indices) {
+        if (index >= vertices.size) {
+            throw std::runtime_error("Cache entry has an index past the end of its vertices");
+        }
+    }
 
-    glBindVertexArray(0);
+    return {vertices, indices, bounds};
+}
 
-    return std::make_shared<ModelHandle<VertexData>>(vertex_vbo, index_vbo, vao, (int) indices.size(), 0, std::move(filename));
+template<typename VertexData>
+void ModelLoader::write_model(BinaryWriter& writer, const std::vector<VertexData>& vertices, const std::vector<uint>& indices, const BoundingVolume& bounds) {
+    writer.write_array(vertices);
+    writer.write_array(indices);
+    writer.write(bounds);
 }
 
 template<typename VertexData>
@@ -109,6 +207,131 @@ std::shared_ptr<ModelHandle<VertexData>> ModelLoader::load_from_file(const std::
 
     auto last_write_time = std::filesystem::last_write_time(path);
 
+    auto existing = find_loaded<VertexData>(file, last_write_time);
+    if (existing != nullptr) {
+        return existing;
+    }
+
+    auto cache_key = MeshCache::key<VertexData>(path, POST_PROCESS_FLAGS, "model");
+    try {
+        if (auto entry = mesh_cache.find(cache_key)) {
+            auto model = read_model<VertexData>(entry->reader, file);
+            cache[{file, std::type_index(typeid(VertexData))}] = {last_write_time, model};
+            return model;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to read mesh cache entry, importing (" << file << ") instead:" << std::endl;
+        std::cerr << e.what() << std::endl;
+    }
+
+    std::vector<VertexData> vertices{};
+    std::vector<uint> indices{};
+    import_model(file, path, importer, vertices, indices);
+
+    auto model = load_from_data(vertices, indices, file);
+
+    BinaryWriter writer{};
+    write_model(writer, vertices, indices, model->get_bounds());
+    mesh_cache.store(cache_key, writer);
+
+    cache[{file, std::type_index(typeid(VertexData))}] = {last_write_time, model};
+
+    return model;
+}
+
+template<typename VertexData>
+std::shared_ptr<ModelHandle<VertexData>> ModelLoader::load_from_file_async(const std::string& file) {
+    auto path = import_path + "/" + file;
+    if (!std::filesystem::exists(path)) {
+        throw std::runtime_error(Formatter() << "Failed to load model (" << path << "): \n\t File does not exist");
+    }
+
+    auto last_write_time = std::filesystem::last_write_time(path);
+
+    // Also finds models that are still loading, so that a file is only loaded once
+    auto existing = find_loaded<VertexData>(file, last_write_time);
+    if (existing != nullptr) {
+        return existing;
+    }
+
+    if (file == PLACEHOLDER_MODEL) {
+        return load_from_file<VertexData>(file);
+    }
+
+    auto model = std::make_shared<ModelHandle<VertexData>>(load_from_file<VertexData>(PLACEHOLDER_MODEL), file);
+    cache[{file, std::type_index(typeid(VertexData))}] = {last_write_time, model};
+
+    std::weak_ptr<ModelHandle<VertexData>> weak_model = model;
+    background_pool.submit([this, file, path, weak_model]() {
+        // Nothing wants the model any more
+        if (weak_model.expired()) return;
+
+        CompletedLoad completed_load{};
+        auto cache_key = MeshCache::key<VertexData>(path, POST_PROCESS_FLAGS, "model");
+        try {
+            if (auto entry = mesh_cache.find(cache_key)) {
+                ArrayView<VertexData> vertices;
+                ArrayView<uint> indices;
+                BoundingVolume bounds;
+                std::tie(vertices, indices, bounds) = read_model_views<VertexData>(entry->reader);
+
+                // Uploaded straight from the mapped entry, which the upload keeps open until then
+                std::shared_ptr<MappedFile> mapped_file = std::move(entry->file);
+                completed_load.size = vertices.size * sizeof(VertexData) + indices.size * sizeof(uint);
+                completed_load.upload = [weak_model, mapped_file, vertices, indices, bounds]() {
+                    auto model = weak_model.lock();
+                    if (model == nullptr) return;
+
+                    auto allocation = GeometryArena<VertexData>::get()->allocate(vertices.data, vertices.size, indices.data, indices.size);
+                    model->finish_loading(allocation, bounds);
+                };
+                completed_loads.push(std::move(completed_load));
+                return;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Failed to read mesh cache entry, importing (" << file << ") instead:" << std::endl;
+            std::cerr << e.what() << std::endl;
+        }
+
+        try {
+            std::vector<VertexData> vertices{};
+            std::vector<uint> indices{};
+            Assimp::Importer worker_importer{};
+            import_model(file, path, worker_importer, vertices, indices);
+            auto bounds = BoundingVolume::from_points(vertices.begin(), vertices.end(), [](const VertexData& vertex) { return vertex.position; });
+
+            BinaryWriter writer{};
+            write_model(writer, vertices, indices, bounds);
+            mesh_cache.store(cache_key, writer);
+
+            completed_load.size = vertices.size() * sizeof(VertexData) + indices.size() * sizeof(uint);
+            completed_load.upload = [weak_model, vertices = std::move(vertices), indices = std::move(indices), bounds]() {
+                auto model = weak_model.lock();
+                if (model == nullptr) return;
+
+                auto allocation = GeometryArena<VertexData>::get()->allocate(vertices, indices);
+                model->finish_loading(allocation, bounds);
+            };
+        } catch (const std::exception& e) {
+            completed_load.upload = [this, file, weak_model, error = std::string(e.what())]() {
+                std::cerr << "Failed to load model (" << file << ") in the background:" << std::endl;
+                std::cerr << error << std::endl;
+
+                // Forget the model, so that loading the file again tries again rather than getting the placeholder
+                auto existing = cache.find({file, std::type_index(typeid(VertexData))});
+                if (existing != cache.end() && existing->second.second.lock() == weak_model.lock()) {
+                    cache.erase(existing);
+                }
+            };
+        }
+        completed_loads.push(std::move(completed_load));
+    });
+
+    return model;
+}
+
+template<typename VertexData>
+std::shared_ptr<ModelHandle<VertexData>> ModelLoader::find_loaded(const std::string& file, std::filesystem::file_time_type last_write_time) {
     auto existing = cache.find({file, std::type_index(typeid(VertexData))});
     if (existing != cache.end()) {
         // Cache exist, so try lock
@@ -118,8 +341,12 @@ std::shared_ptr<ModelHandle<VertexData>> ModelLoader::load_from_file(const std::
             return std::dynamic_pointer_cast<ModelHandle<VertexData>>(handle);
         }
     }
+    return nullptr;
+}
 
-    const aiScene* scene = importer.ReadFile(path, aiProcessPreset_TargetRealtime_MaxQuality | aiProcess_TransformUVCoords | aiProcess_SortByPType);
+template<typename VertexData>
+void ModelLoader::import_model(const std::string& file, const std::string& path, Assimp::Importer& importer, std::vector<VertexData>& vertices, std::vector<uint>& indices) {
+    const aiScene* scene = importer.ReadFile(path, POST_PROCESS_FLAGS);
 
     if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
         throw std::runtime_error(Formatter() << "Failed to load model (" << file << "): \n\t" << importer.GetErrorString());
@@ -140,18 +367,9 @@ std::shared_ptr<ModelHandle<VertexData>> ModelLoader::load_from_file(const std::
         throw std::runtime_error(Formatter() << "Failed to load model (" << file << "): \n\t" << "No triangle meshes");
     }
 
-    std::vector<VertexData> vertices{};
-    std::vector<uint> indices{};
-
     load_node(scene, scene->mRootNode, vertices, indices, glm::mat4{1.0f});
 
-    auto model = load_from_data(vertices, indices, file);
-
     importer.FreeScene();
-
-    cache[{file, std::type_index(typeid(VertexData))}] = {last_write_time, model};
-
-    return model;
 }
 
 template<typename VertexData>
@@ -230,7 +448,48 @@ std::shared_ptr<MeshHierarchy<VertexData>> ModelLoader::load_hierarchy_from_file
         }
     }
 
-    const aiScene* scene = importer.ReadFile(path, aiProcessPreset_TargetRealtime_MaxQuality | aiProcess_TransformUVCoords | aiProcess_SortByPType);
+    auto mesh_hierarchy = std::make_shared<MeshHierarchy<VertexData>>(file);
+
+    auto cache_key = MeshCache::key<VertexData>(path, POST_PROCESS_FLAGS, "hierarchy");
+    bool cached = false;
+    try {
+        if (auto entry = mesh_cache.find(cache_key)) {
+            read_hierarchy(entry->reader, *mesh_hierarchy);
+            cached = true;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to read mesh cache entry, importing (" << file << ") instead:" << std::endl;
+        std::cerr << e.what() << std::endl;
+        // Start over, rather than keep whatever was read before it failed
+        mesh_hierarchy = std::make_shared<MeshHierarchy<VertexData>>(file);
+    }
+
+    if (!cached) {
+        BinaryWriter writer{};
+        import_hierarchy(file, path, *mesh_hierarchy, writer);
+        mesh_cache.store(cache_key, writer);
+    }
+
+    // The entry holds the node tree as imported, so that changing the tolerances or bake rate doesn't need a new entry
+    mesh_hierarchy->flatten(key_tolerances);
+    if (animation_bake_rate > 0.0f) {
+        mesh_hierarchy->bake_animations(animation_bake_rate);
+    }
+
+    mesh_hierarchy->visit_nodes([&mesh_hierarchy](const MeshHierarchyNode& node, glm::mat4 accumulated_transformation) {
+        for (const auto& mesh_id: node.meshes) {
+            mesh_hierarchy->bounds.merge(mesh_hierarchy->meshes[mesh_id].model->get_bounds().transformed(accumulated_transformation));
+        }
+    });
+
+    hierarchy_cache[{file, std::type_index(typeid(VertexData))}] = {last_write_time, mesh_hierarchy};
+
+    return mesh_hierarchy;
+}
+
+template<typename VertexData>
+void ModelLoader::import_hierarchy(const std::string& file, const std::string& path, MeshHierarchy<VertexData>& mesh_hierarchy, BinaryWriter& writer) {
+    const aiScene* scene = importer.ReadFile(path, POST_PROCESS_FLAGS);
 
     if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
         throw std::runtime_error(Formatter() << "Failed to load model (" << file << "): \n\t" << importer.GetErrorString());
@@ -240,9 +499,15 @@ std::shared_ptr<MeshHierarchy<VertexData>> ModelLoader::load_hierarchy_from_file
         throw std::runtime_error(Formatter() << "Failed to load model (" << file << "): \n\t" << "No meshes");
     }
 
-    auto mesh_hierarchy = std::make_shared<MeshHierarchy<VertexData>>(file);
+    uint64_t triangle_meshes = 0;
+    for (auto i = 0u; i < scene->mNumMeshes; ++i) {
+        if ((scene->mMeshes[i]->mPrimitiveTypes & aiPrimitiveType_TRIANGLE) != 0) {
+            triangle_meshes++;
+        }
+    }
+    writer.write(triangle_meshes);
 
-    // {index into scene->mMeshes} -> {index into mesh_hierarchy->models}
+    // {index into scene->mMeshes} -> {index into mesh_hierarchy.models}
     std::unordered_map<uint, uint> mesh_index_map{};
 
     for (auto mesh_i = 0u; mesh_i < scene->mNumMeshes; ++mesh_i) {
@@ -265,7 +530,7 @@ std::shared_ptr<MeshHierarchy<VertexData>> ModelLoader::load_hierarchy_from_file
             const auto* bone = mesh->mBones[bone_i];
             bone_names[bone->mName.C_Str()] = bone_i;
             auto ai_offset_matrix = bone->mOffsetMatrix;
-            mesh_hierarchy->total_bones[bone->mName.C_Str()].push_back({mesh_i, bone_i, reinterpret_cast<glm::mat4&>(ai_offset_matrix.Transpose())});
+            mesh_hierarchy.total_bones[bone->mName.C_Str()].push_back({mesh_i, bone_i, reinterpret_cast<glm::mat4&>(ai_offset_matrix.Transpose())});
 
             for (auto weight_i = 0u; weight_i < bone->mNumWeights; ++weight_i) {
                 const auto* weight = &bone->mWeights[weight_i];
@@ -309,14 +574,17 @@ std::shared_ptr<MeshHierarchy<VertexData>> ModelLoader::load_hierarchy_from_file
             indices.insert(indices.end(), face.mIndices, face.mIndices + face.mNumIndices);
         }
 
-        mesh_index_map[mesh_i] = (int) mesh_hierarchy->meshes.size();
-        mesh_hierarchy->meshes.push_back(ModelInfo{
+        mesh_index_map[mesh_i] = (int) mesh_hierarchy.meshes.size();
+        mesh_hierarchy.meshes.push_back(ModelInfo{
             load_from_data(vertices, indices),
             bone_names
         });
+
+        write_model(writer, vertices, indices, mesh_hierarchy.meshes.back().model->get_bounds());
+        write_bone_names(writer, bone_names);
     }
 
-    if (mesh_hierarchy->meshes.empty()) {
+    if (mesh_hierarchy.meshes.empty()) {
         throw std::runtime_error(Formatter() << "Failed to load model (" << file << "): \n\t" << "No triangle meshes");
     }
 
@@ -328,7 +596,7 @@ std::shared_ptr<MeshHierarchy<VertexData>> ModelLoader::load_hierarchy_from_file
         double ticks_per_second = animation->mTicksPerSecond;
         // Default to "[Unnamed] ({id})", in case file doesn't specify
         // Default to 1 tick-per-second, in case file doesn't specify
-        mesh_hierarchy->animations.emplace_back(name.empty() ? Formatter() << "[Unnamed] (" << animation_i << ")" : name, ticks_per_second == 0.0 ? 1.0 : ticks_per_second, animation->mDuration);
+        mesh_hierarchy.animations.emplace_back(name.empty() ? Formatter() << "[Unnamed] (" << animation_i << ")" : name, ticks_per_second == 0.0 ? 1.0 : ticks_per_second, animation->mDuration);
 
         for (auto channel_i = 0u; channel_i < animation->mNumChannels; ++channel_i) {
             const auto* node_animation = animation->mChannels[channel_i];
@@ -344,7 +612,7 @@ std::shared_ptr<MeshHierarchy<VertexData>> ModelLoader::load_hierarchy_from_file
         for (auto mesh_i = 0u; mesh_i < node->mNumMeshes; ++mesh_i) {
             hierarchy_node.meshes.push_back(mesh_index_map[node->mMeshes[mesh_i]]);
         }
-        const auto& bones = mesh_hierarchy->total_bones[node->mName.C_Str()];
+        const auto& bones = mesh_hierarchy.total_bones[node->mName.C_Str()];
         hierarchy_node.bones.insert(hierarchy_node.bones.end(), bones.begin(), bones.end());
 
         const auto animation = animations.find(node->mName.C_Str());
@@ -353,15 +621,15 @@ std::shared_ptr<MeshHierarchy<VertexData>> ModelLoader::load_hierarchy_from_file
                 auto& animation_data = hierarchy_node.animation_data[animation_id];
                 for (auto i = 0u; i < node_animation->mNumPositionKeys; ++i) {
                     const auto& key = node_animation->mPositionKeys[i];
-                    animation_data.positions[key.mTime] = glm::vec3{key.mValue.x, key.mValue.y, key.mValue.z};
+                    animation_data.positions.insert((float) key.mTime, glm::vec3{key.mValue.x, key.mValue.y, key.mValue.z});
                 }
                 for (auto i = 0u; i < node_animation->mNumRotationKeys; ++i) {
                     const auto& key = node_animation->mRotationKeys[i];
-                    animation_data.rotations[key.mTime] = glm::quat{key.mValue.w, key.mValue.x, key.mValue.y, key.mValue.z};
+                    animation_data.rotations.insert((float) key.mTime, glm::quat{key.mValue.w, key.mValue.x, key.mValue.y, key.mValue.z});
                 }
                 for (auto i = 0u; i < node_animation->mNumScalingKeys; ++i) {
                     const auto& key = node_animation->mScalingKeys[i];
-                    animation_data.scalings[key.mTime] = glm::vec3{key.mValue.x, key.mValue.y, key.mValue.z};
+                    animation_data.scalings.insert((float) key.mTime, glm::vec3{key.mValue.x, key.mValue.y, key.mValue.z});
                 }
             }
         }
@@ -372,13 +640,37 @@ std::shared_ptr<MeshHierarchy<VertexData>> ModelLoader::load_hierarchy_from_file
         }
     };
 
-    load_hierarchy_node(scene->mRootNode, mesh_hierarchy->root_node);
+    load_hierarchy_node(scene->mRootNode, mesh_hierarchy.root_node);
+    write_hierarchy_tree(writer, mesh_hierarchy.total_bones, mesh_hierarchy.animations, mesh_hierarchy.root_node);
 
     importer.FreeScene();
+}
 
-    hierarchy_cache[{file, std::type_index(typeid(VertexData))}] = {last_write_time, mesh_hierarchy};
+template<typename VertexData>
+void ModelLoader::read_hierarchy(BinaryReader& reader, MeshHierarchy<VertexData>& mesh_hierarchy) {
+    auto mesh_count = reader.read<uint64_t>();
+    if (mesh_count == 0) {
+        throw std::runtime_error("Cache entry has no meshes");
+    }
+    for (uint64_t i = 0; i < mesh_count; ++i) {
+        auto model = read_model<VertexData>(reader, std::nullopt);
+        mesh_hierarchy.meshes.push_back(ModelInfo{model, read_bone_names(reader)});
+    }
 
-    return mesh_hierarchy;
+    read_hierarchy_tree(reader, mesh_hierarchy.total_bones, mesh_hierarchy.animations, mesh_hierarchy.root_node);
+
+    // Every node's meshes index into the meshes that were just read
+    std::function<void(const MeshHierarchyNode& node)> check_node = [&check_node, &mesh_hierarchy](const MeshHierarchyNode& node) {
+        for (auto mesh_id: node.meshes) {
+            if (mesh_id >= mesh_hierarchy.meshes.size()) {
+                throw std::runtime_error("Cache entry has a node with a mesh that doesn't exist");
+            }
+        }
+        for (const auto& child: node.children) {
+            check_node(child);
+        }
+    };
+    check_node(mesh_hierarchy.root_node);
 }
 
 template<typename VertexData>
@@ -395,7 +687,7 @@ bool ModelLoader::add_imgui_model_selector(const std::string& caption, std::shar
             const bool is_selected = model_handle->get_filename().has_value() && current_selection == model;
             if (ImGui::Selectable(model.c_str(), is_selected)) {
                 try {
-                    model_handle = load_from_file<VertexData>(model);
+                    model_handle = load_from_file_async<VertexData>(model);
                     changed = true;
                 } catch (const std::exception& e) {
                     std::cerr << "Error while trying to update model file:" << std::endl;
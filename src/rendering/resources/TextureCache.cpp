@@ -0,0 +1,187 @@
+#include "TextureCache.h"
+
+#include <array>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#include "BlockCompression.h"
+#include "utility/Hash.h"
+#include "utility/MappedFile.h"
+
+// See the KTX 2.0 specification: https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html
+static constexpr std::array<unsigned char, 12> KTX2_IDENTIFIER = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+static constexpr uint32_t VK_FORMAT_BC1_RGB_UNORM_BLOCK = 131;
+static constexpr uint32_t VK_FORMAT_BC1_RGB_SRGB_BLOCK = 132;
+// The identifier, then 9 uint32 of the texture's layout, then the offsets and lengths of the data format descriptor,
+// key/value data and supercompression data
+static constexpr size_t KTX2_HEADER_SIZE = 80;
+// (byte_offset, byte_length, uncompressed_byte_length) of each level
+static constexpr size_t KTX2_LEVEL_INDEX_SIZE = 24;
+// The smallest data format descriptor that describes BC1, a basic block with a single sample
+static constexpr uint32_t DFD_SIZE = 44;
+
+template<typename T>
+static void append(std::vector<unsigned char>& bytes, T value) {
+    const auto* first = reinterpret_cast<const unsigned char*>(&value);
+    bytes.insert(bytes.end(), first, first + sizeof(T));
+}
+
+template<typename T>
+static T read(const std::byte* data, size_t offset) {
+    T value;
+    std::memcpy(&value, data + offset, sizeof(T));
+    return value;
+}
+
+TextureCache::TextureCache(std::filesystem::path cache_path) : cache_path(std::move(cache_path)) {}
+
+uint64_t TextureCache::key(const std::filesystem::path& file, bool srgb, bool flip_vertical) {
+    uint64_t hash = Hash::hash_file(file);
+    uint8_t options[2] = {srgb, flip_vertical};
+    hash = Hash::hash_bytes(options, sizeof(options), hash);
+    return Hash::hash_bytes(&FORMAT_VERSION, sizeof(FORMAT_VERSION), hash);
+}
+
+std::optional<std::vector<TextureLevel>> TextureCache::find(uint64_t key, bool srgb) const {
+    if (cache_path.empty()) return std::nullopt;
+
+    auto path = entry_path(key);
+    std::error_code error{};
+    if (!std::filesystem::exists(path, error)) return std::nullopt;
+
+    MappedFile file(path);
+    const std::byte* data = file.data();
+    if (file.size() < KTX2_HEADER_SIZE || std::memcmp(data, KTX2_IDENTIFIER.data(), KTX2_IDENTIFIER.size()) != 0) {
+        throw std::runtime_error(Formatter() << "Texture cache entry is not a KTX2 file (" << path.string() << ")");
+    }
+
+    auto vk_format = read<uint32_t>(data, 12);
+    auto width = read<uint32_t>(data, 20);
+    auto height = read<uint32_t>(data, 24);
+    auto depth = read<uint32_t>(data, 28);
+    auto layer_count = read<uint32_t>(data, 32);
+    auto face_count = read<uint32_t>(data, 36);
+    auto level_count = read<uint32_t>(data, 40);
+    auto supercompression = read<uint32_t>(data, 44);
+    if (vk_format != (srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK) || width == 0 || height == 0 || depth != 0 ||
+        layer_count != 0 || face_count != 1 || level_count == 0 || level_count > 32 || supercompression != 0) {
+        throw std::runtime_error(Formatter() << "Texture cache entry is not a plain BC1 texture (" << path.string() << ")");
+    }
+    if (file.size() < KTX2_HEADER_SIZE + level_count * KTX2_LEVEL_INDEX_SIZE) {
+        throw std::runtime_error(Formatter() << "Texture cache entry is truncated (" << path.string() << ")");
+    }
+
+    std::vector<TextureLevel> levels(level_count);
+    for (uint32_t level = 0; level < level_count; ++level) {
+        size_t index_offset = KTX2_HEADER_SIZE + level * KTX2_LEVEL_INDEX_SIZE;
+        auto byte_offset = read<uint64_t>(data, index_offset);
+        auto byte_length = read<uint64_t>(data, index_offset + 8);
+
+        auto& texture_level = levels[level];
+        texture_level.width = std::max(width >> level, 1u);
+        texture_level.height = std::max(height >> level, 1u);
+        if (byte_length != BlockCompression::bc1_size(texture_level.width, texture_level.height) || byte_offset > file.size() || byte_length > file.size() - byte_offset) {
+            throw std::runtime_error(Formatter() << "Texture cache entry has a malformed level " << level << " (" << path.string() << ")");
+        }
+        const auto* first = reinterpret_cast<const unsigned char*>(data + byte_offset);
+        texture_level.data.assign(first, first + byte_length);
+    }
+    return levels;
+}
+
+void TextureCache::store(uint64_t key, bool srgb, const std::vector<TextureLevel>& levels) const {
+    if (cache_path.empty() || levels.empty()) return;
+
+    std::vector<unsigned char> bytes{};
+    bytes.insert(bytes.end(), KTX2_IDENTIFIER.begin(), KTX2_IDENTIFIER.end());
+    append<uint32_t>(bytes, srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK);
+    // type_size, which is 1 for block compressed formats
+    append<uint32_t>(bytes, 1);
+    append<uint32_t>(bytes, levels[0].width);
+    append<uint32_t>(bytes, levels[0].height);
+    // depth, layer_count and face_count, for a plain 2D texture
+    append<uint32_t>(bytes, 0);
+    append<uint32_t>(bytes, 0);
+    append<uint32_t>(bytes, 1);
+    append<uint32_t>(bytes, (uint32_t) levels.size());
+    // No supercompression
+    append<uint32_t>(bytes, 0);
+
+    auto dfd_offset = (uint32_t) (KTX2_HEADER_SIZE + levels.size() * KTX2_LEVEL_INDEX_SIZE);
+    append<uint32_t>(bytes, dfd_offset);
+    append<uint32_t>(bytes, DFD_SIZE);
+    // No key/value or supercompression data
+    append<uint32_t>(bytes, 0);
+    append<uint32_t>(bytes, 0);
+    append<uint64_t>(bytes, 0);
+    append<uint64_t>(bytes, 0);
+
+    // Level data follows the descriptor, aligned to the 8 byte blocks, and is stored smallest level first
+    size_t data_offset = (dfd_offset + DFD_SIZE + 7) / 8 * 8;
+    std::vector<uint64_t> level_offsets(levels.size());
+    for (size_t level = levels.size(); level-- > 0;) {
+        level_offsets[level] = data_offset;
+        data_offset += levels[level].data.size();
+    }
+    for (size_t level = 0; level < levels.size(); ++level) {
+        append<uint64_t>(bytes, level_offsets[level]);
+        append<uint64_t>(bytes, levels[level].data.size());
+        append<uint64_t>(bytes, levels[level].data.size());
+    }
+
+    // The data format descriptor: its total size, then a basic descriptor block for BC1 with one sample covering the block
+    append<uint32_t>(bytes, DFD_SIZE);
+    // Vendor (Khronos) and descriptor type (basic)
+    append<uint32_t>(bytes, 0);
+    // Version 2, and the block's size
+    append<uint16_t>(bytes, 2);
+    append<uint16_t>(bytes, DFD_SIZE - 4);
+    // Colour model BC1A, BT.709 primaries, the sRGB or linear transfer function, and no flags
+    append<uint8_t>(bytes, 128);
+    append<uint8_t>(bytes, 1);
+    append<uint8_t>(bytes, srgb ? 2 : 1);
+    append<uint8_t>(bytes, 0);
+    // 4x4x1x1 texel blocks (stored minus one), and 8 bytes in the only plane
+    for (uint8_t dimension: {3, 3, 0, 0}) append<uint8_t>(bytes, dimension);
+    for (uint8_t plane: {8, 0, 0, 0, 0, 0, 0, 0}) append<uint8_t>(bytes, plane);
+    // The sample: 64 bits from bit 0 (length stored minus one) of the colour channel, at the origin, over the full range
+    append<uint16_t>(bytes, 0);
+    append<uint8_t>(bytes, 63);
+    append<uint8_t>(bytes, 0);
+    append<uint32_t>(bytes, 0);
+    append<uint32_t>(bytes, 0);
+    append<uint32_t>(bytes, UINT32_MAX);
+
+    bytes.resize((bytes.size() + 7) / 8 * 8);
+    for (size_t level = levels.size(); level-- > 0;) {
+        bytes.insert(bytes.end(), levels[level].data.begin(), levels[level].data.end());
+    }
+
+    try {
+        std::filesystem::create_directories(cache_path);
+
+        // Written to the side then moved into place, so that a partly written entry is never found
+        auto path = entry_path(key);
+        auto temporary_path = path;
+        temporary_path += ".tmp";
+        {
+            std::ofstream out(temporary_path, std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char*>(bytes.data()), (std::streamsize) bytes.size());
+            if (!out) {
+                throw std::runtime_error(Formatter() << "Failed to write " << temporary_path.string());
+            }
+        }
+        std::filesystem::rename(temporary_path, path);
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to store texture cache entry:" << std::endl;
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+std::filesystem::path TextureCache::entry_path(uint64_t key) const {
+    std::string name = Formatter() << std::hex << std::setw(16) << std::setfill('0') << key << ".ktx2";
+    return cache_path / name;
+}
@@ -0,0 +1,41 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <filesystem>
+
+#include "utility/HelperTypes.h"
+
+/// One level of a texture's mip chain, as tightly packed RGB pixels, or as blocks once compressed
+struct TextureLevel {
+    uint width = 0;
+    uint height = 0;
+    std::vector<unsigned char> data{};
+};
+
+/// An on-disk cache of BC1 compressed textures (see BlockCompression), so that a texture is only compressed the first time it is loaded.
+/// Entries are KTX2 files, so they can be inspected with the usual tools, holding the whole mip chain. Like MeshCache, they are
+/// named by a key of the source file's contents and the options it was loaded with, so an edited file just gets a new entry.
+class TextureCache {
+    // Where the entries are kept, or empty to not cache at all
+    std::filesystem::path cache_path;
+public:
+    /// Bumped whenever how entries are produced changes, so that older entries are ignored and replaced
+    static constexpr uint32_t FORMAT_VERSION = 1;
+
+    explicit TextureCache(std::filesystem::path cache_path);
+
+    /// The key for the contents of file, loaded with the given options
+    static uint64_t key(const std::filesystem::path& file, bool srgb, bool flip_vertical);
+
+    /// The BC1 mip chain stored for key, or nothing if there isn't one. Throws if the entry is malformed.
+    [[nodiscard]] std::optional<std::vector<TextureLevel>> find(uint64_t key, bool srgb) const;
+    /// Write the BC1 mip chain for key, which any failure only gets reported for, since the cache is just an optimisation
+    void store(uint64_t key, bool srgb, const std::vector<TextureLevel>& levels) const;
+private:
+    [[nodiscard]] std::filesystem::path entry_path(uint64_t key) const;
+};
+
+#endif //TEXTURE_CACHE_H
@@ -2,8 +2,14 @@
 
 #include <glad/gl.h>
 
+#include "rendering/memory/TextureArray.h"
+
 TextureHandle::TextureHandle(uint texture_id, uint width, uint height, bool srgb, bool flipped, std::optional<std::string> filename) : texture_id(texture_id), width(width), height(height), srgb(srgb), flipped(flipped), filename(std::move(filename)) {}
 
+TextureHandle::TextureHandle(std::shared_ptr<TextureHandle> placeholder, bool srgb, bool flipped, std::optional<std::string> filename)
+    : texture_id(placeholder->texture_id), width(placeholder->width), height(placeholder->height), srgb(srgb), flipped(flipped), filename(std::move(filename)),
+      placeholder(std::move(placeholder)), sampled_array_id(this->placeholder->sampled_array_id), sampled_array_layer(this->placeholder->sampled_array_layer) {}
+
 uint TextureHandle::get_texture_id() const {
     return texture_id;
 }
@@ -20,6 +26,14 @@ uint TextureHandle::get_height() const {
     return height;
 }
 
+uint TextureHandle::get_array_id() const {
+    return sampled_array_id;
+}
+
+uint TextureHandle::get_array_layer() const {
+    return sampled_array_layer;
+}
+
 bool TextureHandle::is_srgb() const {
     return srgb;
 }
@@ -32,6 +46,12 @@ const std::optional<std::string>& TextureHandle::get_filename() const {
     return filename;
 }
 
+bool TextureHandle::is_loaded() const {
+    return placeholder == nullptr;
+}
+
 TextureHandle::~TextureHandle() {
-    glDeleteTextures(1, &texture_id);
+    // The placeholder's texture is its own to delete
+    if (placeholder == nullptr) glDeleteTextures(1, &texture_id);
+    if (texture_array != nullptr) texture_array->free(array_layer);
 }
@@ -2,14 +2,19 @@
 #define TEXTURE_HANDLE_H
 
 #include <string>
+#include <memory>
 #include <optional>
 
 #include <glm/glm.hpp>
 #include "utility/HelperTypes.h"
 
 class TextureLoader;
+class TextureArray;
 
 /// A class representing a handle to a loaded texture, also storing some of its configuration data.
+/// A texture still loading in the background (see TextureLoader::load_from_file_async) uses its placeholder's texture until
+/// the loader swaps in its own.
+/// Where texture arrays are supported, the texture is stored as a layer of one (see TextureArray), and its texture is a view of that layer.
 class TextureHandle : private NonCopyable {
     uint texture_id;
     uint width;
@@ -18,20 +23,37 @@ class TextureHandle : private NonCopyable {
     bool srgb = true;
     bool flipped = false;
     std::optional<std::string> filename{};
+    // While loading, the texture whose name is borrowed in the meantime, which also keeps it from being deleted
+    std::shared_ptr<TextureHandle> placeholder{};
+    // The texture array layer the texture is stored in, if it is in one, which is freed along with the handle
+    std::shared_ptr<TextureArray> texture_array{};
+    uint array_layer = 0;
+    // Where the texture is sampled from when drawn through its array. Stays as the placeholder's until every level has been
+    // uploaded, since unlike the view, the array can't be limited to sampling the levels uploaded so far
+    uint sampled_array_id = 0;
+    uint sampled_array_layer = 0;
 
     friend class TextureLoader;
 
 public:
     TextureHandle(uint texture_id, uint width, uint height, bool srgb = true, bool flipped = false, std::optional<std::string> filename = {});
+    /// A texture that is still loading, which uses placeholder's texture until then
+    TextureHandle(std::shared_ptr<TextureHandle> placeholder, bool srgb, bool flipped, std::optional<std::string> filename);
 
     [[nodiscard]] uint get_texture_id() const;
     [[nodiscard]] glm::uvec2 get_size() const;
     [[nodiscard]] uint get_width() const;
     [[nodiscard]] uint get_height() const;
+    /// The texture array to bind, as a GL_TEXTURE_2D_ARRAY, to sample the texture through a layer index instead, or 0 if it isn't in one
+    [[nodiscard]] uint get_array_id() const;
+    /// The layer of get_array_id holding the texture
+    [[nodiscard]] uint get_array_layer() const;
 
     [[nodiscard]] bool is_flipped() const;
     [[nodiscard]] bool is_srgb() const;
     [[nodiscard]] const std::optional<std::string>& get_filename() const;
+    /// Whether the handle has its own texture yet, rather than the placeholder's
+    [[nodiscard]] bool is_loaded() const;
 
     virtual ~TextureHandle();
 };
@@ -1,5 +1,8 @@
 #include "TextureLoader.h"
 
+#include <array>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 #include <filesystem>
 
@@ -8,10 +11,16 @@
 #include <stb/stb_image.h>
 #include <glad/gl.h>
 
+#include "BlockCompression.h"
+
 #define WHITE_TEXTURE_NAME "[WHITE]"
 #define BLACK_TEXTURE_NAME "[BLACK]"
 
-TextureLoader::TextureLoader(std::string import_path) : import_path(std::move(import_path)), special_names({WHITE_TEXTURE_NAME, BLACK_TEXTURE_NAME}) {
+TextureLoader::TextureLoader(std::string import_path, std::string cache_path) :
+    import_path(std::move(import_path)), texture_cache(std::move(cache_path)),
+    // sRGB textures need the sRGB variant of BC1, which is only defined once both extensions are present
+    compress(GLAD_GL_EXT_texture_compression_s3tc && GLAD_GL_EXT_texture_sRGB),
+    special_names({WHITE_TEXTURE_NAME, BLACK_TEXTURE_NAME}) {
     std::fill_n(default_white_texture_data, DEFAULT_TEXTURE_LEN, (unsigned char) 0xFF);
 }
 
@@ -22,6 +31,34 @@ float get_max_anisotropy() {
     return max_ani;
 }
 
+// Mip levels of sRGB textures are averaged in linear space, as glGenerateMipmap does, so that they don't darken
+static const std::array<float, 256>& srgb_to_linear_table() {
+    static const std::array<float, 256> table = []() {
+        std::array<float, 256> values{};
+        for (uint i = 0; i < 256; ++i) {
+            float c = (float) i / 255.0f;
+            values[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        return values;
+    }();
+    return table;
+}
+
+static unsigned char linear_to_srgb(float linear) {
+    // Finely enough spaced that every sRGB value is still reachable
+    static constexpr uint STEPS = 4096;
+    static const std::array<unsigned char, STEPS + 1> table = []() {
+        std::array<unsigned char, STEPS + 1> values{};
+        for (uint i = 0; i <= STEPS; ++i) {
+            float c = (float) i / STEPS;
+            float srgb = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+            values[i] = (unsigned char) std::lround(srgb * 255.0f);
+        }
+        return values;
+    }();
+    return table[(uint) std::lround(std::clamp(linear, 0.0f, 1.0f) * STEPS)];
+}
+
 std::shared_ptr<TextureHandle> TextureLoader::load_from_file(const std::string& file, bool srgb, bool flip_vertical) {
     if (file == WHITE_TEXTURE_NAME) {
         auto white = default_white_texture();
@@ -40,9 +77,132 @@ std::shared_ptr<TextureHandle> TextureLoader::load_from_file(const std::string&
         throw std::runtime_error(Formatter() << "Failed to load texture file: " << full_path << "\n\t Reason: File does not exist");
     }
 
-    static float max_ani = get_max_anisotropy();
     auto last_write_time = std::filesystem::last_write_time(full_path);
 
+    auto existing = find_loaded(file, srgb, flip_vertical, last_write_time);
+    if (existing != nullptr) {
+        return existing;
+    }
+
+    // The mip chain is built on the CPU, since compressed textures and texture array layers can't be given one with glGenerateMipmap
+    auto levels = load_levels(full_path, srgb, flip_vertical);
+    auto texture = std::make_shared<TextureHandle>(0, 0, 0, srgb, flip_vertical, file);
+    create_texture(*texture, levels, srgb, compress, true);
+
+    cache[{file, srgb, flip_vertical}] = {last_write_time, texture};
+
+    return texture;
+}
+
+std::shared_ptr<TextureHandle> TextureLoader::load_from_file_async(const std::string& file, bool srgb, bool flip_vertical) {
+    if (special_names.count(file) != 0) {
+        return load_from_file(file, srgb, flip_vertical);
+    }
+
+    std::string full_path = import_path + "/" + file;
+
+    if (!std::filesystem::exists(full_path)) {
+        throw std::runtime_error(Formatter() << "Failed to load texture file: " << full_path << "\n\t Reason: File does not exist");
+    }
+
+    auto last_write_time = std::filesystem::last_write_time(full_path);
+
+    // Also finds textures that are still loading, so that a file is only loaded once
+    auto existing = find_loaded(file, srgb, flip_vertical, last_write_time);
+    if (existing != nullptr) {
+        return existing;
+    }
+
+    auto texture = std::make_shared<TextureHandle>(default_white_texture(), srgb, flip_vertical, file);
+    cache[{file, srgb, flip_vertical}] = {last_write_time, texture};
+
+    DecodedTexture decoded{texture, file, srgb, flip_vertical};
+    background_pool.submit([this, full_path, decoded = std::move(decoded)]() mutable {
+        // Nothing wants the texture any more
+        if (decoded.texture.expired()) return;
+
+        try {
+            decoded.levels = load_levels(full_path, decoded.srgb, decoded.flip_vertical);
+            decoded.compressed = compress;
+            decoded.next_level = (int) decoded.levels.size() - 1;
+        } catch (const std::exception& e) {
+            decoded.error = e.what();
+        }
+        decoded_textures.push(std::move(decoded));
+    });
+
+    return texture;
+}
+
+void TextureLoader::process_uploads(size_t byte_budget) {
+    for (auto& decoded: decoded_textures.take_all()) {
+        uploading_textures.push_back(std::move(decoded));
+    }
+    if (uploading_textures.empty()) return;
+
+    if (upload_ring == nullptr) {
+        upload_ring = std::make_unique<PixelUploadRing>();
+    }
+
+    // Rows of RGB pixels are tightly packed
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    size_t uploaded = 0;
+    while (!uploading_textures.empty() && uploaded < byte_budget && upload_ring->ready()) {
+        auto& decoded = uploading_textures.front();
+        auto texture = decoded.texture.lock();
+        if (texture == nullptr || !decoded.error.empty()) {
+            if (!decoded.error.empty()) {
+                std::cerr << "Failed to load texture (" << decoded.file << ") in the background:" << std::endl;
+                std::cerr << decoded.error << std::endl;
+                forget(decoded);
+            }
+            uploading_textures.pop_front();
+            continue;
+        }
+
+        if (!texture->is_loaded()) {
+            create_texture(*texture, decoded.levels, decoded.srgb, decoded.compressed, false);
+            // Only the smallest level is uploaded first, so only it can be sampled
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, (int) decoded.levels.size() - 1);
+            texture->placeholder = nullptr;
+        }
+
+        const auto& level = decoded.levels[decoded.next_level];
+        // Uploaded in bands of whole rows, or whole rows of 4x4 blocks once compressed
+        uint band_height = decoded.compressed ? 4 : 1;
+        size_t band_size = decoded.compressed ? BlockCompression::bc1_size(level.width, 1) : level.width * 3;
+        uint bands_left = (level.height - decoded.next_row + band_height - 1) / band_height;
+        // As many bands as fit in what is left of the budget, but always at least one
+        uint bands = std::clamp((uint) ((byte_budget - uploaded) / band_size), 1u, bands_left);
+        uint rows = std::min(bands * band_height, level.height - decoded.next_row);
+        const unsigned char* data = &level.data[decoded.next_row / band_height * band_size];
+
+        glBindTexture(GL_TEXTURE_2D, texture->texture_id);
+        if (decoded.compressed) {
+            upload_ring->upload_compressed(decoded.next_level, (int) decoded.next_row, (int) level.width, (int) rows, compressed_format(decoded.srgb), data, bands * band_size);
+        } else {
+            upload_ring->upload(decoded.next_level, (int) decoded.next_row, (int) level.width, (int) rows, GL_RGB, data, bands * band_size);
+        }
+        uploaded += bands * band_size;
+        decoded.next_row += rows;
+
+        if (decoded.next_row == level.height) {
+            // Sample from the finished level, now that every level from it down is in
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, decoded.next_level);
+            decoded.next_row = 0;
+            if (--decoded.next_level < 0) {
+                sample_own_array_layer(*texture);
+                uploading_textures.pop_front();
+            }
+        }
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+std::shared_ptr<TextureHandle> TextureLoader::find_loaded(const std::string& file, bool srgb, bool flip_vertical, std::filesystem::file_time_type last_write_time) {
     auto existing = cache.find({file, srgb, flip_vertical});
     if (existing != cache.end()) {
         // Cache exist, so try lock
@@ -52,76 +212,207 @@ std::shared_ptr<TextureHandle> TextureLoader::load_from_file(const std::string&
             return handle;
         }
     }
+    return nullptr;
+}
+
+void TextureLoader::create_texture(TextureHandle& texture, const std::vector<TextureLevel>& levels, bool srgb, bool compressed, bool upload_levels) {
+    static float max_ani = get_max_anisotropy();
+
+    auto level_count = (int) levels.size();
+    uint internal_format = compressed ? compressed_format(srgb) : srgb ? GL_SRGB8 : GL_RGB8;
+    texture.width = levels[0].width;
+    texture.height = levels[0].height;
+
+    if (TextureArray::is_supported()) {
+        auto [texture_array, layer] = allocate_array_layer(texture.width, texture.height, level_count, internal_format, max_ani);
+        texture.texture_id = texture_array->create_view(layer);
+        texture.texture_array = std::move(texture_array);
+        texture.array_layer = layer;
+    } else {
+        glGenTextures(1, &texture.texture_id);
+        glBindTexture(GL_TEXTURE_2D, texture.texture_id);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY, max_ani);
+
+        // Every level is allocated up front, so the texture is complete whichever levels have been filled in so far
+        for (int level = 0; level < level_count; ++level) {
+            const auto& image = levels[level];
+            if (compressed) {
+                glCompressedTexImage2D(GL_TEXTURE_2D, level, internal_format, (int) image.width, (int) image.height, 0, (int) image.data.size(), nullptr);
+            } else {
+                glTexImage2D(GL_TEXTURE_2D, level, internal_format, (int) image.width, (int) image.height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+            }
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level_count - 1);
+    }
 
-    stbi_set_flip_vertically_on_load(flip_vertical);
+    if (!upload_levels) return;
 
+    // Rows of RGB pixels are tightly packed
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int level = 0; level < level_count; ++level) {
+        const auto& image = levels[level];
+        if (compressed) {
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, (int) image.width, (int) image.height, internal_format, (int) image.data.size(), image.data.data());
+        } else {
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, (int) image.width, (int) image.height, GL_RGB, GL_UNSIGNED_BYTE, image.data.data());
+        }
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    sample_own_array_layer(texture);
+}
+
+std::pair<std::shared_ptr<TextureArray>, uint> TextureLoader::allocate_array_layer(uint width, uint height, uint level_count, uint internal_format, float anisotropy) {
+    // Arrays that no texture has a layer of any more are only held on to here
+    texture_arrays.erase(std::remove_if(texture_arrays.begin(), texture_arrays.end(), [](const std::shared_ptr<TextureArray>& texture_array) {
+        return texture_array.use_count() == 1;
+    }), texture_arrays.end());
+
+    uint layer_count = MIN_ARRAY_LAYERS;
+    for (const auto& texture_array: texture_arrays) {
+        if (!texture_array->matches(width, height, level_count, internal_format)) continue;
+        if (auto layer = texture_array->allocate()) {
+            return {texture_array, layer.value()};
+        }
+        layer_count = std::min(std::max(layer_count, texture_array->get_layer_count() * 2), MAX_ARRAY_LAYERS);
+    }
+
+    // Grown geometrically, so that a lone texture doesn't take up a large array, but a common size still ends up in few of them
+    auto texture_array = std::make_shared<TextureArray>(width, height, level_count, internal_format, layer_count, anisotropy);
+    texture_arrays.push_back(texture_array);
+    return {texture_array, texture_array->allocate().value()};
+}
+
+void TextureLoader::sample_own_array_layer(TextureHandle& texture) {
+    if (texture.texture_array == nullptr) return;
+    texture.sampled_array_id = texture.texture_array->get_texture_id();
+    texture.sampled_array_layer = texture.array_layer;
+}
+
+void TextureLoader::forget(const DecodedTexture& decoded) {
+    auto existing = cache.find({decoded.file, decoded.srgb, decoded.flip_vertical});
+    if (existing != cache.end() && existing->second.second.lock() == decoded.texture.lock()) {
+        cache.erase(existing);
+    }
+}
+
+TextureLevel TextureLoader::decode_image(const std::string& full_path, bool flip_vertical) {
+    // Flipped here rather than by stb, since its flip setting is shared by every thread
     int width, height;
     stbi_uc* data = stbi_load(full_path.c_str(), &width, &height, nullptr, STBI_rgb);
     if (!data) {
         throw std::runtime_error(Formatter() << "Failed to load texture file: " << full_path << "\n\t Reason: " << stbi_failure_reason());
     }
 
-    uint texture_id;
-    glGenTextures(1, &texture_id);
-    glBindTexture(GL_TEXTURE_2D, texture_id);
+    TextureLevel image{(uint) width, (uint) height, {}};
+    size_t row_size = image.width * 3;
+    image.data.resize(row_size * image.height);
+    for (uint y = 0; y < image.height; ++y) {
+        uint source_row = flip_vertical ? image.height - 1 - y : y;
+        std::memcpy(&image.data[y * row_size], &data[source_row * row_size], row_size);
+    }
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY, max_ani);
+    stbi_image_free(data);
+    return image;
+}
 
-    glTexImage2D(GL_TEXTURE_2D, 0, srgb ? GL_SRGB : GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
+std::vector<TextureLevel> TextureLoader::build_mip_chain(TextureLevel image, bool srgb) {
+    const auto& to_linear = srgb_to_linear_table();
+
+    std::vector<TextureLevel> levels{};
+    levels.push_back(std::move(image));
+    while (levels.back().width > 1 || levels.back().height > 1) {
+        const auto& source = levels.back();
+        TextureLevel level{std::max(source.width / 2, 1u), std::max(source.height / 2, 1u), {}};
+        level.data.resize(level.width * level.height * 3);
+
+        for (uint y = 0; y < level.height; ++y) {
+            // The 2x2 block of the level above, clamped for a side that is already 1 pixel
+            uint y0 = std::min(y * 2, source.height - 1);
+            uint y1 = std::min(y * 2 + 1, source.height - 1);
+            for (uint x = 0; x < level.width; ++x) {
+                uint x0 = std::min(x * 2, source.width - 1);
+                uint x1 = std::min(x * 2 + 1, source.width - 1);
+                const unsigned char* block[4] = {
+                    &source.data[(y0 * source.width + x0) * 3],
+                    &source.data[(y0 * source.width + x1) * 3],
+                    &source.data[(y1 * source.width + x0) * 3],
+                    &source.data[(y1 * source.width + x1) * 3],
+                };
+                unsigned char* destination = &level.data[(y * level.width + x) * 3];
+                for (uint channel = 0; channel < 3; ++channel) {
+                    if (srgb) {
+                        float sum = to_linear[block[0][channel]] + to_linear[block[1][channel]] + to_linear[block[2][channel]] + to_linear[block[3][channel]];
+                        destination[channel] = linear_to_srgb(sum * 0.25f);
+                    } else {
+                        uint sum = block[0][channel] + block[1][channel] + block[2][channel] + block[3][channel];
+                        destination[channel] = (unsigned char) ((sum + 2) / 4);
+                    }
+                }
+            }
+        }
+        levels.push_back(std::move(level));
+    }
+    return levels;
+}
 
-    stbi_image_free(data);
+std::vector<TextureLevel> TextureLoader::load_levels(const std::string& full_path, bool srgb, bool flip_vertical) const {
+    if (!compress) {
+        return build_mip_chain(decode_image(full_path, flip_vertical), srgb);
+    }
 
-    auto texture = std::make_shared<TextureHandle>(texture_id, width, height, srgb, flip_vertical, file);
+    auto cache_key = TextureCache::key(full_path, srgb, flip_vertical);
+    try {
+        if (auto levels = texture_cache.find(cache_key, srgb)) {
+            return std::move(levels.value());
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to read texture cache entry, compressing (" << full_path << ") instead:" << std::endl;
+        std::cerr << e.what() << std::endl;
+    }
 
-    cache[{file, srgb, flip_vertical}] = {last_write_time, texture};
+    auto levels = build_mip_chain(decode_image(full_path, flip_vertical), srgb);
+    for (auto& level: levels) {
+        level.data = BlockCompression::encode_bc1(level.data.data(), level.width, level.height);
+    }
+    texture_cache.store(cache_key, srgb, levels);
+    return levels;
+}
 
-    return texture;
+uint TextureLoader::compressed_format(bool srgb) {
+    return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
 }
 
 std::shared_ptr<TextureHandle> TextureLoader::default_white_texture() {
     if (default_white_texture_cache != nullptr) return default_white_texture_cache;
 
-    uint texture_id;
-    glGenTextures(1, &texture_id);
-    glBindTexture(GL_TEXTURE_2D, texture_id);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, DEFAULT_TEXTURE_SIZE, DEFAULT_TEXTURE_SIZE, 0, GL_RGB, GL_UNSIGNED_BYTE, &default_white_texture_data[0]);
-
-    default_white_texture_cache = std::make_shared<TextureHandle>(texture_id, DEFAULT_TEXTURE_SIZE, DEFAULT_TEXTURE_SIZE, false, false, WHITE_TEXTURE_NAME);
+    // A single level, since it is a solid colour
+    std::vector<TextureLevel> levels{{DEFAULT_TEXTURE_SIZE, DEFAULT_TEXTURE_SIZE, {default_white_texture_data, default_white_texture_data + DEFAULT_TEXTURE_LEN}}};
+    default_white_texture_cache = std::make_shared<TextureHandle>(0, 0, 0, false, false, WHITE_TEXTURE_NAME);
+    create_texture(*default_white_texture_cache, levels, false, false, true);
     return default_white_texture_cache;
 }
 
 std::shared_ptr<TextureHandle> TextureLoader::default_black_texture() {
     if (default_black_texture_cache != nullptr) return default_black_texture_cache;
 
-    uint texture_id;
-    glGenTextures(1, &texture_id);
-    glBindTexture(GL_TEXTURE_2D, texture_id);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, DEFAULT_TEXTURE_SIZE, DEFAULT_TEXTURE_SIZE, 0, GL_RGB, GL_UNSIGNED_BYTE, &default_black_texture_data[0]);
-
-    default_black_texture_cache = std::make_shared<TextureHandle>(texture_id, DEFAULT_TEXTURE_SIZE, DEFAULT_TEXTURE_SIZE, false, false, BLACK_TEXTURE_NAME);
+    // A single level, since it is a solid colour
+    std::vector<TextureLevel> levels{{DEFAULT_TEXTURE_SIZE, DEFAULT_TEXTURE_SIZE, {default_black_texture_data, default_black_texture_data + DEFAULT_TEXTURE_LEN}}};
+    default_black_texture_cache = std::make_shared<TextureHandle>(0, 0, 0, false, false, BLACK_TEXTURE_NAME);
+    create_texture(*default_black_texture_cache, levels, false, false, true);
     return default_black_texture_cache;
 }
 
 void TextureLoader::cleanup() {
+    uploading_textures.clear();
+    upload_ring = nullptr;
     default_black_texture_cache = nullptr;
     default_white_texture_cache = nullptr;
+    texture_arrays.clear();
 }
 
 void TextureLoader::add_imgui_texture_selector(const std::string& caption, std::shared_ptr<TextureHandle>& texture_handle, bool prefer_srgb) {
@@ -144,7 +435,7 @@ void TextureLoader::add_imgui_texture_selector(const std::string& caption, std::
 
     if (update_param && is_file) {
         try {
-            texture_handle = load_from_file(texture_handle->get_filename().value(), is_rgb, is_flipped);
+            texture_handle = load_from_file_async(texture_handle->get_filename().value(), is_rgb, is_flipped);
         } catch (const std::exception& e) {
             std::cerr << "Error while trying to update texture parameters:" << std::endl;
             std::cerr << e.what() << std::endl;
@@ -169,7 +460,7 @@ void TextureLoader::add_imgui_texture_selector(const std::string& caption, std::
                 bool was_flipped = texture_handle->is_flipped();
                 bool was_special = texture_handle->filename.has_value() && special_names.count(texture_handle->filename.value()) != 0;
                 try {
-                    texture_handle = load_from_file(texture, was_srgb || (prefer_srgb && was_special), was_flipped);
+                    texture_handle = load_from_file_async(texture, was_srgb || (prefer_srgb && was_special), was_flipped);
                 } catch (const std::exception& e) {
                     std::cerr << "Error while trying to update texture file:" << std::endl;
                     std::cerr << e.what() << std::endl;
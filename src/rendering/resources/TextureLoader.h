@@ -1,6 +1,7 @@
 #ifndef TEXTURE_LOADER_H
 #define TEXTURE_LOADER_H
 
+#include <deque>
 #include <string>
 #include <vector>
 #include <memory>
@@ -11,10 +12,19 @@
 #include <unordered_map>
 
 #include "TextureHandle.h"
+#include "TextureCache.h"
+#include "rendering/memory/PixelUploadRing.h"
+#include "rendering/memory/TextureArray.h"
+#include "utility/BackgroundPool.h"
+#include "utility/CompletionQueue.h"
 
 /// A loader class intended for the use of loading textures from disk. Includes caching functionality.
 class TextureLoader {
     std::string import_path;
+    // Compressed mip chains from previous runs, so that each texture is only compressed once
+    TextureCache texture_cache;
+    // Whether textures are block compressed (see BlockCompression), which needs S3TC support
+    bool compress;
 
     static constexpr int DEFAULT_TEXTURE_SIZE = 16;
     static constexpr int DEFAULT_TEXTURE_BPP = 3;
@@ -30,14 +40,61 @@ class TextureLoader {
 
     // Map (relative_path, srgb, is_flipped) -> (last_modified, weak_handle)
     std::unordered_map<std::tuple<std::string, bool, bool>, std::pair<std::filesystem::file_time_type, std::weak_ptr<TextureHandle>>, TripleHash> cache{};
+
+    // The arrays textures are given layers of, where supported, so that instanced draws with different textures can share a call
+    std::vector<std::shared_ptr<TextureArray>> texture_arrays{};
+    // The first array for a size and format has this many layers, and each one after twice as many as the last, up to the max.
+    // Starting at one means a texture whose size and format no other shares costs no more memory than it would on its own.
+    static constexpr uint MIN_ARRAY_LAYERS = 1;
+    static constexpr uint MAX_ARRAY_LAYERS = 64;
+
+    /// A texture decoded on a worker, along with its whole mip chain, which process_uploads uploads a piece at a time
+    struct DecodedTexture {
+        std::weak_ptr<TextureHandle> texture{};
+        std::string file{};
+        bool srgb = true;
+        bool flip_vertical = false;
+        // [level] -> image, from full size down to 1x1. Empty if decoding failed
+        std::vector<TextureLevel> levels{};
+        // Whether the levels are BC1 blocks rather than RGB pixels
+        bool compressed = false;
+        // Why decoding failed
+        std::string error{};
+        // Levels are uploaded smallest first, so that the texture can be used as soon as the first is in
+        int next_level = 0;
+        uint next_row = 0;
+    };
+    // Pushed to by the workers as each texture is decoded
+    CompletionQueue<DecodedTexture> decoded_textures{};
+    // Taken from decoded_textures, and uploaded in order
+    std::deque<DecodedTexture> uploading_textures{};
+    // Created on first use, since it needs the GL context
+    std::unique_ptr<PixelUploadRing> upload_ring{};
+    // Declared last, so that the workers stop before anything they use is destroyed
+    BackgroundPool background_pool{};
 public:
+    // Bytes of pixels process_uploads uploads per frame by default
+    static constexpr size_t DEFAULT_UPLOAD_BUDGET = 8 * 1024 * 1024;
+    static constexpr const char* DEFAULT_CACHE_PATH = "cache/textures";
+
     /// Construct the loader with a import_path which is prepended to any path you try and load.
     /// It also scans the directory for all files, which is used to populate the list of get_available_textures()
-    explicit TextureLoader(std::string import_path);
+    /// Where supported, textures are compressed to BC1 when first loaded, and kept compressed in cache_path (see TextureCache),
+    /// or compressed on every load if it is empty. Requires the OpenGL functions to have been loaded.
+    explicit TextureLoader(std::string import_path, std::string cache_path = DEFAULT_CACHE_PATH);
 
     /// Loads the file at the specified path into GPU memory, with flags for if the texture is sRGB and to flip it vertically.
     std::shared_ptr<TextureHandle> load_from_file(const std::string& file, bool srgb = true, bool flip_vertical = false);
 
+    /// Start loading the file on a worker thread, returning a handle straight away which uses the default white texture until
+    /// process_uploads has uploaded enough of the real one. A failed load is reported then, and leaves the white texture in place.
+    std::shared_ptr<TextureHandle> load_from_file_async(const std::string& file, bool srgb = true, bool flip_vertical = false);
+
+    /// Upload the textures that have finished decoding in the background, a few rows at a time through a ring of pixel buffers,
+    /// stopping once byte_budget has been used (or no buffer is free). Textures are uploaded from the smallest mip level up, and
+    /// swapped in once the first level is, so they sharpen over the following frames. Call once a frame, on the GL thread.
+    void process_uploads(size_t byte_budget = DEFAULT_UPLOAD_BUDGET);
+
     /// Provides a pure white (0xFFFFFF) texture
     std::shared_ptr<TextureHandle> default_white_texture();
     /// Provides a pure black (0x000000) texture
@@ -52,6 +109,27 @@ public:
 
     /// Free up any resources.
     void cleanup();
+private:
+    /// The loaded texture for the key, if it is still in use and up-to-date
+    std::shared_ptr<TextureHandle> find_loaded(const std::string& file, bool srgb, bool flip_vertical, std::filesystem::file_time_type last_write_time);
+    /// Give the texture storage for every level, in a texture array layer where supported, filling them in if upload_levels
+    /// is set, else leaving that to process_uploads. Leaves the texture bound to GL_TEXTURE_2D.
+    void create_texture(TextureHandle& texture, const std::vector<TextureLevel>& levels, bool srgb, bool compressed, bool upload_levels);
+    /// A free layer of an array for textures of this size and format, creating a new array if they are all full
+    std::pair<std::shared_ptr<TextureArray>, uint> allocate_array_layer(uint width, uint height, uint level_count, uint internal_format, float anisotropy);
+    /// Have the texture sampled through its own array layer, once every level of it has been uploaded
+    static void sample_own_array_layer(TextureHandle& texture);
+    /// The whole mip chain of the file, BC1 compressed if compress is set (from texture_cache if possible), else as RGB pixels.
+    /// Safe to call from any thread.
+    [[nodiscard]] std::vector<TextureLevel> load_levels(const std::string& full_path, bool srgb, bool flip_vertical) const;
+    /// Decode the image file as RGB, throwing if it can't be. Safe to call from any thread.
+    static TextureLevel decode_image(const std::string& full_path, bool flip_vertical);
+    /// The image followed by each of its mip levels, down to 1x1, filtered in linear space if it is sRGB
+    static std::vector<TextureLevel> build_mip_chain(TextureLevel image, bool srgb);
+    /// The BC1 format for a texture
+    static uint compressed_format(bool srgb);
+    /// Forget the failed texture, so that loading the file again tries again rather than getting the placeholder
+    void forget(const DecodedTexture& decoded);
 };
 
 
@@ -1,25 +1,203 @@
 #include "Animator.h"
 
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define ANIMATOR_SSE2
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define ANIMATOR_NEON
+#endif
+
 void Animator::animate(double dt) {
-    std::vector<std::shared_ptr<AnimatedEntityInterface>> to_remove{};
-
-    for (auto& item: animated_entities) {
-        if (item.second.paused) continue;
-
-        auto& time = item.first->get_animation_time_seconds();
-        auto dur = item.first->get_animation_duration_seconds();
-        time += dt * item.second.speed;
-        if (time > dur) {
-            if (item.second.loop && dur > 0) {
-                time = std::fmod(time, dur);
-            } else {
-                time = dur;
-                to_remove.push_back(item.first);
-            }
-        }
-    }
-
-    for (const auto& item: to_remove) {
-        animated_entities.erase(item);
+    size_t count = times.size();
+
+    // The times are gathered each frame, since they can also be set directly, such as by the editor's time slider
+    for (size_t i = 0; i < count; ++i) {
+        times[i] = *time_targets[i];
+    }
+
+    // Each entity works out both the wrapped and the clamped time, then picks, so there are no branches.
+    // Paused entities (a rate of 0) keep their time as it is, even past the end, such as the editor's slider can leave it.
+    size_t i = 0;
+#if defined(ANIMATOR_SSE2)
+    __m128d dt_lanes = _mm_set1_pd(dt);
+    __m128d zero = _mm_setzero_pd();
+    for (; i + 2 <= count; i += 2) {
+        __m128d rate = _mm_loadu_pd(&rates[i]);
+        __m128d time = _mm_add_pd(_mm_loadu_pd(&times[i]), _mm_mul_pd(dt_lanes, rate));
+        __m128d duration = _mm_loadu_pd(&durations[i]);
+        // Truncating is flooring here, since wrapped is only picked for a time past a positive duration
+        __m128d loops = _mm_cvtepi32_pd(_mm_cvttpd_epi32(_mm_div_pd(time, duration)));
+        __m128d wrapped = _mm_sub_pd(time, _mm_mul_pd(duration, loops));
+
+        __m128d past_end = _mm_and_pd(_mm_cmpgt_pd(time, duration), _mm_cmpneq_pd(rate, zero));
+        __m128d wrap = _mm_castsi128_pd(_mm_set_epi64x(-(int64_t) wraps[i + 1], -(int64_t) wraps[i]));
+        __m128d end = _mm_or_pd(_mm_and_pd(wrap, wrapped), _mm_andnot_pd(wrap, duration));
+        _mm_storeu_pd(&times[i], _mm_or_pd(_mm_and_pd(past_end, end), _mm_andnot_pd(past_end, time)));
+
+        int done = _mm_movemask_pd(_mm_andnot_pd(wrap, past_end));
+        finished[i] = (uint8_t) (done & 1);
+        finished[i + 1] = (uint8_t) ((done >> 1) & 1);
+    }
+#elif defined(ANIMATOR_NEON)
+    for (; i + 2 <= count; i += 2) {
+        float64x2_t rate = vld1q_f64(&rates[i]);
+        float64x2_t time = vfmaq_n_f64(vld1q_f64(&times[i]), rate, dt);
+        float64x2_t duration = vld1q_f64(&durations[i]);
+        float64x2_t wrapped = vfmsq_f64(time, duration, vrndmq_f64(vdivq_f64(time, duration)));
+
+        uint64x2_t past_end = vbicq_u64(vcgtq_f64(time, duration), vceqzq_f64(rate));
+        uint64_t wrap_lanes[2] = {wraps[i] ? UINT64_MAX : 0, wraps[i + 1] ? UINT64_MAX : 0};
+        uint64x2_t wrap = vld1q_u64(wrap_lanes);
+        float64x2_t end = vbslq_f64(wrap, wrapped, duration);
+        vst1q_f64(&times[i], vbslq_f64(past_end, end, time));
+
+        uint64x2_t done = vbicq_u64(past_end, wrap);
+        finished[i] = (uint8_t) (vgetq_lane_u64(done, 0) & 1);
+        finished[i + 1] = (uint8_t) (vgetq_lane_u64(done, 1) & 1);
+    }
+#endif
+
+    // Remainder, or everything if there is no SIMD support
+    for (; i < count; ++i) {
+        double time = times[i] + dt * rates[i];
+        double duration = durations[i];
+        bool past_end = time > duration && rates[i] != 0.0;
+        bool wrap = wraps[i] != 0;
+        double end = wrap ? time - duration * std::floor(time / duration) : duration;
+        times[i] = past_end ? end : time;
+        finished[i] = past_end && !wrap;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        *time_targets[i] = times[i];
+    }
+
+    // Backwards, so that the entity moved into each removed one's place has already been checked
+    for (size_t i = count; i-- > 0;) {
+        if (finished[i]) remove((uint) i);
+    }
+}
+
+void Animator::start(const std::shared_ptr<AnimatedEntityInterface>& animated_entity, const AnimationParameters& animation_parameters) {
+    stop(animated_entity);
+    animated_entity->get_animation_id() = animation_parameters.animation_id;
+    animated_entity->get_animation_time_seconds() = 0.0;
+    insert(animated_entity, animation_parameters);
+}
+
+void Animator::update_param(const std::shared_ptr<AnimatedEntityInterface>& animated_entity, const AnimationParameters& animation_parameters) {
+    if (auto dense_index = find(*animated_entity)) {
+        set_parameters(*dense_index, animation_parameters);
+    }
+}
+
+void Animator::pause(const std::shared_ptr<AnimatedEntityInterface>& animated_entity) {
+    if (auto dense_index = find(*animated_entity)) {
+        parameters[*dense_index].paused = true;
+        rates[*dense_index] = 0.0;
+    }
+}
+
+void Animator::resume(const std::shared_ptr<AnimatedEntityInterface>& animated_entity, const AnimationParameters& animation_parameters) {
+    AnimationParameters resumed = animation_parameters;
+    if (auto dense_index = find(*animated_entity)) {
+        resumed.paused = false;
+        set_parameters(*dense_index, resumed);
+    } else {
+        animated_entity->get_animation_id() = animation_parameters.animation_id;
+        insert(animated_entity, resumed);
+    }
+}
+
+std::optional<AnimationParameters> Animator::is_animating(const std::shared_ptr<AnimatedEntityInterface>& animated_entity) const {
+    if (auto dense_index = find(*animated_entity)) {
+        return parameters[*dense_index];
+    }
+    return std::nullopt;
+}
+
+void Animator::stop(const std::shared_ptr<AnimatedEntityInterface>& animated_entity) {
+    animated_entity->get_animation_id() = NONE_ANIMATION;
+    animated_entity->get_animation_time_seconds() = 0.0;
+    if (auto dense_index = find(*animated_entity)) {
+        remove(*dense_index);
+    }
+}
+
+std::optional<uint> Animator::find(AnimatedEntityInterface& animated_entity) const {
+    const auto& [slot, generation] = animated_entity.get_animator_handle();
+    if (slot >= slots.size() || slots[slot].generation != generation) return std::nullopt;
+
+    // A copy of an entity also copies its handle, so check that the slot really is this entity's
+    uint dense_index = slots[slot].dense_index;
+    if (entities[dense_index].get() != &animated_entity) return std::nullopt;
+    return dense_index;
+}
+
+void Animator::insert(const std::shared_ptr<AnimatedEntityInterface>& animated_entity, const AnimationParameters& animation_parameters) {
+    uint slot;
+    if (free_slots.empty()) {
+        slot = (uint) slots.size();
+        slots.emplace_back();
+        // So that freeing slots in animate never needs to allocate
+        free_slots.reserve(slots.size());
+    } else {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    }
+
+    auto dense_index = (uint) entities.size();
+    slots[slot].dense_index = dense_index;
+    animated_entity->get_animator_handle() = AnimatorHandle{slot, slots[slot].generation};
+
+    entities.push_back(animated_entity);
+    parameters.emplace_back();
+    dense_slots.push_back(slot);
+    time_targets.push_back(&animated_entity->get_animation_time_seconds());
+    times.push_back(0.0);
+    rates.push_back(0.0);
+    durations.push_back(0.0);
+    wraps.push_back(0);
+    finished.push_back(0);
+    set_parameters(dense_index, animation_parameters);
+}
+
+void Animator::set_parameters(uint dense_index, const AnimationParameters& animation_parameters) {
+    auto& animated_entity = *entities[dense_index];
+    parameters[dense_index] = animation_parameters;
+    rates[dense_index] = animation_parameters.paused ? 0.0 : animation_parameters.speed;
+    // Read once here rather than every frame, since it only changes with the animation
+    durations[dense_index] = animated_entity.get_animation_duration_seconds();
+    wraps[dense_index] = animation_parameters.loop && durations[dense_index] > 0.0;
+    animated_entity.get_animation_lod_policy() = animation_parameters.lod_policy;
+}
+
+/// values[index] = values.back(), then drop the back
+template<typename T>
+static void swap_remove(std::vector<T>& values, uint index) {
+    values[index] = std::move(values.back());
+    values.pop_back();
+}
+
+void Animator::remove(uint dense_index) {
+    uint slot = dense_slots[dense_index];
+    ++slots[slot].generation;
+    free_slots.push_back(slot);
+
+    swap_remove(entities, dense_index);
+    swap_remove(parameters, dense_index);
+    swap_remove(dense_slots, dense_index);
+    swap_remove(time_targets, dense_index);
+    swap_remove(times, dense_index);
+    swap_remove(rates, dense_index);
+    swap_remove(durations, dense_index);
+    swap_remove(wraps, dense_index);
+    swap_remove(finished, dense_index);
+
+    if (dense_index < entities.size()) {
+        slots[dense_slots[dense_index]].dense_index = dense_index;
     }
 }
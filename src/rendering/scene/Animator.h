@@ -1,7 +1,10 @@
 #ifndef ANIMATOR_H
 #define ANIMATOR_H
 
-#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <cstdint>
 
 #include "rendering/scene/RenderedEntity.h"
 
@@ -10,99 +13,70 @@ struct AnimationParameters {
     bool loop = false;
     bool paused = false;
     double speed = 1.0;
+    // How the renderer cuts back posing the entity when it is small on screen
+    AnimationLodPolicy lod_policy{};
 };
 
-/// A class for controlling the animation for a set of animatable entities
+/// A class for controlling the animation for a set of animatable entities.
+/// The animating entities are packed densely, with each value that animate steps in an array of its own, so that a frame is
+/// a single pass over contiguous memory, two entities at a time with SSE2 or NEON where available. Each entity holds a handle to its slot (see AnimatorHandle), which leads to its
+/// place in the arrays, so nothing needs to be hashed to find it.
 class Animator {
-    std::unordered_map<std::shared_ptr<AnimatedEntityInterface>, AnimationParameters> animated_entities{};
+    struct Slot {
+        // Index into the dense arrays, while the slot is in use
+        uint dense_index = 0;
+        // Incremented each time the slot is freed, so that the handles of its previous entities no longer match
+        uint generation = 1;
+    };
+    std::vector<Slot> slots{};
+    std::vector<uint> free_slots{};
+
+    // The dense arrays, [dense index] -> value for each animating entity
+    std::vector<std::shared_ptr<AnimatedEntityInterface>> entities{};
+    std::vector<AnimationParameters> parameters{};
+    std::vector<uint> dense_slots{};
+    // The entity's get_animation_time_seconds, which times is gathered from and written back to
+    std::vector<double*> time_targets{};
+    std::vector<double> times{};
+    // Speed, or 0 while paused
+    std::vector<double> rates{};
+    std::vector<double> durations{};
+    // Whether the time wraps at the end, set for looping animations with a duration
+    std::vector<uint8_t> wraps{};
+    // Set by animate for the entities that reached the end this frame
+    std::vector<uint8_t> finished{};
+
+    /// Dense index of the entity, if it is animating
+    std::optional<uint> find(AnimatedEntityInterface& animated_entity) const;
+    /// Start tracking an entity that isn't animating
+    void insert(const std::shared_ptr<AnimatedEntityInterface>& animated_entity, const AnimationParameters& animation_parameters);
+    /// Copy the parameters into the dense arrays, and onto the entity
+    void set_parameters(uint dense_index, const AnimationParameters& animation_parameters);
+    /// Move the last entity into this one's place, and free its slot
+    void remove(uint dense_index);
 public:
     /// Animated each playing entity, incrementing time by dt.
     void animate(double dt);
 
     /// Start animating an entity with the given parameters. If it was already present then reset to t=0 and use new parameters.
-    template<class AnimatedEntity>
-    void start(std::shared_ptr<AnimatedEntity> animated_entity, AnimationParameters animation_parameters);
+    void start(const std::shared_ptr<AnimatedEntityInterface>& animated_entity, const AnimationParameters& animation_parameters);
 
     /// Update the parameters on an animating entity with the given parameters.
     /// If it was not already present then nothing happens.
-    template<class AnimatedEntity>
-    void update_param(std::shared_ptr<AnimatedEntity> animated_entity, AnimationParameters animation_parameters);
+    void update_param(const std::shared_ptr<AnimatedEntityInterface>& animated_entity, const AnimationParameters& animation_parameters);
 
     /// Pause an animating entity if it's currently play
-    template<class AnimatedEntity>
-    void pause(std::shared_ptr<AnimatedEntity> animated_entity);
+    void pause(const std::shared_ptr<AnimatedEntityInterface>& animated_entity);
 
     /// Resumes a paused entity, also updating the animation parameters.
     /// If the entity is not currently present, then start animating it with these parameters at t=0
-    template<class AnimatedEntity>
-    void resume(std::shared_ptr<AnimatedEntity> animated_entity, AnimationParameters animation_parameters);
+    void resume(const std::shared_ptr<AnimatedEntityInterface>& animated_entity, const AnimationParameters& animation_parameters);
 
     /// Checks if an entity is currently animating, if so returns it's current parameters.
-    template<class AnimatedEntity>
-    std::optional<AnimationParameters> is_animating(const std::shared_ptr<AnimatedEntity>& animated_entity);
+    std::optional<AnimationParameters> is_animating(const std::shared_ptr<AnimatedEntityInterface>& animated_entity) const;
 
     /// Stop an entity from animationg, does nothing it it was already stopped.
-    template<class AnimatedEntity>
-    void stop(const std::shared_ptr<AnimatedEntity>& animated_entity);
+    void stop(const std::shared_ptr<AnimatedEntityInterface>& animated_entity);
 };
 
-template<class AnimatedEntity>
-void Animator::start(std::shared_ptr<AnimatedEntity> animated_entity, AnimationParameters animation_parameters) {
-    stop(animated_entity);
-    auto aei = std::dynamic_pointer_cast<AnimatedEntityInterface>(animated_entity);
-    aei->get_animation_id() = animation_parameters.animation_id;
-    aei->get_animation_time_seconds() = 0.0;
-    animated_entities[aei] = animation_parameters;
-}
-
-template<class AnimatedEntity>
-void Animator::update_param(std::shared_ptr<AnimatedEntity> animated_entity, AnimationParameters animation_parameters) {
-    auto aei = std::dynamic_pointer_cast<AnimatedEntityInterface>(animated_entity);
-    auto param = animated_entities.find(aei);
-    if (param != animated_entities.end()) {
-        param->second = animation_parameters;
-    }
-}
-
-template<class AnimatedEntity>
-void Animator::pause(std::shared_ptr<AnimatedEntity> animated_entity) {
-    auto aei = std::dynamic_pointer_cast<AnimatedEntityInterface>(animated_entity);
-    auto param = animated_entities.find(aei);
-    if (param != animated_entities.end()) {
-        param->second.paused = true;
-    }
-}
-
-template<class AnimatedEntity>
-void Animator::resume(std::shared_ptr<AnimatedEntity> animated_entity, AnimationParameters animation_parameters) {
-    auto aei = std::dynamic_pointer_cast<AnimatedEntityInterface>(animated_entity);
-    auto param = animated_entities.find(aei);
-    if (param != animated_entities.end()) {
-        param->second = animation_parameters;
-        param->second.paused = false;
-    } else {
-        aei->get_animation_id() = animation_parameters.animation_id;
-        animated_entities[aei] = animation_parameters;
-    }
-}
-
-template<class AnimatedEntity>
-std::optional<AnimationParameters> Animator::is_animating(const std::shared_ptr<AnimatedEntity>& animated_entity) {
-    auto aei = std::dynamic_pointer_cast<AnimatedEntityInterface>(animated_entity);
-    auto param = animated_entities.find(aei);
-    if (param != animated_entities.end()) {
-        return param->second;
-    } else {
-        return std::nullopt;
-    }
-}
-
-template<class AnimatedEntity>
-void Animator::stop(const std::shared_ptr<AnimatedEntity>& animated_entity) {
-    auto aei = std::dynamic_pointer_cast<AnimatedEntityInterface>(animated_entity);
-    aei->get_animation_id() = NONE_ANIMATION;
-    aei->get_animation_time_seconds() = 0.0;
-    animated_entities.erase(aei);
-}
-
 #endif //ANIMATOR_H
@@ -0,0 +1,117 @@
+#include "Frustum.h"
+
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86)
+#include <xmmintrin.h>
+#define FRUSTUM_SSE
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define FRUSTUM_NEON
+#endif
+
+Frustum::Frustum(const glm::mat4& projection_view_matrix) {
+    const glm::mat4& m = projection_view_matrix;
+    // Rows of the matrix, glm is column major
+    glm::vec4 row_x = {m[0][0], m[1][0], m[2][0], m[3][0]};
+    glm::vec4 row_y = {m[0][1], m[1][1], m[2][1], m[3][1]};
+    glm::vec4 row_z = {m[0][2], m[1][2], m[2][2], m[3][2]};
+    glm::vec4 row_w = {m[0][3], m[1][3], m[2][3], m[3][3]};
+
+    std::array<glm::vec4, 6> planes = {
+        row_w + row_x, // Left
+        row_w - row_x, // Right
+        row_w + row_y, // Bottom
+        row_w - row_y, // Top
+        row_w + row_z, // Near
+        row_w - row_z, // Far
+    };
+
+    for (size_t i = 0; i < planes.size(); ++i) {
+        glm::vec4 plane = planes[i];
+        float length = std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+        if (length < 1e-6f) {
+            // Degenerate, as the far plane of an infinite projection is, so make it accept everything
+            plane = {0.0f, 0.0f, 0.0f, 1.0f};
+        } else {
+            // Normalised so that the plane equation gives a distance, which can be compared to a radius
+            plane /= length;
+        }
+        a[i] = plane.x;
+        b[i] = plane.y;
+        c[i] = plane.z;
+        d[i] = plane.w;
+    }
+}
+
+std::array<glm::vec4, 6> Frustum::get_planes() const {
+    std::array<glm::vec4, 6> planes{};
+    for (size_t i = 0; i < planes.size(); ++i) {
+        planes[i] = {a[i], b[i], c[i], d[i]};
+    }
+    return planes;
+}
+
+bool Frustum::intersects_sphere(glm::vec4 sphere) const {
+    for (size_t i = 0; i < 6; ++i) {
+        if (a[i] * sphere.x + b[i] * sphere.y + c[i] * sphere.z + d[i] < -sphere.w) return false;
+    }
+    return true;
+}
+
+void Frustum::cull_spheres(const std::vector<glm::vec4>& spheres, std::vector<uint8_t>& out_visible) const {
+    out_visible.resize(spheres.size());
+
+    size_t i = 0;
+#if defined(FRUSTUM_SSE)
+    for (; i + 4 <= spheres.size(); i += 4) {
+        // Transpose four (x, y, z, r) spheres into x, y, z, r registers
+        __m128 x = _mm_loadu_ps(&spheres[i][0]);
+        __m128 y = _mm_loadu_ps(&spheres[i + 1][0]);
+        __m128 z = _mm_loadu_ps(&spheres[i + 2][0]);
+        __m128 r = _mm_loadu_ps(&spheres[i + 3][0]);
+        _MM_TRANSPOSE4_PS(x, y, z, r);
+        __m128 negative_r = _mm_sub_ps(_mm_setzero_ps(), r);
+
+        // All lanes set, comparing zero with itself avoids needing SSE2 for an integer set
+        __m128 inside = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+        for (size_t p = 0; p < 6; ++p) {
+            __m128 distance = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(a[p])), _mm_mul_ps(y, _mm_set1_ps(b[p]))),
+                _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(c[p])), _mm_set1_ps(d[p]))
+            );
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negative_r));
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        for (int lane = 0; lane < 4; ++lane) {
+            out_visible[i + lane] = (uint8_t) ((mask >> lane) & 1);
+        }
+    }
+#elif defined(FRUSTUM_NEON)
+    for (; i + 4 <= spheres.size(); i += 4) {
+        // De-interleaving load, gives x, y, z, r registers directly
+        float32x4x4_t sphere = vld4q_f32(&spheres[i][0]);
+        float32x4_t negative_r = vnegq_f32(sphere.val[3]);
+
+        uint32x4_t inside = vdupq_n_u32(0xFFFFFFFF);
+        for (size_t p = 0; p < 6; ++p) {
+            float32x4_t distance = vdupq_n_f32(d[p]);
+            distance = vmlaq_n_f32(distance, sphere.val[0], a[p]);
+            distance = vmlaq_n_f32(distance, sphere.val[1], b[p]);
+            distance = vmlaq_n_f32(distance, sphere.val[2], c[p]);
+            inside = vandq_u32(inside, vcgeq_f32(distance, negative_r));
+        }
+
+        out_visible[i] = (uint8_t) (vgetq_lane_u32(inside, 0) & 1);
+        out_visible[i + 1] = (uint8_t) (vgetq_lane_u32(inside, 1) & 1);
+        out_visible[i + 2] = (uint8_t) (vgetq_lane_u32(inside, 2) & 1);
+        out_visible[i + 3] = (uint8_t) (vgetq_lane_u32(inside, 3) & 1);
+    }
+#endif
+
+    // Remainder, or everything if there is no SIMD support
+    for (; i < spheres.size(); ++i) {
+        out_visible[i] = intersects_sphere(spheres[i]) ? 1 : 0;
+    }
+}
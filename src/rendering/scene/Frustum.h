@@ -0,0 +1,62 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <array>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <unordered_set>
+
+#include <glm/glm.hpp>
+
+/// The six planes of a camera's view frustum, in world space, for rejecting geometry that can't be seen.
+class Frustum {
+    // Planes stored as structure of arrays, (a, b, c, d) such that a point is inside when dot((a, b, c), point) + d >= 0
+    std::array<float, 6> a{};
+    std::array<float, 6> b{};
+    std::array<float, 6> c{};
+    std::array<float, 6> d{};
+public:
+    /// Extract the planes from a combined projection and view matrix (Gribb & Hartmann).
+    /// Works with infinite projections, the far plane just never rejects anything.
+    explicit Frustum(const glm::mat4& projection_view_matrix);
+
+    /// The planes as (a, b, c, d), in the order left, right, bottom, top, near, far
+    [[nodiscard]] std::array<glm::vec4, 6> get_planes() const;
+    /// Whether a sphere, packed as (centre, radius), is at least partly inside the frustum
+    [[nodiscard]] bool intersects_sphere(glm::vec4 sphere) const;
+    /// Test many spheres, packed as (centre, radius), at once, writing 1 for each sphere that is at least partly inside and 0 otherwise.
+    /// Spheres are processed four at a time with SSE or NEON where available.
+    void cull_spheres(const std::vector<glm::vec4>& spheres, std::vector<uint8_t>& out_visible) const;
+};
+
+/// Finds which entities of a scene are inside a frustum, keeping its buffers between frames so culling doesn't allocate.
+class FrustumCuller {
+    std::vector<glm::vec4> spheres{};
+    std::vector<uint8_t> visible{};
+public:
+    /// Appends the entities whose `bounding_sphere(entity)` is inside the frustum to `out_entities` (which is cleared first)
+    template<typename Entity, typename BoundingSphereFn>
+    void cull(const Frustum& frustum, const std::unordered_set<std::shared_ptr<Entity>>& entities, BoundingSphereFn bounding_sphere, std::vector<const Entity*>& out_entities);
+};
+
+template<typename Entity, typename BoundingSphereFn>
+void FrustumCuller::cull(const Frustum& frustum, const std::unordered_set<std::shared_ptr<Entity>>& entities, BoundingSphereFn bounding_sphere, std::vector<const Entity*>& out_entities) {
+    out_entities.clear();
+    spheres.clear();
+    for (const auto& entity: entities) {
+        out_entities.push_back(entity.get());
+        spheres.push_back(bounding_sphere(*entity));
+    }
+
+    frustum.cull_spheres(spheres, visible);
+
+    // Compact in place, keeping the original order
+    size_t count = 0;
+    for (size_t i = 0; i < out_entities.size(); ++i) {
+        if (visible[i]) out_entities[count++] = out_entities[i];
+    }
+    out_entities.resize(count);
+}
+
+#endif //FRUSTUM_H
@@ -1,10 +1,66 @@
 #include "Lights.h"
 
+#include <cmath>
 #include <algorithm>
 // task h
 #include <type_traits>  // For std::is_same_v
+
+// Attenuation factors, must match point_light_calculation in lights.glsl
+static constexpr float ATTENUATION_CONSTANT = 0.01f;
+static constexpr float ATTENUATION_LINEAR = 0.2f;
+static constexpr float ATTENUATION_QUADRATIC = 0.05f;
+
+float PointLight::get_radius() const {
+    float intensity = std::max(colour.r, std::max(colour.g, colour.b)) * colour.a;
+
+    // Solve intensity / (a + b * d + c * d^2) = CUTOFF for d
+    float constant = ATTENUATION_CONSTANT - intensity / CUTOFF;
+    if (constant >= 0.0f) return 0.0f;
+
+    float discriminant = ATTENUATION_LINEAR * ATTENUATION_LINEAR - 4.0f * ATTENUATION_QUADRATIC * constant;
+    return (-ATTENUATION_LINEAR + std::sqrt(discriminant)) / (2.0f * ATTENUATION_QUADRATIC);
+}
+
 std::vector<PointLight> LightScene::get_nearest_point_lights(glm::vec3 target, size_t max_count, size_t min_count) const {
-    return get_nearest_lights(point_lights, target, max_count, min_count);
+    std::vector<PointLight> result{};
+    get_nearest_point_lights(target, max_count, min_count, result);
+    return result;
+}
+
+void LightScene::get_nearest_point_lights(glm::vec3 target, size_t max_count, size_t min_count, std::vector<PointLight>& out_lights, float target_radius) const {
+    out_lights.clear();
+
+    auto iterator = iterate_nearest_point_lights(target, target_radius);
+    while (out_lights.size() < max_count) {
+        const PointLight* point_light = iterator.next();
+        if (point_light == nullptr) break;
+        out_lights.push_back(*point_light);
+    }
+
+    while (out_lights.size() < min_count) {
+        out_lights.push_back(PointLight::off());
+    }
+}
+
+PointLightTree::NearestIterator LightScene::iterate_nearest_point_lights(glm::vec3 target, float target_radius) const {
+    ensure_spatial_index();
+    return point_light_tree.nearest(target, target_radius);
+}
+
+void LightScene::update_spatial_index() {
+    if (point_lights_changed) {
+        ensure_spatial_index();
+    } else {
+        point_light_tree.refit();
+    }
+}
+
+void LightScene::ensure_spatial_index() const {
+    // Also catch the set being edited directly without calling mark_point_lights_changed, as long as the size changed
+    if (point_lights_changed || point_light_tree.size() != point_lights.size()) {
+        point_light_tree.rebuild(point_lights);
+        point_lights_changed = false;
+    }
 }
 
 // task h
@@ -2,11 +2,14 @@
 #define LIGHTS_H
 
 #include <memory>
+#include <limits>
 #include <vector>
 #include <unordered_set>
 
 #include <glm/glm.hpp>
 
+#include "PointLightTree.h"
+
 /// A representation of a PointLight render scene element
 struct PointLight {
     PointLight() = default;
@@ -26,6 +29,13 @@ struct PointLight {
     // Alpha components are just used to store a scalar that is applied before passing to the GPU
     glm::vec4 colour{};
 
+    /// The fraction of a light's colour under which it is considered to no longer contribute
+    static constexpr float CUTOFF = 1.0f / 256.0f;
+
+    /// The distance at which the light's contribution drops below CUTOFF,
+    /// using the same attenuation as point_light_calculation in lights.glsl
+    [[nodiscard]] float get_radius() const;
+
     // On GPU format
     // alignas used to conform to std140 for direct binary usage with glsl
     struct Data {
@@ -61,6 +71,10 @@ struct DirectionalLight {
 
 /// A collection of each light type, with helpers that allow for selecting a subset of
 /// those lights on a proximity basis, since processing an unbounded number of lights on the GPU is bad idea.
+///
+/// Point lights are indexed by a PointLightTree, so point lights should be added and removed through
+/// add_point_light/remove_point_light (or mark_point_lights_changed called after editing the set directly),
+/// and update_spatial_index called once a frame before querying, to pick up lights that have moved.
 struct LightScene {
     std::unordered_set<std::shared_ptr<PointLight>> point_lights;
     // task h
@@ -73,26 +87,38 @@ struct LightScene {
     /// If a `min_count` > 0 is provided, it will provide at least that many, with filling empty
     /// slots with a "Black" light.
     ///
-    /// NOTE: This is VERY inefficient as is, since it currently (possibly) sorts all lights,
-    ///       then copies out up to `max_count` point lights, so is O(n log(n)) for
-    ///       n being the total number of point lights.
-    ///
-    ///       So an improvement would be to use a data structure which can accelerate this,
-    ///       as well as support incrementally getting the `k` nearest.
-    ///
+    /// Uses the spatial index, so only visits about as many lights as it returns.
     std::vector<PointLight> get_nearest_point_lights(glm::vec3 target, size_t max_count, size_t min_count = 0) const;
+    /// The same as above, but writes into `out_lights` (replacing its contents) so that the storage can be reused between calls.
+    /// If `target_radius` is finite, then lights which can't reach the sphere of that radius around `target` are left out.
+    void get_nearest_point_lights(glm::vec3 target, size_t max_count, size_t min_count, std::vector<PointLight>& out_lights,
+                                  float target_radius = std::numeric_limits<float>::infinity()) const;
+    /// Visit point lights in order of increasing distance from `target`, so that the caller can stop whenever it likes.
+    /// See PointLightTree::NearestIterator.
+    [[nodiscard]] PointLightTree::NearestIterator iterate_nearest_point_lights(glm::vec3 target, float target_radius = std::numeric_limits<float>::infinity()) const;
     // task h
     std::vector<DirectionalLight> get_directional_lights(size_t max_count, size_t min_count = 0) const;
 
     // Add these helper methods
     void add_point_light(std::shared_ptr<PointLight> light) {
         point_lights.insert(std::move(light));
+        point_lights_changed = true;
     }
 
-    void remove_point_light(const std::shared_ptr<PointLight>& light) {
-        point_lights.erase(light);
+    bool remove_point_light(const std::shared_ptr<PointLight>& light) {
+        bool removed = point_lights.erase(light) != 0;
+        point_lights_changed |= removed;
+        return removed;
     }
 
+    /// Needs to be called if `point_lights` is modified directly
+    void mark_point_lights_changed() {
+        point_lights_changed = true;
+    }
+
+    /// Rebuild the spatial index if the set of point lights changed, otherwise refit it for lights that moved
+    void update_spatial_index();
+
     // task h - add methods for directional lights
     void add_directional_light(std::shared_ptr<DirectionalLight> light) {
         directional_lights.insert(std::move(light));
@@ -104,6 +130,12 @@ struct LightScene {
 
 
 private:
+    // Mutable so that queries can lazily rebuild after the set changes
+    mutable PointLightTree point_light_tree{};
+    mutable bool point_lights_changed = true;
+
+    void ensure_spatial_index() const;
+
     template<typename Light>
     static std::vector<Light> get_nearest_lights(const std::unordered_set<std::shared_ptr<Light>>& lights, glm::vec3 target, size_t max_count, size_t min_count = 0);
 };
@@ -31,11 +31,11 @@ bool MasterRenderScene::remove_entity(const std::shared_ptr<EmissiveEntityRender
 }
 
 void MasterRenderScene::insert_light(std::shared_ptr<PointLight> point_light) {
-    light_scene.point_lights.insert(std::move(point_light));
+    light_scene.add_point_light(std::move(point_light));
 }
 
 bool MasterRenderScene::remove_light(const std::shared_ptr<PointLight>& point_light) {
-    return light_scene.point_lights.erase(point_light) != 0;
+    return light_scene.remove_point_light(point_light);
 }
 
 //task h
@@ -0,0 +1,158 @@
+#include "PointLightTree.h"
+
+#include <algorithm>
+
+#include "Lights.h"
+
+// Ordering for a min heap on distance
+template<typename Entry>
+static bool further(const Entry& lhs, const Entry& rhs) {
+    return lhs.distance_squared > rhs.distance_squared;
+}
+
+/// Whether something with a radius of influence `radius`, at `distance_squared` from the target, can reach the sphere around the target
+static bool reaches(float distance_squared, float radius, float target_radius) {
+    float reach = radius + target_radius;
+    return distance_squared <= reach * reach;
+}
+
+static float distance_squared_to_box(glm::vec3 point, glm::vec3 min, glm::vec3 max) {
+    glm::vec3 offset = glm::clamp(point, min, max) - point;
+    return glm::dot(offset, offset);
+}
+
+void PointLightTree::rebuild(const std::unordered_set<std::shared_ptr<PointLight>>& point_lights) {
+    lights.clear();
+    for (const auto& point_light: point_lights) {
+        lights.push_back(point_light.get());
+    }
+    radii.resize(lights.size());
+
+    nodes.clear();
+    if (!lights.empty()) {
+        build(0, (uint) lights.size());
+    }
+
+    refit();
+}
+
+uint PointLightTree::build(uint first, uint count) {
+    uint index = (uint) nodes.size();
+    nodes.push_back(Node{});
+
+    if (count <= LEAF_SIZE) {
+        nodes[index].right_or_first = first;
+        nodes[index].count = count;
+        return index;
+    }
+
+    // Split at the median along the axis the lights are most spread out on
+    glm::vec3 min = lights[first]->position;
+    glm::vec3 max = lights[first]->position;
+    for (uint i = first + 1; i < first + count; ++i) {
+        min = glm::min(min, lights[i]->position);
+        max = glm::max(max, lights[i]->position);
+    }
+    glm::vec3 extent = max - min;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+    uint half = count / 2;
+    auto begin = lights.begin() + first;
+    std::nth_element(begin, begin + half, begin + count, [axis](const PointLight* lhs, const PointLight* rhs) {
+        return lhs->position[axis] < rhs->position[axis];
+    });
+
+    build(first, half);
+    uint right = build(first + half, count - half);
+    // Can't hold a reference across the recursive calls, since they grow `nodes`
+    nodes[index].right_or_first = right;
+    nodes[index].count = 0;
+    return index;
+}
+
+void PointLightTree::refit() {
+    for (size_t i = 0; i < lights.size(); ++i) {
+        radii[i] = lights[i]->get_radius();
+    }
+
+    // Children are always stored after their parent, so walking backwards visits children first
+    for (auto i = (long) nodes.size() - 1; i >= 0; --i) {
+        Node& node = nodes[i];
+        if (node.count > 0) {
+            node.min = node.max = lights[node.right_or_first]->position;
+            node.max_radius = radii[node.right_or_first];
+            for (uint l = node.right_or_first + 1; l < node.right_or_first + node.count; ++l) {
+                node.min = glm::min(node.min, lights[l]->position);
+                node.max = glm::max(node.max, lights[l]->position);
+                node.max_radius = std::max(node.max_radius, radii[l]);
+            }
+        } else {
+            const Node& left = nodes[i + 1];
+            const Node& right = nodes[node.right_or_first];
+            node.min = glm::min(left.min, right.min);
+            node.max = glm::max(left.max, right.max);
+            node.max_radius = std::max(left.max_radius, right.max_radius);
+        }
+    }
+}
+
+size_t PointLightTree::size() const {
+    return lights.size();
+}
+
+PointLightTree::NearestIterator PointLightTree::nearest(glm::vec3 target, float target_radius) const {
+    return {*this, target, target_radius};
+}
+
+PointLightTree::NearestIterator::NearestIterator(const PointLightTree& tree, glm::vec3 target, float target_radius) :
+    tree(tree), target(target), target_radius(target_radius) {
+
+    tree.heap.clear();
+    if (tree.nodes.empty()) return;
+
+    const Node& root = tree.nodes[0];
+    float distance_squared = distance_squared_to_box(target, root.min, root.max);
+    if (reaches(distance_squared, root.max_radius, target_radius)) {
+        tree.heap.push_back({distance_squared, 0, false});
+    }
+}
+
+const PointLight* PointLightTree::NearestIterator::next(float* out_distance_squared) {
+    auto& heap = tree.heap;
+
+    // Nodes are keyed by the distance to their bounds, which is never more than the distance to any light inside them,
+    // so when a light reaches the top of the heap, nothing closer can still be hidden inside a node.
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), further<HeapEntry>);
+        HeapEntry entry = heap.back();
+        heap.pop_back();
+
+        if (entry.is_light) {
+            if (out_distance_squared != nullptr) *out_distance_squared = entry.distance_squared;
+            return tree.lights[entry.index];
+        }
+
+        const Node& node = tree.nodes[entry.index];
+        if (node.count > 0) {
+            for (uint l = node.right_or_first; l < node.right_or_first + node.count; ++l) {
+                glm::vec3 offset = tree.lights[l]->position - target;
+                float distance_squared = glm::dot(offset, offset);
+                if (reaches(distance_squared, tree.radii[l], target_radius)) {
+                    heap.push_back({distance_squared, l, true});
+                    std::push_heap(heap.begin(), heap.end(), further<HeapEntry>);
+                }
+            }
+        } else {
+            for (uint child: {entry.index + 1, node.right_or_first}) {
+                const Node& child_node = tree.nodes[child];
+                float distance_squared = distance_squared_to_box(target, child_node.min, child_node.max);
+                if (reaches(distance_squared, child_node.max_radius, target_radius)) {
+                    heap.push_back({distance_squared, child, false});
+                    std::push_heap(heap.begin(), heap.end(), further<HeapEntry>);
+                }
+            }
+        }
+    }
+
+    return nullptr;
+}
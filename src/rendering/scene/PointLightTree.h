@@ -0,0 +1,77 @@
+#ifndef POINT_LIGHT_TREE_H
+#define POINT_LIGHT_TREE_H
+
+#include <limits>
+#include <memory>
+#include <vector>
+#include <unordered_set>
+
+#include <glm/glm.hpp>
+
+#include "utility/HelperTypes.h"
+
+struct PointLight;
+
+/// A bounding volume hierarchy over a set of point lights, used to find the lights nearest to a point without looking at every light.
+///
+/// The topology is built once for a set of lights, then refit every frame so that lights can move without a rebuild.
+/// Each node also stores the largest radius of influence of the lights below it, so that queries for a target
+/// with a known size can skip whole subtrees of lights that can't reach it.
+///
+/// NOTE: Queries share a scratch buffer owned by the tree (so that they don't allocate), so only one NearestIterator may be in use at a time.
+class PointLightTree {
+    struct Node {
+        glm::vec3 min;
+        // For internal nodes, the index of the right child (the left child always directly follows its parent),
+        // for leaves, the index of the first light.
+        uint right_or_first;
+        glm::vec3 max;
+        // Zero for internal nodes
+        uint count;
+        float max_radius;
+    };
+
+    struct HeapEntry {
+        // Squared distance from the target to the node's bounds, or to the light
+        float distance_squared;
+        uint index;
+        bool is_light;
+    };
+
+    static constexpr uint LEAF_SIZE = 4;
+
+    std::vector<Node> nodes{};
+    std::vector<const PointLight*> lights{};
+    // Radius of influence of each light in `lights`, updated by refit
+    std::vector<float> radii{};
+
+    mutable std::vector<HeapEntry> heap{};
+public:
+    /// Visits the lights in order of increasing distance from a target, only doing as much work as is needed to find the next one.
+    class NearestIterator {
+        const PointLightTree& tree;
+        glm::vec3 target;
+        float target_radius;
+    public:
+        NearestIterator(const PointLightTree& tree, glm::vec3 target, float target_radius);
+
+        /// Returns the next nearest light, or nullptr if there are none left.
+        /// If a finite target_radius was given, lights whose radius of influence doesn't reach the sphere around the target are skipped.
+        const PointLight* next(float* out_distance_squared = nullptr);
+    };
+
+    /// Rebuild the hierarchy for a new set of lights, the lights must stay alive (and in the set) until the next rebuild.
+    void rebuild(const std::unordered_set<std::shared_ptr<PointLight>>& point_lights);
+    /// Recompute the bounds and radii for the current light positions and colours, without changing the topology.
+    void refit();
+
+    [[nodiscard]] size_t size() const;
+
+    /// Start an incremental nearest light query, see NearestIterator.
+    /// A target_radius of infinity means lights are never skipped for being out of reach.
+    [[nodiscard]] NearestIterator nearest(glm::vec3 target, float target_radius = std::numeric_limits<float>::infinity()) const;
+private:
+    uint build(uint first, uint count);
+};
+
+#endif //POINT_LIGHT_TREE_H
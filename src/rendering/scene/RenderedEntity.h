@@ -2,6 +2,8 @@
 #define RENDERED_ENTITY_H
 
 #include <memory>
+#include <cmath>
+#include <algorithm>
 
 #include "rendering/resources/ModelHandle.h"
 #include "rendering/resources/MeshHierarchy.h"
@@ -26,6 +28,40 @@ std::shared_ptr<RenderedEntity<VertexData, InstanceData, RenderData>> RenderedEn
     return std::make_shared<RenderedEntity<VertexData, InstanceData, RenderData>>(model_handle, instance_data, render_data);
 }
 
+/// How far the posing of an animated entity is cut back as it gets smaller on screen.
+/// Coverage is the height of the entity's bounds as a fraction of the viewport's height.
+struct AnimationLodPolicy {
+    bool enabled = true;
+    // At or above this coverage the pose is updated every frame, below it every (full_rate_coverage / coverage) frames...
+    float full_rate_coverage = 0.25f;
+    // ...up to every max_interval frames
+    uint max_interval = 8;
+    // Below this coverage the pose is held, until the entity grows again
+    float hold_coverage = 0.01f;
+    // Below this coverage minor bones are collapsed (see MeshHierarchy::minor_nodes)
+    float reduced_skeleton_coverage = 0.1f;
+
+    /// How many frames apart to update the pose at the given coverage, 0 to hold it
+    [[nodiscard]] uint update_interval(float coverage) const {
+        if (!enabled || coverage >= full_rate_coverage) return 1;
+        if (coverage < hold_coverage) return 0;
+        return std::min(max_interval, (uint) std::ceil(full_rate_coverage / coverage));
+    }
+};
+
+/// What an animated entity was last posed with by the renderer, so that the pose can be held between updates
+struct AnimationLodState {
+    uint animation_id = NONE_ANIMATION;
+    double time_seconds = 0.0;
+    bool reduced_skeleton = false;
+};
+
+/// Where an animating entity is in the Animator, only valid while the slot it names is still on the same generation
+struct AnimatorHandle {
+    uint slot = UINT_MAX;
+    uint generation = 0;
+};
+
 /// A base class for type-erased AnimatedEntity stuff.
 struct AnimatedEntityInterface {
     // [animation_id] -> (animation_name, ticks_per_second, duration_ticks)
@@ -33,6 +69,8 @@ struct AnimatedEntityInterface {
     [[nodiscard]] virtual uint& get_animation_id() = 0;
     [[nodiscard]] virtual double& get_animation_time_seconds() = 0;
     [[nodiscard]] virtual double get_animation_duration_seconds() const = 0;
+    [[nodiscard]] virtual AnimationLodPolicy& get_animation_lod_policy() = 0;
+    [[nodiscard]] virtual AnimatorHandle& get_animator_handle() = 0;
     virtual ~AnimatedEntityInterface() = default;
 };
 
@@ -46,6 +84,17 @@ struct AnimatedRenderedEntity : public AnimatedEntityInterface {
     // Animation Data
     uint animation_id = NONE_ANIMATION; // NONE_ANIMATION means disabled
     double animation_time_seconds = 0.0;
+    // Where sampling the animation was last up to, so playing forwards doesn't need to search for keys.
+    // Only a cache, so it is updated while rendering a const entity
+    mutable AnimationCursor animation_cursor{};
+    // Index of the first bone of this frame's pose in the renderer's bone palettes buffer, set ahead of rendering so mutable like the cursor
+    mutable uint bone_palette_offset = 0;
+    // How the pose is simplified when small on screen, set by the Animator
+    AnimationLodPolicy animation_lod_policy{};
+    // Updated by the renderer as it poses the entity, so mutable like the cursor
+    mutable AnimationLodState animation_lod_state{};
+    // Set by the Animator while the entity is animating
+    AnimatorHandle animator_handle{};
 
     AnimatedRenderedEntity(const std::shared_ptr<MeshHierarchy<VertexData>>& mesh_hierarchy, InstanceData instance_data, RenderData render_data);
 
@@ -70,6 +119,14 @@ struct AnimatedRenderedEntity : public AnimatedEntityInterface {
         const auto& [animation_name, ticks_per_second, duration_ticks] = mesh_hierarchy->animations[animation_id];
         return duration_ticks / ticks_per_second;
     }
+
+    [[nodiscard]] AnimationLodPolicy& get_animation_lod_policy() override {
+        return animation_lod_policy;
+    }
+
+    [[nodiscard]] AnimatorHandle& get_animator_handle() override {
+        return animator_handle;
+    }
 };
 
 template<typename VertexData, typename InstanceData, typename RenderData>
@@ -48,6 +48,8 @@ std::unique_ptr<EditorScene::AnimatedEntityElement> EditorScene::AnimatedEntityE
     new_entity->animation_parameters.speed = animation_parameters["speed"];
     new_entity->animation_parameters.paused = animation_parameters["paused"];
     new_entity->animation_parameters.loop = animation_parameters["loop"];
+    // Optional, since scenes saved before it existed don't have it
+    new_entity->animation_parameters.lod_policy.enabled = animation_parameters.value("lod_enabled", true);
     new_entity->rendered_entity->animation_id = animation_parameters["animation_id"];
     new_entity->rendered_entity->animation_time_seconds = animation_parameters["animation_time_seconds"];
 
@@ -73,6 +75,7 @@ json EditorScene::AnimatedEntityElement::into_json() const {
             {"speed", animation_parameters.speed},
             {"paused", animation_parameters.paused},
             {"loop", animation_parameters.loop},
+            {"lod_enabled", animation_parameters.lod_policy.enabled},
             {"animation_time_seconds", rendered_entity->animation_time_seconds},
         }}
     };
@@ -87,8 +90,9 @@ void EditorScene::AnimatedEntityElement::add_imgui_edit_section(MasterRenderScen
 
     ImGui::Text("Model & Textures");
     if (scene_context.model_loader.add_imgui_hierarchy_selector("Model Selection", rendered_entity->mesh_hierarchy)) {
+        // The animator keeps the old animation's duration until it is told otherwise
+        render_scene.animator.stop(rendered_entity);
         animation_parameters.animation_id = NONE_ANIMATION;
-        rendered_entity->animation_time_seconds = 0.0;
     }
     scene_context.texture_loader.add_imgui_texture_selector("Diffuse Texture", rendered_entity->render_data.diffuse_texture);
     scene_context.texture_loader.add_imgui_texture_selector("Specular Map", rendered_entity->render_data.specular_map_texture, false);
@@ -41,7 +41,7 @@ std::unique_ptr<EditorScene::EntityElement> EditorScene::EntityElement::from_jso
     new_entity->update_material_from_json(j);
 
     if (j.contains("model")) {
-        new_entity->rendered_entity->model = scene_context.model_loader.load_from_file<EntityRenderer::VertexData>(j["model"]);
+        new_entity->rendered_entity->model = scene_context.model_loader.load_from_file_async<EntityRenderer::VertexData>(j["model"]);
     }
     if (j.contains("diffuse_texture")) {
         new_entity->rendered_entity->render_data.diffuse_texture = texture_from_json(scene_context, j["diffuse_texture"]);
@@ -113,7 +113,7 @@ void EditorScene::EntityElement::load_json(const json& j, const SceneContext& sc
         update_material_from_json(j);
     }
     if (j.contains("model") && rendered_entity) {
-        rendered_entity->model = scene_context.model_loader.load_from_file<EntityRenderer::VertexData>(j["model"]);
+        rendered_entity->model = scene_context.model_loader.load_from_file_async<EntityRenderer::VertexData>(j["model"]);
     }
     if (j.contains("diffuse_texture") && rendered_entity) {
         rendered_entity->render_data.diffuse_texture = texture_from_json(scene_context, j["diffuse_texture"]);
@@ -35,7 +35,7 @@ std::shared_ptr<TextureHandle> EditorScene::SceneElement::texture_from_json(cons
         return scene_context.texture_loader.default_white_texture();
     }
 
-    return scene_context.texture_loader.load_from_file(json["filename"], json["is_srgb"], json["is_flipped"]);
+    return scene_context.texture_loader.load_from_file_async(json["filename"], json["is_srgb"], json["is_flipped"]);
 }
 
 void EditorScene::LocalTransformComponent::add_local_transform_imgui_edit_section(MasterRenderScene& /*render_scene*/, const SceneContext& scene_context) {
@@ -311,6 +311,10 @@ void EditorScene::AnimationComponent::add_animation_imgui_edit_section(MasterRen
                 render_scene.animator.update_param(entity, get_animation_parameters());
             }
         }
+
+        if (ImGui::Checkbox("Animation LOD", &get_animation_parameters().lod_policy.enabled) && is_playing) {
+            render_scene.animator.update_param(entity, get_animation_parameters());
+        }
     }
 }
 
@@ -0,0 +1,55 @@
+#include "BackgroundPool.h"
+
+#include <iostream>
+#include <algorithm>
+
+BackgroundPool::BackgroundPool(uint thread_count) {
+    workers.reserve(thread_count);
+    for (uint i = 0; i < thread_count; ++i) {
+        workers.emplace_back(&BackgroundPool::worker_loop, this);
+    }
+}
+
+void BackgroundPool::submit(std::function<void()> job) {
+    {
+        std::lock_guard lock(mutex);
+        jobs.push_back(std::move(job));
+    }
+    work_ready.notify_one();
+}
+
+void BackgroundPool::worker_loop() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock lock(mutex);
+            work_ready.wait(lock, [this]() { return stopping || !jobs.empty(); });
+            if (stopping) return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+
+        try {
+            job();
+        } catch (const std::exception& e) {
+            std::cerr << "Error in background job:" << std::endl;
+            std::cerr << e.what() << std::endl;
+        }
+    }
+}
+
+uint BackgroundPool::default_thread_count() {
+    return std::clamp(std::thread::hardware_concurrency() / 4, 1u, 4u);
+}
+
+BackgroundPool::~BackgroundPool() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+        jobs.clear();
+    }
+    work_ready.notify_all();
+    for (auto& worker: workers) {
+        worker.join();
+    }
+}
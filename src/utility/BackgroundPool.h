@@ -0,0 +1,37 @@
+#ifndef BACKGROUND_POOL_H
+#define BACKGROUND_POOL_H
+
+#include <mutex>
+#include <deque>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+#include "HelperTypes.h"
+
+/// Worker threads for jobs that run alongside the frames, such as loading files, where nothing waits for them to finish.
+/// Unlike ThreadPool, submitting returns straight away, and jobs hand their results back themselves (e.g. through a CompletionQueue).
+class BackgroundPool : NonCopyable {
+    std::vector<std::thread> workers{};
+
+    std::mutex mutex{};
+    std::condition_variable work_ready{};
+    std::deque<std::function<void()>> jobs{};
+    bool stopping = false;
+public:
+    explicit BackgroundPool(uint thread_count = default_thread_count());
+
+    /// Run job on one of the workers, some time later, in the order submitted. Exceptions that escape it are reported and dropped.
+    void submit(std::function<void()> job);
+
+    /// A few threads, leaving most of the cores to the frame
+    static uint default_thread_count();
+
+    /// Jobs yet to start are dropped, and running ones are waited for
+    ~BackgroundPool();
+private:
+    void worker_loop();
+};
+
+#endif //BACKGROUND_POOL_H
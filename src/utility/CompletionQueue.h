@@ -0,0 +1,59 @@
+#ifndef COMPLETION_QUEUE_H
+#define COMPLETION_QUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#include "HelperTypes.h"
+
+/// A queue that any number of threads push finished work onto, and a single thread (e.g. the render thread) takes it all back off.
+/// Pushing links a node onto the head with a compare-and-swap, and taking swaps the whole list out at once, so neither side ever
+/// locks or waits on the other.
+template<typename T>
+class CompletionQueue : NonCopyable {
+    struct Node {
+        T value;
+        Node* next;
+    };
+    std::atomic<Node*> head{nullptr};
+public:
+    CompletionQueue() = default;
+
+    /// Safe to call from any thread
+    void push(T value);
+    /// Everything pushed since the last call, in the order it was pushed. Only one thread may take at a time.
+    std::vector<T> take_all();
+
+    ~CompletionQueue();
+};
+
+template<typename T>
+void CompletionQueue<T>::push(T value) {
+    auto* node = new Node{std::move(value), head.load(std::memory_order_relaxed)};
+    // On failure node->next is updated to the current head, ready to try again
+    while (!head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed)) {}
+}
+
+template<typename T>
+std::vector<T> CompletionQueue<T>::take_all() {
+    Node* node = head.exchange(nullptr, std::memory_order_acquire);
+
+    std::vector<T> values{};
+    while (node != nullptr) {
+        values.push_back(std::move(node->value));
+        Node* next = node->next;
+        delete node;
+        node = next;
+    }
+    // The list is newest first
+    std::reverse(values.begin(), values.end());
+    return values;
+}
+
+template<typename T>
+CompletionQueue<T>::~CompletionQueue() {
+    take_all();
+}
+
+#endif //COMPLETION_QUEUE_H
@@ -0,0 +1,31 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstdint>
+#include <cstddef>
+#include <filesystem>
+
+#include "MappedFile.h"
+
+/// FNV-1a, a simple and fast (though not cryptographic) hash, used to name on-disk caches (see MeshCache and TextureCache)
+namespace Hash {
+    constexpr uint64_t FNV_OFFSET_BASIS = 0xCBF29CE484222325ull;
+    constexpr uint64_t FNV_PRIME = 0x100000001B3ull;
+
+    /// Hash the bytes, continuing on from hash
+    inline uint64_t hash_bytes(const void* data, size_t size, uint64_t hash = FNV_OFFSET_BASIS) {
+        const auto* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ bytes[i]) * FNV_PRIME;
+        }
+        return hash;
+    }
+
+    /// Hash the contents of the file, throwing if it can't be read
+    inline uint64_t hash_file(const std::filesystem::path& file) {
+        MappedFile contents(file);
+        return hash_bytes(contents.data(), contents.size());
+    }
+}
+
+#endif //HASH_H
@@ -62,4 +62,15 @@ struct TripleHash {
     }
 };
 
+/// A hasher to allow using a 4-tuple as a key for an unordered_map or unordered_set
+struct QuadHash {
+    template<class T1, class T2, class T3, class T4>
+    std::size_t operator()(const std::tuple<T1, T2, T3, T4>& quad) const {
+        return std::hash<T1>()(std::get<0>(quad))
+               ^ (std::hash<T2>()(std::get<1>(quad)) << 3)
+               ^ (std::hash<T3>()(std::get<2>(quad)) << 7)
+               ^ (std::hash<T4>()(std::get<3>(quad)) << 11);
+    }
+};
+
 #endif //HELPER_TYPES_H
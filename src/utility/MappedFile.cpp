@@ -0,0 +1,82 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::filesystem::path& path) {
+    file_handle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        file_handle = nullptr;
+        throw std::runtime_error(Formatter() << "Failed to open file for mapping (" << path.string() << ")");
+    }
+
+    LARGE_INTEGER file_size{};
+    GetFileSizeEx(file_handle, &file_size);
+    length = (size_t) file_size.QuadPart;
+    // An empty file can't be mapped, but is still a valid (empty) view
+    if (length == 0) return;
+
+    mapping_handle = CreateFileMappingW(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_handle != nullptr) {
+        contents = static_cast<const std::byte*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (contents == nullptr) {
+        if (mapping_handle != nullptr) CloseHandle(mapping_handle);
+        CloseHandle(file_handle);
+        throw std::runtime_error(Formatter() << "Failed to map file (" << path.string() << ")");
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (contents != nullptr) UnmapViewOfFile(contents);
+    if (mapping_handle != nullptr) CloseHandle(mapping_handle);
+    if (file_handle != nullptr) CloseHandle(file_handle);
+}
+#else
+MappedFile::MappedFile(const std::filesystem::path& path) {
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        throw std::runtime_error(Formatter() << "Failed to open file for mapping (" << path.string() << ")");
+    }
+
+    struct stat file_stat{};
+    if (fstat(file, &file_stat) != 0) {
+        close(file);
+        throw std::runtime_error(Formatter() << "Failed to read the size of file (" << path.string() << ")");
+    }
+    length = (size_t) file_stat.st_size;
+
+    // An empty file can't be mapped, but is still a valid (empty) view
+    if (length != 0) {
+        void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file, 0);
+        if (mapping == MAP_FAILED) {
+            close(file);
+            throw std::runtime_error(Formatter() << "Failed to map file (" << path.string() << ")");
+        }
+        contents = static_cast<const std::byte*>(mapping);
+    }
+    // The mapping keeps its own reference to the file
+    close(file);
+}
+
+MappedFile::~MappedFile() {
+    if (contents != nullptr) munmap(const_cast<std::byte*>(contents), length);
+}
+#endif
+
+const std::byte* MappedFile::data() const {
+    return contents;
+}
+
+size_t MappedFile::size() const {
+    return length;
+}
@@ -0,0 +1,29 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <filesystem>
+
+#include "HelperTypes.h"
+
+/// A whole file mapped read-only into memory, rather than read into a buffer, so that only the pages actually touched are loaded
+/// and nothing is copied on the way. The contents stay valid for as long as the MappedFile does.
+class MappedFile : NonCopyable {
+    const std::byte* contents = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#endif
+public:
+    /// Map the file at path, throwing if it can't be opened or mapped
+    explicit MappedFile(const std::filesystem::path& path);
+
+    /// Start of the file, aligned to a page
+    [[nodiscard]] const std::byte* data() const;
+    [[nodiscard]] size_t size() const;
+
+    ~MappedFile();
+};
+
+#endif //MAPPED_FILE_H
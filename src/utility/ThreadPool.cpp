@@ -0,0 +1,89 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(uint thread_count) {
+    workers.reserve(thread_count);
+    for (uint i = 0; i < thread_count; ++i) {
+        workers.emplace_back(&ThreadPool::worker_loop, this);
+    }
+}
+
+void ThreadPool::parallel_for(size_t count, const std::function<void(size_t begin, size_t end)>& fn) {
+    if (count == 0) return;
+    if (workers.empty() || count == 1) {
+        fn(0, count);
+        return;
+    }
+
+    {
+        std::lock_guard lock(mutex);
+        job = &fn;
+        job_count = count;
+        // A few chunks per thread, so that uneven work still balances out
+        chunk_size = std::max<size_t>(1, count / ((workers.size() + 1) * 4));
+        next_begin = 0;
+        job_exception = nullptr;
+        busy = workers.size();
+        ++generation;
+    }
+    work_ready.notify_all();
+
+    run_chunks();
+
+    std::unique_lock lock(mutex);
+    work_done.wait(lock, [this]() { return busy == 0; });
+    job = nullptr;
+    if (job_exception != nullptr) {
+        std::rethrow_exception(job_exception);
+    }
+}
+
+void ThreadPool::run_chunks() {
+    size_t begin;
+    while ((begin = next_begin.fetch_add(chunk_size)) < job_count) {
+        try {
+            (*job)(begin, std::min(begin + chunk_size, job_count));
+        } catch (...) {
+            std::lock_guard lock(mutex);
+            if (job_exception == nullptr) job_exception = std::current_exception();
+        }
+    }
+}
+
+void ThreadPool::worker_loop() {
+    size_t seen_generation = 0;
+    while (true) {
+        {
+            std::unique_lock lock(mutex);
+            work_ready.wait(lock, [this, seen_generation]() { return stopping || generation != seen_generation; });
+            if (stopping) return;
+            seen_generation = generation;
+        }
+
+        run_chunks();
+
+        std::lock_guard lock(mutex);
+        if (--busy == 0) work_done.notify_one();
+    }
+}
+
+uint ThreadPool::get_thread_count() const {
+    return (uint) workers.size() + 1;
+}
+
+uint ThreadPool::default_thread_count() {
+    uint cores = std::thread::hardware_concurrency();
+    return cores > 1 ? cores - 1 : 0;
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (auto& worker: workers) {
+        worker.join();
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+#include "HelperTypes.h"
+
+/// A fixed set of worker threads, for splitting up work that must be finished before the frame can carry on (e.g. posing animated entities).
+class ThreadPool : NonCopyable {
+    std::vector<std::thread> workers{};
+
+    std::mutex mutex{};
+    std::condition_variable work_ready{};
+    std::condition_variable work_done{};
+    // Incremented for each job, so workers can tell a new job from a spurious wake up
+    size_t generation = 0;
+    // Workers yet to finish the current job
+    size_t busy = 0;
+    bool stopping = false;
+
+    // The current job
+    const std::function<void(size_t begin, size_t end)>* job = nullptr;
+    size_t job_count = 0;
+    size_t chunk_size = 1;
+    std::atomic<size_t> next_begin{0};
+    std::exception_ptr job_exception{};
+public:
+    /// Start the workers, by default one per core other than the calling thread's, since it does its share of the work too
+    explicit ThreadPool(uint thread_count = default_thread_count());
+
+    /// Call fn(begin, end) for chunks covering [0, count), spread across the workers and the calling thread, and return once every chunk is done.
+    /// fn is called concurrently, so must only touch what belongs to its own range. If any call throws, one of the exceptions is rethrown here.
+    void parallel_for(size_t count, const std::function<void(size_t begin, size_t end)>& fn);
+
+    [[nodiscard]] uint get_thread_count() const;
+
+    static uint default_thread_count();
+
+    ~ThreadPool();
+private:
+    void worker_loop();
+    /// Take chunks of the current job until there are none left
+    void run_chunks();
+};
+
+#endif //THREAD_POOL_H